@@ -0,0 +1,277 @@
+/*
+# Benchmark of the sampling pipeline
+
+This sketch measures how long each stage of the sampling pipeline takes on the target and how stable the sample rate
+of the HMC5883L is. Run it before and after updating the library to catch performance regressions.
+
+## Timing
+The stages are timed with the cycle counter of the CPU: CCOUNT on the ESP32 and the DWT cycle counter on Cortex-M3/M4/M7.
+Other targets fall back to micros(), which has a resolution of 4 microseconds on AVR, so the short stages read as 0 or 4 there.
+All results are printed in microseconds.
+
+## Output
+Every result is one CSV line, which can be copied into a spreadsheet or compared with diff:
+
+    stage,setting,count,min_us,mean_us,max_us,jitter_us
+
+jitter_us is the standard deviation. The sweeps are:
+
+    - The bus stages readRawSample, getData and update at 100 kHz and 400 kHz I2C clock.
+    - The CPU stages scaleData, calculateHeading with each heading method and calibration.
+    - The latency of a triggered measurement for 1, 2, 4 and 8 averaged samples.
+    - The interval between samples in continuous mode for 15 Hz, 30 Hz and 75 Hz output rate.
+
+For the output rates, count is the number of samples per second and the statistics describe the interval between them.
+*/
+#include <Arduino.h> // Include the Arduino core library
+#include <Wire.h>    // Include the Wire library for I2C communication
+
+#include "MultiCompassHMC5883L.h" // Include the custom MultiCompassHMC5883L library
+
+#define BENCHMARK_ITERATIONS 200   // Number of measurements of each stage
+#define BENCHMARK_RATE_WINDOW 2000 // Duration of each output rate measurement in milliseconds
+#define BENCHMARK_TRIGGER_TIMEOUT 100 // Longest wait for a triggered measurement in milliseconds
+
+#if defined(ARDUINO_ARCH_ESP32)
+// The ESP32 counts CPU cycles in the CCOUNT register.
+static inline uint32_t readCycles() { return ESP.getCycleCount(); }
+static float cyclesPerMicrosecond() { return getCpuFrequencyMhz(); }
+static void beginCycles() {}
+#elif defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__)
+// The DWT unit of the Cortex-M3/M4/M7 counts CPU cycles once it is enabled through the debug registers.
+#define BENCHMARK_DEMCR (*(volatile uint32_t *)0xE000EDFC)
+#define BENCHMARK_DWT_CTRL (*(volatile uint32_t *)0xE0001000)
+#define BENCHMARK_DWT_CYCCNT (*(volatile uint32_t *)0xE0001004)
+static inline uint32_t readCycles() { return BENCHMARK_DWT_CYCCNT; }
+static float cyclesPerMicrosecond() { return F_CPU / 1000000.0f; }
+static void beginCycles()
+{
+  BENCHMARK_DEMCR |= 1UL << 24; // TRCENA
+  BENCHMARK_DWT_CYCCNT = 0;
+  BENCHMARK_DWT_CTRL |= 1;      // CYCCNTENA
+}
+#else
+// Without a cycle counter the stages are timed in microseconds.
+static inline uint32_t readCycles() { return micros(); }
+static float cyclesPerMicrosecond() { return 1; }
+static void beginCycles() {}
+#endif
+
+typedef struct
+{
+  uint32_t count; // Number of measurements
+  uint32_t min;   // Shortest measurement in cycles
+  uint32_t max;   // Longest measurement in cycles
+  float mean;     // Running mean in cycles
+  float m2;       // Running sum of the squared differences to the mean
+} StageStats;
+
+// Reset the statistics of a stage
+void resetStats(StageStats *stats)
+{
+  stats->count = 0;
+  stats->min = UINT32_MAX;
+  stats->max = 0;
+  stats->mean = 0;
+  stats->m2 = 0;
+}
+
+// Add one measurement, the mean and variance are updated with Welford's method, so no samples have to be stored
+void addStats(StageStats *stats, uint32_t cycles)
+{
+  stats->count++;
+  stats->min = min(stats->min, cycles);
+  stats->max = max(stats->max, cycles);
+  float delta = cycles - stats->mean;
+  stats->mean += delta / stats->count;
+  stats->m2 += delta * (cycles - stats->mean);
+}
+
+// Print one CSV line, count can be replaced, e.g. by the samples per second
+void printStats(const char *stage, const char *setting, const StageStats *stats, float count)
+{
+  float scale = 1 / cyclesPerMicrosecond();
+  float jitter = stats->count > 1 ? sqrtf(stats->m2 / (stats->count - 1)) : 0;
+  Serial.print(stage);
+  Serial.print(',');
+  Serial.print(setting);
+  Serial.print(',');
+  Serial.print(count, 1);
+  Serial.print(',');
+  Serial.print(stats->count > 0 ? stats->min * scale : 0, 2);
+  Serial.print(',');
+  Serial.print(stats->mean * scale, 2);
+  Serial.print(',');
+  Serial.print(stats->max * scale, 2);
+  Serial.print(',');
+  Serial.println(jitter * scale, 2);
+}
+
+// Time a statement BENCHMARK_ITERATIONS times and print the result
+#define BENCHMARK_STAGE(stage, setting, statement)   \
+  do                                                 \
+  {                                                  \
+    StageStats stats;                                \
+    resetStats(&stats);                              \
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++)   \
+    {                                                \
+      uint32_t start = readCycles();                 \
+      statement;                                     \
+      addStats(&stats, readCycles() - start);        \
+    }                                                \
+    printStats(stage, setting, &stats, stats.count); \
+  } while (0)
+
+#if defined(ARDUINO_ARCH_ESP32)
+TwoWire I2C1 = TwoWire(0); // Create a TwoWire object named I2C1 using the 0th I2C bus
+#else
+TwoWire &I2C1 = Wire; // The other cores have one default bus on fixed pins
+#endif
+MultiCompassHMC5883L compass(&I2C1); // Create a MultiCompassHMC5883L object named compass, using the I2C1 bus
+
+const uint8_t STATUS_READY = 0x01; // RDY bit of the HMC5883L status register
+
+// Time the stages that access the bus at one I2C clock
+void benchmarkBus(uint32_t clock, const char *setting)
+{
+  I2C1.setClock(clock);
+  compass.setMode(HMC5883L_MODE_CONTINOUS);
+  CompassRawSample sample;
+  CompassData data = {};
+  BENCHMARK_STAGE("readRawSample", setting, compass.readRawSample(&sample));
+  BENCHMARK_STAGE("getData", setting, compass.getData(&data));
+  BENCHMARK_STAGE("update", setting, compass.update(&data, 0, 0, 1));
+}
+
+// Time the stages that only use the CPU
+void benchmarkCpu()
+{
+  CompassData data = {};
+  compass.getData(&data);
+  BENCHMARK_STAGE("scaleData", "-", compass.scaleData(&data));
+
+  compass.setHeadingMethod(COMPASS_HEADING_ATAN2);
+  BENCHMARK_STAGE("calculateHeading", "atan2", compass.calculateHeading(&data, 0, 0, 1));
+  compass.setHeadingMethod(COMPASS_HEADING_POLYNOMIAL);
+  BENCHMARK_STAGE("calculateHeading", "polynomial", compass.calculateHeading(&data, 0, 0, 1));
+  compass.setHeadingMethod(COMPASS_HEADING_TABLE);
+  BENCHMARK_STAGE("calculateHeading", "table", compass.calculateHeading(&data, 0, 0, 1));
+  compass.setHeadingMethod(COMPASS_HEADING_ATAN2);
+
+  // The bounds only widen on the first call, every further call measures the regular check
+  BENCHMARK_STAGE("calibration", "-", compass.calibration(&data));
+}
+
+// Time a triggered measurement from the trigger to the read of the result
+void benchmarkAveraging(HMC5883L_Samples samples, const char *setting)
+{
+  compass.setAveragedSamples(samples);
+  CompassData data = {};
+  StageStats stats;
+  resetStats(&stats);
+  for (int i = 0; i < BENCHMARK_ITERATIONS / 10; i++)
+  {
+    uint32_t start = readCycles();
+    unsigned long started = millis();
+    compass.triggerMeasurement();
+    while (!compass.getTriggeredData(&data))
+    {
+      // A sensor that stopped answering never reports a result
+      if (millis() - started > BENCHMARK_TRIGGER_TIMEOUT)
+      {
+        Serial.print("# triggered ");
+        Serial.print(setting);
+        Serial.println(": timeout");
+        return;
+      }
+    }
+    addStats(&stats, readCycles() - start);
+  }
+  printStats("triggered", setting, &stats, stats.count);
+}
+
+// Measure the sample rate and the interval jitter in continuous mode
+void benchmarkRate(HMC5883L_OutputRate rate, const char *setting)
+{
+  compass.setOutputRate(rate);
+  compass.setMode(HMC5883L_MODE_CONTINOUS);
+  CompassData data = {};
+  StageStats stats;
+  resetStats(&stats);
+  uint32_t last = 0;
+  bool first = true;
+  unsigned long start = millis();
+  while (millis() - start < BENCHMARK_RATE_WINDOW)
+  {
+    // Poll the RDY bit, reading the output registers clears it
+    if (!(compass.readByte(HMC5883L_REGISTER_STATUS) & STATUS_READY))
+    {
+      continue;
+    }
+    uint32_t now = readCycles();
+    compass.getData(&data);
+    if (!first)
+    {
+      addStats(&stats, now - last);
+    }
+    first = false;
+    last = now;
+  }
+  printStats("interval", setting, &stats, stats.count * 1000.0f / BENCHMARK_RATE_WINDOW);
+}
+
+void setup()
+{
+  Serial.begin(115200); // Initialize the serial communication at 115200 baud rate
+  delay(1000);          // Wait for 1 second to allow the serial communication to initialize
+  beginCycles();
+
+#if defined(ARDUINO_ARCH_ESP32)
+  I2C1.begin(26, 25); // Initialize the I2C communication with SDA pin at 26 and SCL pin at 25
+#else
+  I2C1.begin(); // Initialize the I2C communication on the default pins of the board
+#endif
+  CompassSetupStatus setup = compass.begin();
+  Serial.print("# ");
+  Serial.print(compass.getName());
+  Serial.print(": ");
+  Serial.println(MultiCompass::getSetupStatusName(setup));
+
+  // A fixed calibration, so scaleData and calculateHeading run the same code as in the field
+  CompassSetting settings = {};
+  settings.minX = -500;
+  settings.minY = -500;
+  settings.minZ = -500;
+  settings.maxX = 500;
+  settings.maxY = 500;
+  settings.maxZ = 500;
+  compass.setCalibration(&settings);
+  compass.setAveragedSamples(HMC5883L_SAMPLES_1);
+  compass.setOutputRate(HMC5883L_OUTPUTRATE_75HZ);
+
+  Serial.println("stage,setting,count,min_us,mean_us,max_us,jitter_us");
+  benchmarkBus(100000, "100kHz");
+  benchmarkBus(400000, "400kHz");
+  benchmarkCpu();
+
+  benchmarkAveraging(HMC5883L_SAMPLES_1, "1 sample");
+  benchmarkAveraging(HMC5883L_SAMPLES_2, "2 samples");
+  benchmarkAveraging(HMC5883L_SAMPLES_4, "4 samples");
+  benchmarkAveraging(HMC5883L_SAMPLES_8, "8 samples");
+  compass.setAveragedSamples(HMC5883L_SAMPLES_1);
+
+  benchmarkRate(HMC5883L_OUTPUTRATE_15HZ, "15Hz");
+  benchmarkRate(HMC5883L_OUTPUTRATE_30HZ, "30Hz");
+  benchmarkRate(HMC5883L_OUTPUTRATE_75HZ, "75Hz");
+
+  const CompassBusCounters &counters = compass.getBusCounters();
+  Serial.print("# transfers ");
+  Serial.print(counters.transfers);
+  Serial.print(", failures ");
+  Serial.println(counters.failures);
+}
+
+void loop()
+{
+  // The benchmark runs once, reset the board to repeat it
+}
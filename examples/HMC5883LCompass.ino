@@ -60,8 +60,24 @@ void setup()
   Serial.print("Mode:"); // Print "Mode:" to the serial monitor
   I2C1.begin(26, 25);    // Initialize the I2C communication with SDA pin at 26 and SCL pin at 25
 
+  // Identify the sensor and run its self test, the result fits into a single line of the boot log
+  CompassSetupStatus setup = compass.begin(true);
+  Serial.print(compass.getName());
+  Serial.print(" at 0x");
+  Serial.print(compass.adress, HEX);
+  Serial.print(": ");
+  Serial.print(MultiCompass::getSetupStatusName(setup));
+  Serial.print(" gain X:");
+  Serial.print(compass.gainCorrection[0], 3);
+  Serial.print(" Y:");
+  Serial.print(compass.gainCorrection[1], 3);
+  Serial.print(" Z:");
+  Serial.println(compass.gainCorrection[2], 3);
+
   compass.setMode(HMC5883L_Mode::HMC5883L_MODE_CONTINOUS);          // Set the HMC5883L compass sensor mode to continuous measurement mode
   compass.setAveragedSamples(HMC5883L_Samples::HMC5883L_SAMPLES_8); // Set the number of averaged samples to 8
+  compass.setHeadingMethod(COMPASS_HEADING_POLYNOMIAL);              // Calculate the heading without atan2f, within 0.1 degree
+  compass.setHeadingUnit(COMPASS_UNIT_DEGREES);                     // Report the heading in degrees
 
   // Insert the generated calibration here.
   /*
@@ -112,20 +128,21 @@ void loop()
     Serial.print(" Z:");
     Serial.print(data.scaledZ, 3);
     Serial.print("  H:");
-    Serial.print(data.heading / (2 * PI) * 360);
+    Serial.print(data.heading);
 
     // Check if this is the first successful calibration
     if (!oldCalibration)
     {
       // If it is, print the calibration settings for later use
+      const CompassSetting &current = compass.getCalibration();
       Serial.println("Copy this calibration at the bottom of the setup:");
       Serial.println("CompassSetting settings = {};");
-      Serial.println("settings.minX = " + String(compass.settings.minX) + ";");
-      Serial.println("settings.minY = " + String(compass.settings.minY) + ";");
-      Serial.println("settings.minZ = " + String(compass.settings.minZ) + ";");
-      Serial.println("settings.maxX = " + String(compass.settings.maxX) + ";");
-      Serial.println("settings.maxY = " + String(compass.settings.maxY) + ";");
-      Serial.println("settings.maxZ = " + String(compass.settings.maxZ) + ";");
+      Serial.println("settings.minX = " + String(current.minX) + ";");
+      Serial.println("settings.minY = " + String(current.minY) + ";");
+      Serial.println("settings.minZ = " + String(current.minZ) + ";");
+      Serial.println("settings.maxX = " + String(current.maxX) + ";");
+      Serial.println("settings.maxY = " + String(current.maxY) + ";");
+      Serial.println("settings.maxZ = " + String(current.maxZ) + ";");
       Serial.println("compass.setCalibration(&settings);");
     }
 
@@ -136,19 +153,20 @@ void loop()
   else
   {
     // If the calibration was not successful, print the current calibration settings
+    const CompassSetting &current = compass.getCalibration();
     Serial.print("Calibrating:");
     Serial.print(" minX:");
-    Serial.print(compass.settings.minX);
+    Serial.print(current.minX);
     Serial.print(" minY:");
-    Serial.print(compass.settings.minY);
+    Serial.print(current.minY);
     Serial.print(" minZ:");
-    Serial.print(compass.settings.minZ);
+    Serial.print(current.minZ);
     Serial.print(" maxX:");
-    Serial.print(compass.settings.maxX);
+    Serial.print(current.maxX);
     Serial.print(" maxY:");
-    Serial.print(compass.settings.maxY);
+    Serial.print(current.maxY);
     Serial.print(" maxZ:");
-    Serial.print(compass.settings.maxZ);
+    Serial.print(current.maxZ);
     Serial.println();
 
     // Wait for 10 milliseconds before looping again
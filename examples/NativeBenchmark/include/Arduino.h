@@ -0,0 +1,88 @@
+/**
+ * @file Arduino.h
+ * @brief Host replacement of the Arduino core
+ * This file contains the small part of the Arduino API the MultiCompass library uses, so it builds on the host.
+ * Time comes from the steady clock, the pin and interrupt functions do nothing.
+ */
+
+#ifndef MULTICOMPASS_NATIVE_ARDUINO_H
+#define MULTICOMPASS_NATIVE_ARDUINO_H
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <type_traits>
+
+#ifndef ARDUINO
+#define ARDUINO 10800
+#endif
+
+#define PI 3.1415926535897932384626433832795
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define OUTPUT_OPEN_DRAIN 0x13
+
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+#define NOT_AN_INTERRUPT -1
+
+#define IRAM_ATTR
+#define PROGMEM
+#define pgm_read_word(address) (*(const uint16_t *)(address))
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+// decltype of the conditional would be a reference to the parameters, so the common type is returned by value.
+template <typename A, typename B>
+static inline typename std::common_type<A, B>::type min(A a, B b) { return a < b ? a : b; }
+
+template <typename A, typename B>
+static inline typename std::common_type<A, B>::type max(A a, B b) { return a > b ? a : b; }
+
+#define constrain(amount, low, high) ((amount) < (low) ? (low) : ((amount) > (high) ? (high) : (amount)))
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+
+int digitalPinToInterrupt(uint8_t pin);
+void attachInterrupt(uint8_t interrupt, void (*handler)(void), int mode);
+void detachInterrupt(uint8_t interrupt);
+void noInterrupts();
+void interrupts();
+
+/**
+ * @class Print
+ * @brief Byte output, e.g. the target of a MultiCompassStream.
+ */
+class Print
+{
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t value) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t length)
+    {
+        size_t written = 0;
+        while (length-- > 0 && write(*buffer++) == 1)
+        {
+            written++;
+        }
+        return written;
+    }
+};
+
+#endif
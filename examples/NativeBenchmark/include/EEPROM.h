@@ -0,0 +1,25 @@
+/**
+ * @file EEPROM.h
+ * @brief Host replacement of the AVR EEPROM library, an erased EEPROM in memory.
+ */
+
+#ifndef MULTICOMPASS_NATIVE_EEPROM_H
+#define MULTICOMPASS_NATIVE_EEPROM_H
+
+#include "Arduino.h"
+
+class EEPROMClass
+{
+public:
+    EEPROMClass() { memset(cells, 0xFF, sizeof(cells)); }
+    uint8_t read(int address) { return cells[address]; }
+    void update(int address, uint8_t value) { cells[address] = value; }
+    uint16_t length() { return sizeof(cells); }
+
+private:
+    uint8_t cells[1024];
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
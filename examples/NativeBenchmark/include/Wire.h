@@ -0,0 +1,31 @@
+/**
+ * @file Wire.h
+ * @brief Host replacement of the Arduino Wire library
+ * A TwoWire object on the host is a bus without devices: every address is not acknowledged.
+ * Use a MultiCompassMockTransport to emulate a sensor.
+ */
+
+#ifndef MULTICOMPASS_NATIVE_WIRE_H
+#define MULTICOMPASS_NATIVE_WIRE_H
+
+#include "Arduino.h"
+
+class TwoWire
+{
+public:
+    TwoWire(uint8_t bus) { (void)bus; }
+    void begin() {}
+    void end() {}
+    void setClock(uint32_t frequency) { (void)frequency; }
+    void beginTransmission(uint8_t address) { (void)address; }
+    size_t write(uint8_t value) { (void)value; return 1; }
+    size_t write(const uint8_t *buffer, size_t length) { (void)buffer; return length; }
+    uint8_t endTransmission(bool stop = true) { (void)stop; return 2; }
+    uint8_t requestFrom(uint8_t address, uint8_t length) { (void)address; (void)length; return 0; }
+    int available() { return 0; }
+    int read() { return -1; }
+};
+
+extern TwoWire Wire;
+
+#endif
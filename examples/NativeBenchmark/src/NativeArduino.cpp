@@ -0,0 +1,89 @@
+/*
+ *   Copyright (c) 2023 Malte Hering
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <chrono>
+#include <thread>
+
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "Wire.h"
+
+static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+unsigned long millis()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+unsigned long micros()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+void delay(unsigned long ms)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(unsigned int us)
+{
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+    (void)pin;
+    (void)mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+    (void)pin;
+    (void)value;
+}
+
+int digitalRead(uint8_t pin)
+{
+    // Released bus lines are pulled up.
+    (void)pin;
+    return HIGH;
+}
+
+int digitalPinToInterrupt(uint8_t pin)
+{
+    (void)pin;
+    return NOT_AN_INTERRUPT;
+}
+
+void attachInterrupt(uint8_t interrupt, void (*handler)(void), int mode)
+{
+    (void)interrupt;
+    (void)handler;
+    (void)mode;
+}
+
+void detachInterrupt(uint8_t interrupt)
+{
+    (void)interrupt;
+}
+
+void noInterrupts() {}
+
+void interrupts() {}
+
+TwoWire Wire(0);
+EEPROMClass EEPROM;
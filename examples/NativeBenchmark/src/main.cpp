@@ -0,0 +1,272 @@
+/*
+ *   Copyright (c) 2023 Malte Hering
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Host benchmark of the MultiCompass math pipeline.
+ *
+ * A synthetic HMC5883L with hard and soft iron distortion and noise is replayed through a MultiCompassMockTransport.
+ * Every stage runs over all samples and reports nanoseconds per sample, the heading stages also report their error
+ * against the true heading. The exit code is 1 if an error exceeds its limit, so the benchmark doubles as a check.
+ *
+ *     pio run -e native -t exec
+ *     .pio/build/native/program 5000000
+ */
+
+#include <chrono>
+#include <stdio.h>
+#include <vector>
+
+#include "MultiCompassCalibration.h"
+#include "MultiCompassHMC5883L.h"
+#include "MultiCompassMockTransport.h"
+
+#define BENCHMARK_SAMPLES 1000000 // Default number of samples, the first argument replaces it
+#define BENCHMARK_FIELD 545.0f    // Earth field of 0.5 gauss at the default gain of 1090 LSB per gauss
+#define BENCHMARK_NOISE 2         // Noise of each axis in LSB
+
+static const float offset[3] = {80, -45, 30};    // Hard iron offset in LSB
+static const float softIron[3] = {1.1f, 0.9f, 1}; // Soft iron scale of each axis
+
+typedef struct
+{
+    double startTime; // Start of the stage in seconds
+    const char *name; // Name of the stage
+} Stage;
+
+typedef struct
+{
+    double sum;     // Sum of the squared errors in degrees
+    double worst;   // Largest error in degrees
+    uint32_t count; // Number of compared samples
+} HeadingError;
+
+static uint32_t randomState = 12345;
+static int failures = 0;
+
+// Linear congruential generator, the same samples on every host
+static float randomUnit()
+{
+    randomState = randomState * 1664525 + 1013904223;
+    return (randomState >> 8) * (1.0f / 16777216);
+}
+
+static double now()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void beginStage(Stage *stage, const char *name)
+{
+    stage->name = name;
+    stage->startTime = now();
+}
+
+static void endStage(const Stage *stage, size_t count)
+{
+    double seconds = now() - stage->startTime;
+    printf("%-30s %10.1f ns/sample %12.0f samples/s\n", stage->name, seconds * 1e9 / count, count / seconds);
+}
+
+static void addError(HeadingError *error, float heading, float truth)
+{
+    double difference = fabs(heading - truth);
+    if (difference > 180)
+    {
+        difference = 360 - difference;
+    }
+    error->sum += difference * difference;
+    error->worst = difference > error->worst ? difference : error->worst;
+    error->count++;
+}
+
+static void checkError(const char *name, const HeadingError *error, double limit)
+{
+    double rms = error->count > 0 ? sqrt(error->sum / error->count) : 0;
+    bool passed = error->worst <= limit;
+    printf("%-30s rms %.3f deg, worst %.3f deg, limit %.3f deg: %s\n", name, rms, error->worst, limit, passed ? "ok" : "FAILED");
+    if (!passed)
+    {
+        failures++;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : BENCHMARK_SAMPLES;
+
+    // Field directions evenly spread over the sphere, distorted like a sensor next to iron.
+    std::vector<CompassRawSample> samples(count);
+    std::vector<float> truth(count);
+    std::vector<bool> horizontal(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        float z = 2 * randomUnit() - 1;
+        float angle = 2 * (float)PI * randomUnit();
+        float radius = sqrtf(1 - z * z);
+        float field[3] = {radius * cosf(angle), radius * sinf(angle), z};
+        int16_t raw[3];
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float noise = (randomUnit() * 2 - 1) * BENCHMARK_NOISE;
+            raw[axis] = (int16_t)lroundf(field[axis] * BENCHMARK_FIELD * softIron[axis] + offset[axis] + noise);
+        }
+        samples[i].x = raw[0];
+        samples[i].y = raw[1];
+        samples[i].z = raw[2];
+        truth[i] = angle * (float)(180 / PI);
+        // Near the poles the noise dominates the heading.
+        horizontal[i] = radius > 0.5f;
+    }
+
+    // The mock answers like an HMC5883L, including its identification.
+    MultiCompassMockTransport mock(HMC5883L_ADDRESS);
+    mock.setRegister(HMC5883L_REGISTER_IDENT_A, HMC5883L_IDENT_A);
+    mock.setRegister(HMC5883L_REGISTER_IDENT_B, HMC5883L_IDENT_B);
+    mock.setRegister(HMC5883L_REGISTER_IDENT_C, HMC5883L_IDENT_C);
+    mock.setRegister(HMC5883L_REGISTER_CONFIG_B, HMC5883L_DEFAULT_CONFIG_B);
+    const CompassReplayLayout layout = HMC5883L_REPLAY_LAYOUT;
+    mock.setReplay(samples.data(), count, &layout, false);
+
+    MultiCompassHMC5883L compass(&mock);
+    CompassSetupStatus setup = compass.begin();
+    printf("%s on mock transport: %s, %u samples\n\n", compass.getName(), MultiCompass::getSetupStatusName(setup), (unsigned)count);
+    if (setup != COMPASS_SETUP_OK)
+    {
+        return 1;
+    }
+    compass.setHeadingUnit(COMPASS_UNIT_DEGREES);
+
+    Stage stage;
+    std::vector<CompassData> data(count);
+    beginStage(&stage, "getData (mock transport)");
+    for (size_t i = 0; i < count; i++)
+    {
+        compass.getData(&data[i]);
+    }
+    endStage(&stage, count);
+    if (mock.getReplayPosition() != count || data[count - 1].rawX != samples[count - 1].x)
+    {
+        printf("The replay lost samples\n");
+        return 1;
+    }
+
+    beginStage(&stage, "calibration (min/max)");
+    for (size_t i = 0; i < count; i++)
+    {
+        compass.calibration(&data[i]);
+    }
+    endStage(&stage, count);
+
+    MultiCompassCalibration ellipsoid;
+    beginStage(&stage, "addSample (ellipsoid)");
+    for (size_t i = 0; i < count; i++)
+    {
+        ellipsoid.addSample(&data[i]);
+    }
+    endStage(&stage, count);
+
+    beginStage(&stage, "scaleData (min/max)");
+    for (size_t i = 0; i < count; i++)
+    {
+        compass.scaleData(&data[i]);
+    }
+    endStage(&stage, count);
+
+    const CompassHeadingMethod methods[3] = {COMPASS_HEADING_ATAN2, COMPASS_HEADING_POLYNOMIAL, COMPASS_HEADING_TABLE};
+    const char *names[3] = {"calculateHeading (atan2)", "calculateHeading (polynomial)", "calculateHeading (table)"};
+    // Noise of 2 LSB at a horizontal field of at least 270 LSB, plus the error of the approximation.
+    const double limits[3] = {1.2, 1.3, 1.2};
+    for (int m = 0; m < 3; m++)
+    {
+        compass.setHeadingMethod(methods[m]);
+        beginStage(&stage, names[m]);
+        for (size_t i = 0; i < count; i++)
+        {
+            compass.calculateHeading(&data[i], 0, 0, 1);
+        }
+        endStage(&stage, count);
+
+        HeadingError error = {};
+        for (size_t i = 0; i < count; i++)
+        {
+            if (horizontal[i])
+            {
+                addError(&error, data[i].heading, truth[i]);
+            }
+        }
+        checkError(names[m], &error, limits[m]);
+    }
+
+    CompassSoftIron fit;
+    beginStage(&stage, "solve (ellipsoid)");
+    bool solved = ellipsoid.getSoftIron(&fit);
+    endStage(&stage, 1);
+    if (!solved)
+    {
+        printf("The ellipsoid fit failed\n");
+        return 1;
+    }
+    compass.setSoftIronCalibration(&fit);
+    compass.setHeadingMethod(COMPASS_HEADING_ATAN2);
+
+    beginStage(&stage, "scaleData (ellipsoid)");
+    for (size_t i = 0; i < count; i++)
+    {
+        compass.scaleData(&data[i]);
+    }
+    endStage(&stage, count);
+
+    // The fit does not know the rotation around the field, so only the spread of the error is meaningful.
+    HeadingError error = {};
+    for (size_t i = 0; i < count; i++)
+    {
+        compass.calculateHeading(&data[i], 0, 0, 1);
+        if (horizontal[i])
+        {
+            addError(&error, data[i].heading, truth[i]);
+        }
+    }
+    checkError("heading (ellipsoid)", &error, 1.5);
+
+    std::vector<CompassFixedData> fixed(count);
+    compass.clearSoftIronCalibration();
+    beginStage(&stage, "scaleData (fixed point)");
+    for (size_t i = 0; i < count; i++)
+    {
+        compass.scaleData(&samples[i], &fixed[i]);
+    }
+    endStage(&stage, count);
+
+    beginStage(&stage, "calculateHeading (fixed)");
+    for (size_t i = 0; i < count; i++)
+    {
+        compass.calculateHeading(&fixed[i], 0, 0, 1);
+    }
+    endStage(&stage, count);
+
+    error = {};
+    for (size_t i = 0; i < count; i++)
+    {
+        if (horizontal[i])
+        {
+            addError(&error, fixed[i].heading * (360.0f / MULTICOMPASS_ANGLE_FULL), truth[i]);
+        }
+    }
+    checkError("calculateHeading (fixed)", &error, 1.3);
+
+    return failures > 0 ? 1 : 0;
+}
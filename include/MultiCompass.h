@@ -16,29 +16,273 @@
 
 #include <Wire.h>
 
+#include "MultiCompassRingBuffer.h"
+#include "MultiCompassTransport.h"
+
+#if defined(ARDUINO_ARCH_ESP32)
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#endif
+
+#ifndef MULTICOMPASS_RING_SIZE
+#if defined(__AVR__)
+#define MULTICOMPASS_RING_SIZE 8 ///< Capacity of a MultiCompassSampleBuffer, has to be a power of two
+#else
+#define MULTICOMPASS_RING_SIZE 32 ///< Capacity of a MultiCompassSampleBuffer, has to be a power of two
+#endif
+#endif
+
+// Define MULTICOMPASS_FIXED_POINT to run scaleData and calculateHeading through the integer pipeline.
+// Define MULTICOMPASS_COMPACT to store the raw axes and the calibration bounds as int16_t, like the sensors deliver them.
+// Define MULTICOMPASS_NO_FLOAT to build without any float code, it implies MULTICOMPASS_COMPACT and removes the float only features.
+
+#if defined(MULTICOMPASS_NO_FLOAT) && !defined(MULTICOMPASS_COMPACT)
+#define MULTICOMPASS_COMPACT
+#endif
+
+#define MULTICOMPASS_DATAREADY_SLOTS 4 ///< Number of instances that can use the data ready interrupt at the same time
+
+#if defined(MULTICOMPASS_COMPACT)
+typedef int16_t CompassRawValue;      ///< Type of the raw axes and the calibration bounds.
+#define MULTICOMPASS_BOUND_LIMIT 32767 ///< Start value of the minimum bounds, the maximum bounds start at its negation
+#else
+typedef float CompassRawValue;         ///< Type of the raw axes and the calibration bounds.
+#define MULTICOMPASS_BOUND_LIMIT 100000 ///< Start value of the minimum bounds, the maximum bounds start at its negation
+#endif
+
+#if defined(MULTICOMPASS_NO_FLOAT)
+typedef int16_t CompassScaledValue;          ///< Type of the scaled axes, Q14 like CompassFixedData.
+typedef uint16_t CompassAngleValue;          ///< Type of the heading and the declination, a binary angle like CompassFixedData.
+typedef uint16_t CompassRawScaleValue;       ///< Type of rawScale, 4096 == 1.0.
+#define MULTICOMPASS_RAW_SCALE_ONE (1 << 12) ///< 1.0 of rawScale, which has 12 fractional bits without float support
+#else
+typedef float CompassScaledValue; ///< Type of the scaled axes.
+typedef float CompassAngleValue;  ///< Type of the heading and the declination, the declination is in radians.
+typedef float CompassRawScaleValue; ///< Type of rawScale.
+#endif
+
 typedef struct
 {
-    float rawX;
-    float rawY;
-    float rawZ;
-    float scaledX;
-    float scaledY;
-    float scaledZ;
-    float heading;
+    CompassRawValue rawX;
+    CompassRawValue rawY;
+    CompassRawValue rawZ;
+    CompassScaledValue scaledX;
+    CompassScaledValue scaledY;
+    CompassScaledValue scaledZ;
+    CompassAngleValue heading;
+    uint32_t timestamp; ///< Capture time in microseconds, taken right before the bus transfer or on the DRDY edge.
+    uint32_t sequence;  ///< Sample counter of the sensor, gaps show lost samples.
+    uint8_t flags;      ///< COMPASS_FLAG_* bits describing the quality of the sample.
 } CompassData;
 
+#define COMPASS_FLAG_OVERFLOW 0x01      ///< At least one axis of the sample saturated.
+#define COMPASS_FLAG_RANGE_CHANGED 0x02 ///< The sample may still be measured with the previous field range.
+#define COMPASS_FLAG_ANOMALY 0x04       ///< The calibrated field norm left the band around its baseline, e.g. next to a motor.
+
+#ifndef MULTICOMPASS_FIELD_WARMUP
+#define MULTICOMPASS_FIELD_WARMUP 32 ///< Samples averaged into a new field baseline before the check flags samples
+#endif
+#ifndef MULTICOMPASS_FIELD_ALPHA
+#define MULTICOMPASS_FIELD_ALPHA 0.01f ///< Weight of an unflagged sample in the running field baseline
+#endif
+#ifndef MULTICOMPASS_FIELD_STALE
+#define MULTICOMPASS_FIELD_STALE 64 ///< Flagged samples in a row after which the field baseline is learned again
+#endif
+
 typedef struct
 {
-    float minX;
-    float minY;
-    float minZ;
-    float maxX;
-    float maxY;
-    float maxZ;
-    float heading;
-    long long lastCalibration;
+    CompassRawValue minX;
+    CompassRawValue minY;
+    CompassRawValue minZ;
+    CompassRawValue maxX;
+    CompassRawValue maxY;
+    CompassRawValue maxZ;
+    CompassAngleValue heading;
+    uint32_t lastCalibration; ///< millis() when calibration() last widened the bounds.
 } CompassSetting;
 
+typedef struct
+{
+    int16_t x;
+    int16_t y;
+    int16_t z;
+    uint32_t timestamp; ///< Capture time in microseconds, taken right before the bus transfer or on the DRDY edge.
+    uint32_t sequence;  ///< Sample counter of the sensor, gaps show lost samples.
+} CompassRawSample;
+
+typedef MultiCompassRingBuffer<CompassRawSample, MULTICOMPASS_RING_SIZE> MultiCompassSampleBuffer;
+
+#if !defined(MULTICOMPASS_NO_FLOAT)
+typedef struct
+{
+    float *x;       ///< Scaled X axis of each sample.
+    float *y;       ///< Scaled Y axis of each sample.
+    float *z;       ///< Scaled Z axis of each sample.
+    float *heading; ///< Heading of each sample in the unit set with setHeadingUnit().
+} CompassBatch;
+
+typedef struct
+{
+    float east[3];  ///< Projection of the scaled field onto the horizontal east axis.
+    float north[3]; ///< Projection of the scaled field onto the horizontal north axis.
+} CompassTiltMatrix;
+#endif
+
+#define MULTICOMPASS_FIXED_ONE (1 << 14)      ///< 1.0 in the Q14 format of the scaled fixed point values
+#define MULTICOMPASS_FIXED_SCALE_SHIFT 8      ///< Fractional bits of the fixed point scale beyond Q14
+#define MULTICOMPASS_FIXED_MIN_RANGE 32       ///< Smallest half range that keeps the fixed point scaling in 32 bit
+#define MULTICOMPASS_ANGLE_FULL 65536UL       ///< A full turn (2*PI) in binary angle units
+#define MULTICOMPASS_DEGREES_TO_ANGLE(degrees) ((uint16_t)(int32_t)((degrees) * (65536.0 / 360) + ((degrees) < 0 ? -0.5 : 0.5))) ///< Converts a constant angle in degrees to a binary angle at compile time
+
+typedef struct
+{
+    int16_t scaledX;  ///< Scaled X axis in Q14, 16384 == 1.0.
+    int16_t scaledY;  ///< Scaled Y axis in Q14.
+    int16_t scaledZ;  ///< Scaled Z axis in Q14.
+    uint16_t heading; ///< Heading as binary angle, 65536 == 2*PI.
+} CompassFixedData;
+
+#if !defined(MULTICOMPASS_NO_FLOAT)
+typedef enum
+{
+    COMPASS_HEADING_ATAN2,      ///< atan2f() of the math library, exact but slow without an FPU.
+    COMPASS_HEADING_POLYNOMIAL, ///< Octant reduction and a cubic polynomial, within 0.1 degree.
+    COMPASS_HEADING_TABLE       ///< Octant reduction and an interpolated 256 entry table, within 0.001 degree.
+} CompassHeadingMethod;
+
+typedef enum
+{
+    COMPASS_UNIT_RADIANS, ///< Heading between 0 and 2*PI.
+    COMPASS_UNIT_DEGREES, ///< Heading between 0 and 360.
+    COMPASS_UNIT_BINARY   ///< Heading as binary angle between 0 and 65536.
+} CompassHeadingUnit;
+
+typedef struct
+{
+    float offset[3]; ///< Hard iron offset of each axis in raw units.
+    float matrix[9]; ///< Row major soft iron matrix, maps the raw values minus the offset onto the unit sphere.
+    bool valid;      ///< The calibration is used instead of the min/max calibration.
+} CompassSoftIron;
+#endif
+
+typedef struct
+{
+#if !defined(MULTICOMPASS_NO_FLOAT)
+    float offset[3];        ///< Hard iron offset of each axis in raw units.
+    float invScale[3];      ///< Reciprocal half range of each axis.
+#endif
+    int32_t offsetFixed[3]; ///< Hard iron offset of each axis in raw units.
+    int32_t scaleFixed[3];  ///< Reciprocal half range of each axis, scaled by 2^(14 + MULTICOMPASS_FIXED_SCALE_SHIFT).
+    int32_t limitFixed[3];  ///< Largest centered raw value of each axis whose product with its scale fits in 32 bit.
+    uint16_t declinationFixed; ///< Declination as binary angle.
+#if !defined(MULTICOMPASS_NO_FLOAT)
+    bool useMatrix;         ///< Apply the soft iron matrix instead of the per axis scale.
+    float matrix[9];        ///< Row major soft iron matrix.
+    int32_t matrixFixed[9]; ///< Soft iron matrix, scaled by 2^(14 + MULTICOMPASS_FIXED_SCALE_SHIFT).
+#endif
+} CompassCoefficients;
+
+typedef struct
+{
+    CompassSetting settings;          ///< The min/max calibration and the declination.
+#if !defined(MULTICOMPASS_NO_FLOAT)
+    CompassSoftIron softIron;         ///< The hard and soft iron calibration.
+#endif
+    CompassRawScaleValue rawScale[3]; ///< Factor of each axis from the current raw units to the raw units of the calibration.
+    CompassCoefficients coefficients; ///< The coefficients derived from both calibrations.
+} CompassCalibrationState;
+
+typedef enum
+{
+    COMPASS_SETUP_OK = 0,          ///< The sensor was identified and configured.
+    COMPASS_SETUP_NO_RESPONSE,     ///< No device acknowledged the address.
+    COMPASS_SETUP_WRONG_ID,        ///< A device answered, but its identification does not match the sensor.
+    COMPASS_SETUP_CONFIG_FAILED,   ///< The configuration could not be written.
+    COMPASS_SETUP_SELFTEST_FAILED, ///< The self test measured a gain outside of the limits of the datasheet.
+} CompassSetupStatus;
+
+typedef struct
+{
+    uint32_t transfers;          ///< Number of transfers, repeated attempts count once.
+    uint32_t failures;           ///< Number of transfers that failed after all retries.
+    uint32_t retries;            ///< Number of repeated attempts.
+    uint32_t errors;             ///< Number of failed attempts.
+    uint32_t nacks;              ///< Failed attempts because the sensor did not acknowledge.
+    uint32_t timeouts;           ///< Failed attempts because the sensor did not answer in time.
+    uint32_t busErrors;          ///< Failed attempts because of other bus errors.
+    uint32_t recoveries;         ///< Number of bus recoveries.
+    uint8_t consecutiveFailures; ///< Failed transfers since the last successful one.
+} CompassBusCounters;
+
+// Define MULTICOMPASS_NO_METRICS to remove the latency measurement of every transfer.
+
+#define MULTICOMPASS_LATENCY_BUCKETS 8 ///< Number of buckets of the latency histogram
+#define MULTICOMPASS_LATENCY_SHIFT 6   ///< Bucket 0 holds transfers below 2^6 microseconds, every further bucket doubles the limit
+
+typedef struct
+{
+    uint32_t elapsed;           ///< Milliseconds since the last reset.
+    uint32_t samples;           ///< Samples acquired since the last reset, without the lost ones.
+#if !defined(MULTICOMPASS_NO_FLOAT)
+    float sampleRate;           ///< Achieved samples per second since the last reset.
+#endif
+    uint32_t dataReadyOverruns; ///< Samples lost in data ready mode since the last reset.
+    uint32_t blockedTime;       ///< Microseconds spent in synchronous transfers, including their retries.
+    uint32_t maxLatency;        ///< Longest transfer in microseconds.
+    uint32_t latency[MULTICOMPASS_LATENCY_BUCKETS]; ///< Transfers per bucket, bucket i below 2^(MULTICOMPASS_LATENCY_SHIFT + i) microseconds, the last one without limit.
+    CompassBusCounters bus;     ///< Transfer and error counters since the last reset.
+} CompassMetrics;
+
+typedef enum
+{
+    COMPASS_STEP_SELECT = 0, ///< Writing the register pointer.
+    COMPASS_STEP_REQUEST,    ///< Requesting the bytes.
+    COMPASS_STEP_COLLECT,    ///< Waiting for the bytes.
+} CompassTransactionStep;
+
+class MultiCompass;
+
+/**
+ * @brief Function called when an asynchronous read is completed.
+ * @param compass The instance which executed the read.
+ * @param status The final status of the read.
+ * @param arg The argument given to startRead.
+ */
+typedef void (*CompassCallback)(MultiCompass *compass, CompassStatus status, void *arg);
+
+typedef struct
+{
+    uint8_t reg;
+    uint8_t *buffer;
+    uint8_t length;
+    CompassTransactionStep step;
+    unsigned long start;
+    CompassCallback callback;
+    void *arg;
+    volatile CompassStatus status;
+} CompassTransaction;
+
+#define MULTICOMPASS_BLOB_VERSION 1       ///< Layout version of the calibration blob
+#define MULTICOMPASS_CONFIG_BYTES 8       ///< Maximal number of sensor configuration bytes in the calibration blob
+#define MULTICOMPASS_BLOB_SIZE (84 + MULTICOMPASS_CONFIG_BYTES) ///< Maximal size of a calibration blob in bytes
+
+class MultiCompassStorage;
+
+class MultiCompassBiquad;
+class MultiCompassBiquadFixed;
+template <typename DATA, typename T, typename SUM, typename BIQUAD>
+class MultiCompassFilterStage;
+#if defined(MULTICOMPASS_NO_FLOAT)
+typedef MultiCompassFilterStage<CompassData, int16_t, int32_t, MultiCompassBiquadFixed> MultiCompassFilter;         ///< Filter stage of CompassData, which holds Q14 values without float support
+#else
+typedef MultiCompassFilterStage<CompassData, float, float, MultiCompassBiquad> MultiCompassFilter;                   ///< Filter stage of the float pipeline, see MultiCompassFilter.h
+#endif
+typedef MultiCompassFilterStage<CompassFixedData, int16_t, int32_t, MultiCompassBiquadFixed> MultiCompassFilterFixed; ///< Filter stage of the fixed point pipeline, see MultiCompassFilter.h
+
+#ifndef MULTICOMPASS_TIMEOUT
+#define MULTICOMPASS_TIMEOUT 5000 ///< Default timeout of a transfer in microseconds
+#endif
+
 /**
  * @class MultiCompass
  * @brief Class for reading data from multiple compass sensors and providing scaled and calibrated data.
@@ -54,11 +298,51 @@ public:
      */
     MultiCompass(TwoWire *wire);
 
+    /**
+     * @brief Constructor for MultiCompass class with another bus, e.g. a MultiCompassMockTransport.
+     * recoverBus() only writes the configuration again, it cannot reach the bus lines.
+     * @param transport Pointer to the transport, it has to outlive the instance.
+     */
+    MultiCompass(MultiCompassTransport *transport);
+
+    /**
+     * @brief Destructor for MultiCompass class.
+     */
+    virtual ~MultiCompass() {}
+
+    /**
+     * @brief Identifies and configures the sensor. The generic compass only checks that its address is acknowledged.
+     * @param selfTest Whether to run the self test of the sensor, if it has one.
+     * @return COMPASS_SETUP_OK if the sensor is ready, otherwise the reason of the failure.
+     */
+    virtual CompassSetupStatus begin(bool selfTest = false);
+
+    /**
+     * @brief Gets a short description of a transfer status for log messages.
+     * @param status The status.
+     * @return The description.
+     */
+    static const char *getStatusName(CompassStatus status);
+
+    /**
+     * @brief Gets a short description of a setup status for log messages.
+     * @param status The status.
+     * @return The description.
+     */
+    static const char *getSetupStatusName(CompassSetupStatus status);
+
+    /**
+     * @brief Gets the name of the sensor, e.g. to identify the sensors of a MultiCompassArray.
+     * @return The name of the sensor.
+     */
+    virtual const char *getName();
+
     /**
      * @brief Sets the declination angle for the compass.
-     * @param declinationAngle The declination angle in degrees.
+     * @param declinationAngle The declination angle in radians, a binary angle with MULTICOMPASS_NO_FLOAT,
+     * e.g. MULTICOMPASS_DEGREES_TO_ANGLE(3.5).
      */
-    void setDeclinationAngle(float declinationAngle);
+    void setDeclinationAngle(CompassAngleValue declinationAngle);
 
     /**
      * @brief Sets the calibration settings for the compass.
@@ -67,19 +351,206 @@ public:
     void setCalibration(CompassSetting *settings);
 
     /**
-     * @brief Gets the calibration settings for the compass.
+     * @brief Gets a copy of the calibration settings for the compass.
      * @param settings A pointer to a CompassSetting struct where the calibration settings will be stored.
      */
     void getCalibration(CompassSetting *settings);
 
+    /**
+     * @brief Gets the live calibration settings without copying them.
+     * @return A reference to the published calibration settings.
+     */
+    const CompassSetting &getCalibration();
+
+#if !defined(MULTICOMPASS_NO_FLOAT)
+    /**
+     * @brief Gets the live soft iron calibration without copying it.
+     * @return A reference to the published soft iron calibration.
+     */
+    const CompassSoftIron &getSoftIronCalibration();
+#endif
+
+    /**
+     * @brief Gets the live coefficients without copying them.
+     * @return A reference to the published coefficients.
+     */
+    const CompassCoefficients &getCoefficients();
+
+    /**
+     * @brief Gets the published settings, soft iron calibration and coefficients as one consistent snapshot.
+     * The calibration is double buffered: the snapshot stays untouched until the second next publishCalibration(),
+     * so a reader that uses it for one sample needs neither a lock nor a copy.
+     * @return A reference to the published state.
+     */
+    const CompassCalibrationState &acquireCalibration();
+
+    /**
+     * @brief Starts a calibration update on the unpublished copy of the state, initialized with the published one.
+     * Every writer takes the writer lock here until publishCalibration(): the setters, calibration(), the range
+     * changes of the drivers and a background calibration task. On ESP32 it is a spinlock, so the edit has to be
+     * short, must not block and has to be published.
+     * @return A pointer to the copy, to be modified and then published with publishCalibration().
+     */
+    CompassCalibrationState *editCalibration();
+
+    /**
+     * @brief Rebuilds the coefficients of the edited copy, publishes it atomically to the sampling path
+     * and releases the writer lock.
+     */
+    void publishCalibration();
+
+#if !defined(MULTICOMPASS_NO_FLOAT)
+    /**
+     * @brief Sets a hard and soft iron calibration, e.g. from a MultiCompassCalibration fit.
+     * While it is set, it replaces the min/max calibration of the settings.
+     * @param calibration A pointer to a CompassSoftIron struct containing the calibration.
+     */
+    void setSoftIronCalibration(const CompassSoftIron *calibration);
+
+    /**
+     * @brief Removes the soft iron calibration, the min/max calibration of the settings is used again.
+     */
+    void clearSoftIronCalibration();
+
+    /**
+     * @brief Enables the interference check of every acquired sample.
+     * The norm of the calibrated field is compared with a running baseline, which is learned again whenever
+     * the calibration is replaced, e.g. by setCalibration() or a loaded blob. The bounds widened by calibration()
+     * keep the baseline, so a disturbance during the calibration is still flagged and skipped. If
+     * MULTICOMPASS_FIELD_STALE samples in a row are flagged, the baseline is taken as stale, e.g. learned while
+     * the bounds of a new calibration were still narrow, and learned again.
+     * Samples outside the band are flagged with COMPASS_FLAG_ANOMALY.
+     * @param tolerance The allowed relative deviation of the norm from the baseline, e.g. 0.15, 0 disables the check.
+     * @param maxRate The allowed relative change of the norm per second, 0 disables the rate check.
+     * @param pauseCalibration Whether calibration() skips flagged samples.
+     */
+    void setFieldCheck(float tolerance, float maxRate = 0, bool pauseCalibration = true);
+
+    /**
+     * @brief Gets the baseline of the calibrated field norm.
+     * @return The baseline, 0 while it is learned.
+     */
+    float getFieldBaseline();
+
+    /**
+     * @brief Discards the baseline of the field norm, e.g. after moving to a place with another field strength.
+     * Only a request is recorded, the sampling path discards the baseline with its next sample, so it may be
+     * called from any context.
+     */
+    void resetFieldBaseline();
+
+    /**
+     * @brief Gets the factor from the current raw units of an axis to the raw units of the calibration.
+     * It changes with the field range, e.g. when auto-ranging switches the gain.
+     * @param axis The axis, 0 to 2.
+     * @return The factor.
+     */
+    float getRawScale(uint8_t axis);
+#endif
+
+    /**
+     * @brief Serializes the calibration settings, the soft iron calibration and the sensor configuration.
+     * The blob is versioned, little endian and protected by a CRC, so it can be stored as is.
+     * The coefficients are not part of the blob, they are rebuilt from the calibration when it is loaded.
+     * @param buffer A pointer to the buffer where the blob will be stored.
+     * @param length The size of the buffer, MULTICOMPASS_BLOB_SIZE is always sufficient.
+     * @return The length of the blob, 0 if the buffer is too small.
+     */
+    size_t serializeCalibration(uint8_t *buffer, size_t length);
+
+    /**
+     * @brief Restores the calibration and the sensor configuration from a blob.
+     * Nothing is changed unless the whole blob is valid.
+     * @param buffer A pointer to the blob.
+     * @param length The length of the buffer, may be larger than the blob.
+     * @return true if the blob was valid and the configuration was written to the sensor, false otherwise.
+     */
+    bool deserializeCalibration(const uint8_t *buffer, size_t length);
+
+    /**
+     * @brief Serializes the calibration and writes it to a storage.
+     * @param storage A pointer to the storage backend.
+     * @return true if the blob was stored, false otherwise.
+     */
+    bool saveCalibration(MultiCompassStorage *storage);
+
+    /**
+     * @brief Reads a blob from a storage and restores the calibration from it.
+     * @param storage A pointer to the storage backend.
+     * @return true if a valid blob was loaded, false otherwise.
+     */
+    bool loadCalibration(MultiCompassStorage *storage);
+
+    /**
+     * @brief Calculates a CRC-16/CCITT-FALSE checksum.
+     * @param data A pointer to the data.
+     * @param length The length of the data.
+     * @param crc The start value, or the result of the previous block to continue a checksum.
+     * @return The checksum.
+     */
+    static uint16_t crc16(const uint8_t *data, size_t length, uint16_t crc = 0xFFFF);
+
+    /**
+     * @brief Gets the sensor configuration that is stored with the calibration.
+     * @param buffer A pointer to the buffer where the configuration will be stored.
+     * @param length The size of the buffer.
+     * @return The number of configuration bytes, the generic compass has none.
+     */
+    virtual uint8_t getConfigBytes(uint8_t *buffer, uint8_t length);
+
+    /**
+     * @brief Restores the sensor configuration that was stored with the calibration.
+     * @param buffer A pointer to the configuration bytes.
+     * @param length The number of configuration bytes.
+     * @return true if the configuration was applied, false otherwise.
+     */
+    virtual bool setConfigBytes(const uint8_t *buffer, uint8_t length);
+
+    /**
+     * @brief Checks whether stored configuration bytes belong to this sensor, without applying them.
+     * @param buffer A pointer to the configuration bytes.
+     * @param length The number of configuration bytes.
+     * @return true if setConfigBytes() would accept them, false otherwise.
+     */
+    virtual bool checkConfigBytes(const uint8_t *buffer, uint8_t length);
+
     /**
      * @brief Scales the raw sensor data.
      * @param data A pointer to a CompassData struct containing the raw sensor data to be scaled.
      */
     void scaleData(CompassData *data);
 
+#if !defined(MULTICOMPASS_NO_FLOAT)
+    /**
+     * @brief Sets how the float pipeline calculates the heading, COMPASS_HEADING_ATAN2 by default.
+     * @param method The method, as a CompassHeadingMethod enum value.
+     */
+    void setHeadingMethod(CompassHeadingMethod method);
+
+    /**
+     * @brief Gets how the float pipeline calculates the heading.
+     * @return The method, as a CompassHeadingMethod enum value.
+     */
+    CompassHeadingMethod getHeadingMethod();
+
+    /**
+     * @brief Sets the unit of the float headings, COMPASS_UNIT_RADIANS by default.
+     * The declination is still set in radians, it is converted to the unit.
+     * @param unit The unit, as a CompassHeadingUnit enum value.
+     */
+    void setHeadingUnit(CompassHeadingUnit unit);
+
+    /**
+     * @brief Gets the unit of the float headings.
+     * @return The unit, as a CompassHeadingUnit enum value.
+     */
+    CompassHeadingUnit getHeadingUnit();
+#endif
+
     /**
      * @brief Calculates the heading based on the raw sensor data and current calibration settings.
+     * The heading uses the method of setHeadingMethod() and the unit of setHeadingUnit(),
+     * with MULTICOMPASS_NO_FLOAT it is a binary angle of the fixed point pipeline.
      * @param data A pointer to a CompassData struct containing the raw sensor data.
      * @param x The X axis of the sensor.
      * @param y The Y axis of the sensor.
@@ -87,6 +558,191 @@ public:
      */
     void calculateHeading(CompassData *data, int x, int y, int z);
 
+    /**
+     * @brief Scales an array of samples.
+     * @param data A pointer to an array of CompassData structs containing the raw sensor data.
+     * @param count The number of samples.
+     */
+    void scaleDataBatch(CompassData *data, size_t count);
+
+    /**
+     * @brief Calculates the heading of an array of scaled samples.
+     * @param data A pointer to an array of CompassData structs containing the scaled sensor data.
+     * @param count The number of samples.
+     * @param x The X axis of the sensor.
+     * @param y The Y axis of the sensor.
+     * @param z The Z axis of the sensor.
+     */
+    void calculateHeadingBatch(CompassData *data, size_t count, int x, int y, int z);
+
+#if !defined(MULTICOMPASS_NO_FLOAT)
+    /**
+     * @brief Scales an array of raw samples into separate axis arrays.
+     * The structure of arrays layout lets the compiler vectorize the loops on targets with SIMD extensions.
+     * @param samples A pointer to an array of raw samples.
+     * @param count The number of samples.
+     * @param batch A pointer to a CompassBatch struct, its x, y and z arrays need space for count values.
+     */
+    void scaleDataBatch(const CompassRawSample *samples, size_t count, CompassBatch *batch);
+
+    /**
+     * @brief Calculates the heading of scaled axis arrays.
+     * @param batch A pointer to a CompassBatch struct, its heading array needs space for count values.
+     * @param count The number of samples.
+     * @param x The X axis of the sensor.
+     * @param y The Y axis of the sensor.
+     * @param z The Z axis of the sensor.
+     */
+    void calculateHeadingBatch(CompassBatch *batch, size_t count, int x, int y, int z);
+
+    /**
+     * @brief Precomputes the tilt compensation for one attitude.
+     * The accelerometer vector has to point away from earth at rest, i.e. +1 g on the upwards axis.
+     * Its length does not matter. The heading is measured along the X axis, like calculateHeading(data, 0, 0, 1).
+     * @param ax The X axis of the accelerometer.
+     * @param ay The Y axis of the accelerometer.
+     * @param az The Z axis of the accelerometer.
+     * @param matrix A pointer to a CompassTiltMatrix struct where the projection will be stored.
+     */
+    void prepareTiltCompensation(float ax, float ay, float az, CompassTiltMatrix *matrix);
+
+    /**
+     * @brief Calculates the tilt compensated heading of a scaled sample.
+     * @param data A pointer to a CompassData struct containing the scaled sensor data.
+     * @param ax The X axis of the accelerometer.
+     * @param ay The Y axis of the accelerometer.
+     * @param az The Z axis of the accelerometer.
+     */
+    void calculateTiltCompensatedHeading(CompassData *data, float ax, float ay, float az);
+
+    /**
+     * @brief Calculates the tilt compensated heading of a scaled sample with a precomputed attitude.
+     * @param data A pointer to a CompassData struct containing the scaled sensor data.
+     * @param matrix A pointer to the precomputed CompassTiltMatrix.
+     */
+    void calculateTiltCompensatedHeading(CompassData *data, const CompassTiltMatrix *matrix);
+
+    /**
+     * @brief Calculates the tilt compensated heading of an array of scaled samples sharing one attitude.
+     * @param data A pointer to an array of CompassData structs containing the scaled sensor data.
+     * @param count The number of samples.
+     * @param ax The X axis of the accelerometer.
+     * @param ay The Y axis of the accelerometer.
+     * @param az The Z axis of the accelerometer.
+     */
+    void calculateTiltCompensatedHeadingBatch(CompassData *data, size_t count, float ax, float ay, float az);
+
+    /**
+     * @brief Calculates the tilt compensated heading of scaled axis arrays sharing one attitude.
+     * @param batch A pointer to a CompassBatch struct containing the scaled axes and receiving the headings.
+     * @param count The number of samples.
+     * @param ax The X axis of the accelerometer.
+     * @param ay The Y axis of the accelerometer.
+     * @param az The Z axis of the accelerometer.
+     */
+    void calculateTiltCompensatedHeadingBatch(CompassBatch *batch, size_t count, float ax, float ay, float az);
+#endif
+
+    /**
+     * @brief Scales a raw sample with integer operations only.
+     * @param sample A pointer to a CompassRawSample struct containing the raw sensor data.
+     * @param data A pointer to a CompassFixedData struct where the Q14 scaled data will be stored.
+     */
+    void scaleData(const CompassRawSample *sample, CompassFixedData *data);
+
+    /**
+     * @brief Calculates the heading of fixed point data with integer operations only.
+     * @param data A pointer to a CompassFixedData struct containing the scaled data, the heading is stored as binary angle.
+     * @param x The X axis of the sensor.
+     * @param y The Y axis of the sensor.
+     * @param z The Z axis of the sensor.
+     */
+    void calculateHeading(CompassFixedData *data, int x, int y, int z);
+
+    /**
+     * @brief Sets the filter stage of CompassData, applied by filterData() and filterHeading().
+     * The filter keeps the history of this sensor, so every sensor needs its own instance.
+     * @param filter A pointer to the filter, NULL to disable filtering.
+     */
+    void setFilter(MultiCompassFilter *filter);
+
+    /**
+     * @brief Sets the filter stage of the fixed point pipeline.
+     * @param filter A pointer to the filter, NULL to disable filtering.
+     */
+    void setFilter(MultiCompassFilterFixed *filter);
+
+    /**
+     * @brief Filters the scaled axes of a sample, call it between scaleData() and calculateHeading().
+     * Samples flagged with COMPASS_FLAG_OVERFLOW are passed unchanged and do not enter the filter history.
+     * @param data A pointer to a CompassData struct containing the scaled sensor data.
+     */
+    void filterData(CompassData *data);
+
+    /**
+     * @brief Filters the scaled axes of a fixed point sample, call it between scaleData() and calculateHeading().
+     * @param data A pointer to a CompassFixedData struct containing the scaled data.
+     */
+    void filterData(CompassFixedData *data);
+
+    /**
+     * @brief Filters the heading of a sample through its cosine and sine, call it after calculateHeading().
+     * @param data A pointer to a CompassData struct containing the heading.
+     */
+    void filterHeading(CompassData *data);
+
+    /**
+     * @brief Filters the binary angle heading of a fixed point sample, call it after calculateHeading().
+     * @param data A pointer to a CompassFixedData struct containing the heading.
+     */
+    void filterHeading(CompassFixedData *data);
+
+    /**
+     * @brief Calculates atan2 with a 32 bit integer CORDIC.
+     * @param y The y component, has to stay within +-2^17.
+     * @param x The x component, has to stay within +-2^17.
+     * @return The angle as binary angle, 65536 == 2*PI.
+     */
+    static uint16_t atan2Fixed(int32_t y, int32_t x);
+
+    /**
+     * @brief Calculates the sine and cosine of a binary angle with a 32 bit integer CORDIC.
+     * @param angle The angle as binary angle, 65536 == 2*PI.
+     * @param sine A pointer where the sine will be stored in Q14.
+     * @param cosine A pointer where the cosine will be stored in Q14.
+     */
+    static void sinCosFixed(uint16_t angle, int16_t *sine, int16_t *cosine);
+
+#if !defined(MULTICOMPASS_NO_FLOAT)
+    /**
+     * @brief Calculates atan2 with one of the heading methods.
+     * The approximations reduce the angle to the first octant with a single division, so they avoid atan2f entirely.
+     * @param y The y component.
+     * @param x The x component.
+     * @param method The method, as a CompassHeadingMethod enum value.
+     * @param turn The value of a full turn, e.g. 2*PI, 360 or 65536.
+     * @return The angle between 0 and turn.
+     */
+    static float atan2Turn(float y, float x, CompassHeadingMethod method, float turn);
+
+    /**
+     * @brief Calculates atan2 with one of the heading methods as binary angle.
+     * @param y The y component.
+     * @param x The x component.
+     * @param method The method, as a CompassHeadingMethod enum value.
+     * @return The angle as binary angle, 65536 == 2*PI.
+     */
+    static uint16_t atan2Angle(float y, float x, CompassHeadingMethod method);
+#endif
+
+    /**
+     * @brief Publishes a new rawScale together with the coefficients derived from it, e.g. after the field range changed.
+     * @param x The factor of the X axis.
+     * @param y The factor of the Y axis.
+     * @param z The factor of the Z axis.
+     */
+    void setRawScale(CompassRawScaleValue x, CompassRawScaleValue y, CompassRawScaleValue z);
+
     /**
      * @brief Writes a byte to the specified register on the compass sensor.
      * @param reg The register to write to.
@@ -94,6 +750,17 @@ public:
      */
     void writeByte(uint8_t reg, uint8_t value);
 
+    /**
+     * @brief Writes a block of consecutive registers on the compass sensor in a single transaction.
+     * The register pointer of the sensor has to increment automatically after each byte.
+     * A failed transfer is repeated up to retries times, each attempt takes at most the timeout.
+     * @param reg The first register to write to.
+     * @param buffer A pointer to the bytes to write.
+     * @param length The number of bytes to write.
+     * @return true if the block was written, false otherwise.
+     */
+    bool writeBytes(uint8_t reg, const uint8_t *buffer, uint8_t length);
+
     /**
      * @brief Reads a byte from the specified register on the compass sensor.
      * @param reg The register to read from.
@@ -109,23 +776,404 @@ public:
      */
     int readTwoBytes(uint8_t reg, bool LSB);
 
+    /**
+     * @brief Reads a block of consecutive registers from the compass sensor in a single transaction.
+     * The register pointer of the sensor has to increment automatically after each byte.
+     * A failed transfer is repeated up to retries times, each attempt takes at most the timeout.
+     * @param reg The first register to read from.
+     * @param buffer A pointer to the buffer where the read bytes will be stored.
+     * @param length The number of bytes to read.
+     * @return true if all requested bytes were received, false otherwise.
+     */
+    bool readBytes(uint8_t reg, uint8_t *buffer, uint8_t length);
+
+    /**
+     * @brief Starts an asynchronous read of consecutive registers.
+     * The read is advanced by pollRead() or, on ESP32, executed by the task started with startAsyncTask().
+     * Only the ESP32 task and the STM32 DMA transport overlap the transfer with the caller, with the Wire,
+     * bit-bang and ESP-IDF transports each step of pollRead() blocks for the duration of its bus transfer.
+     * Synchronous transfers of this instance fail with COMPASS_BUSY until the read is completed.
+     * @param reg The first register to read from.
+     * @param buffer A pointer to the buffer where the read bytes will be stored, has to stay valid until completion.
+     * @param length The number of bytes to read.
+     * @param callback A function called on completion, may be NULL.
+     * @param arg An argument passed to the callback.
+     * @return COMPASS_OK if the read was started, COMPASS_BUSY if another read is still pending.
+     */
+    CompassStatus startRead(uint8_t reg, uint8_t *buffer, uint8_t length, CompassCallback callback = NULL, void *arg = NULL);
+
+    /**
+     * @brief Advances the pending asynchronous read by one step.
+     * The register select and request steps block in the transport (e.g. Wire.requestFrom()) until their
+     * transfer is done, unless the STM32 DMA transport is used. On ESP32 with a running task, this only
+     * reports the state of the read.
+     * @return COMPASS_BUSY while the read is pending, otherwise the final status of the last read.
+     */
+    CompassStatus pollRead();
+
+    /**
+     * @brief Blocks until the pending asynchronous read is completed.
+     * @return The final status of the read.
+     */
+    CompassStatus waitRead();
+
+    /**
+     * @brief Gets the transport of all transfers of this sensor.
+     * @return A pointer to the transport.
+     */
+    MultiCompassTransport *getTransport();
+
+    /**
+     * @brief Gets the transfer and error counters of this sensor.
+     * @return A reference to the counters.
+     */
+    const CompassBusCounters &getBusCounters();
+
+    /**
+     * @brief Resets all transfer and error counters of this sensor.
+     */
+    void resetBusCounters();
+
+    /**
+     * @brief Takes a snapshot of the metrics of this sensor: sample rate, lost samples, bus counters and the latency histogram.
+     * Without MULTICOMPASS_NO_METRICS every transfer adds its duration to the histogram, which only costs a few shifts.
+     * @param metrics A pointer to a CompassMetrics struct where the snapshot will be stored.
+     */
+    void getMetrics(CompassMetrics *metrics);
+
+    /**
+     * @brief Starts a new measurement window of the metrics, the bus counters are reset as well.
+     */
+    void resetMetrics();
+
+    /**
+     * @brief Sets the pins and the clock of the bus, which recoverBus() needs to clock out a stuck sensor and to restart the bus.
+     * Setting the pins also enables the automatic recovery after recoveryThreshold failed transfers in a row.
+     * @param sda The GPIO of SDA.
+     * @param scl The GPIO of SCL.
+     * @param frequency The clock of the bus in Hz, 0 keeps the default of the core.
+     */
+    void setBusPins(int8_t sda, int8_t scl, uint32_t frequency = 0);
+
+    /**
+     * @brief Enables the bus timeout of the Wire object with the configured timeout, on cores that define WIRE_HAS_TIMEOUT.
+     * Without it, a stuck bus blocks forever in endTransmission() on AVR, so no failure is counted and the recovery
+     * never starts. begin(), setBusPins() and recoverBus() call it, call it again after changing timeout.
+     */
+    void enableWireTimeout();
+
+    /**
+     * @brief Frees a stuck bus and writes the shadowed configuration again.
+     * With known pins, SCL is clocked until the sensor releases SDA, a STOP condition is sent and the Wire object is
+     * restarted. This affects all sensors on the bus. Without pins, only the configuration is written.
+     * @return true if the bus lines are released and the configuration was written, false otherwise.
+     */
+    bool recoverBus();
+
+    /**
+     * @brief Writes the shadowed configuration to the sensor, e.g. after a bus recovery.
+     * @return true if the configuration was written, false otherwise.
+     */
+    virtual bool applyConfig();
+
+#if defined(ARDUINO_ARCH_ESP32)
+    /**
+     * @brief Starts a worker task which executes the asynchronous reads, so they overlap with the caller.
+     * The callback of a read is then called from the task.
+     * @param priority The FreeRTOS priority of the task.
+     * @param core The core the task is pinned to.
+     * @return true if the task was created, false otherwise.
+     */
+    bool startAsyncTask(UBaseType_t priority = 5, BaseType_t core = tskNO_AFFINITY);
+
+    /**
+     * @brief Stops the worker task of the asynchronous reads.
+     */
+    void stopAsyncTask();
+#endif
+
     /**
      * @brief Reads the raw sensor data and calculates the scaled and calibrated compass data.
      * @param data A pointer to a CompassData struct where the scaled and calibrated data will be stored.
+     * @return true if the sensor was read, false otherwise.
      */
-    void getData(CompassData *data);
+    virtual bool getData(CompassData *data);
+
+    /**
+     * @brief Reads one sample, scales and filters it and calculates its heading.
+     * The drivers override it with the statically dispatched chain of MultiCompassDriver::update().
+     * @param data A pointer to a CompassData struct where the sample will be stored.
+     * @param x The X axis of the sensor.
+     * @param y The Y axis of the sensor.
+     * @param z The Z axis of the sensor.
+     * @return true if the sensor was read, false otherwise.
+     */
+    virtual bool update(CompassData *data, int x = 0, int y = 0, int z = 1);
+
+    /**
+     * @brief Acquires several samples at once.
+     * In data ready mode the buffered samples are drained, otherwise a single new sample is read,
+     * because polling faster than the output rate would only repeat the last conversion.
+     * @param data A pointer to an array of CompassData structs where the raw data will be stored.
+     * @param count The size of the array.
+     * @return The number of acquired samples.
+     */
+    size_t getDataBatch(CompassData *data, size_t count);
 
     /**
      * @brief Calibrates the compass based on the current sensor data.
+     * The min and max values of each axis are widened by every sample, the calibration is complete
+     * once they did not change for calibrationPeriod milliseconds. Flagged samples are skipped.
      * @param data A pointer to a CompassData struct containing the current sensor data.
      * @return true if calibration was successful, false otherwise.
      */
-    bool calibration(CompassData *data);
+    virtual bool calibration(CompassData *data);
+
+    /**
+     * @brief Reads one raw sample from the sensor in a single burst transaction.
+     * This is the acquisition step used by the data ready mode and is implemented by each sensor.
+     * @param sample A pointer to a CompassRawSample struct where the raw sample will be stored.
+     * @return true if a sample was read, false otherwise.
+     */
+    virtual bool readRawSample(CompassRawSample *sample);
+
+    /**
+     * @brief Inspects every sample returned by getData() and getDataBatch() and sets its flags.
+     * Sensors override this to detect saturation or to adapt their configuration to the signal.
+     * @param data A pointer to a CompassData struct containing the raw sensor data.
+     */
+    virtual void checkSample(CompassData *data);
+
+    /**
+     * @brief Compares the calibrated field norm of an acquired sample with its baseline, see setFieldCheck().
+     * Unflagged samples update the baseline. Without float support the check is not available and does nothing.
+     * The sample is not scaled yet, so the check scales a copy of it.
+     * @param data A pointer to a CompassData struct containing the raw sensor data.
+     */
+    void checkField(CompassData *data);
+
+    /**
+     * @brief Compares the calibrated field norm of a sample that scaleData() already scaled with its baseline.
+     * @param data A pointer to a CompassData struct containing the scaled sensor data.
+     */
+    void checkScaledField(CompassData *data);
+
+    /**
+     * @brief Advances the sequence number atomically, as the data ready task and the caller both acquire samples.
+     * The interrupt state of the caller is restored on AVR and Cortex-M, so it may be called with masked interrupts.
+     * @param advance The number of samples to advance by, 0 only reads the sequence number.
+     * @return The sequence number after the advance.
+     */
+    uint32_t nextSequence(uint8_t advance = 1);
+
+    /**
+     * @brief Reads one raw sample and stamps it with the capture time and the next sequence number.
+     * @param sample A pointer to a CompassRawSample struct where the raw sample will be stored.
+     * @return true if a sample was read, false otherwise.
+     */
+    bool acquireSample(CompassRawSample *sample);
+
+    /**
+     * @brief Enables the data ready mode, which samples the sensor on every edge of its DRDY pin.
+     * The interrupt only schedules the read, the transfer itself is done by handleDataReady() or,
+     * on ESP32, by the task started with startDataReadyTask().
+     * @param pin The GPIO the DRDY pin of the sensor is connected to.
+     * @param buffer A pointer to the ring buffer that receives the samples, NULL to only count the edges.
+     * @param mode The interrupt edge that signals new data.
+     * @return true if the interrupt was attached, false otherwise.
+     */
+    bool beginDataReady(uint8_t pin, MultiCompassSampleBuffer *buffer, int mode = FALLING);
+
+    /**
+     * @brief Disables the data ready mode and detaches the interrupt.
+     */
+    void endDataReady();
 
-    CompassSetting settings; /**< The current calibration settings. */
-    TwoWire *mywire;         /**< Pointer to the Wire object for I2C communication. */
+    /**
+     * @brief Checks whether the data ready interrupt is attached.
+     * @return true if the data ready mode is enabled, false otherwise.
+     */
+    bool isDataReadyEnabled();
+
+    /**
+     * @brief Gets the number of data ready edges seen by the interrupt, the counter wraps at 256.
+     * @return The number of edges.
+     */
+    uint8_t getDataReadyCount();
+
+#if defined(ARDUINO_ARCH_ESP32)
+    /**
+     * @brief Starts a task which reads the sensor as soon as the data ready interrupt fires.
+     * With this task running, handleDataReady() must not be called from the main loop.
+     * @param priority The FreeRTOS priority of the task.
+     * @param core The core the task is pinned to.
+     * @return true if the task was created, false otherwise.
+     */
+    bool startDataReadyTask(UBaseType_t priority = 5, BaseType_t core = tskNO_AFFINITY);
+#endif
+
+    /**
+     * @brief Reads the sensor if the data ready interrupt fired since the last call.
+     * This is the producer of the sample buffer and has to be called from one context only.
+     * @return true if a new sample was added to the buffer, false otherwise.
+     */
+    bool handleDataReady();
+
+    /**
+     * @brief Gets the number of samples waiting in the data ready buffer.
+     * @return The number of buffered samples.
+     */
+    uint8_t availableSamples();
+
+    /**
+     * @brief Drains samples from the data ready buffer.
+     * @param samples A pointer to an array where the samples will be stored.
+     * @param maxCount The size of the array.
+     * @return The number of samples copied to the array.
+     */
+    uint8_t readSamples(CompassRawSample *samples, uint8_t maxCount);
+
+    /**
+     * @brief Interrupt handler of the data ready mode, only schedules the next read.
+     */
+    void onDataReady();
+
+    int calibrationPeriod = 1000; /**< The calibration period, in milliseconds. */
+    TwoWire *mywire;         /**< Pointer to the Wire object for I2C communication, NULL with another transport. */
     uint8_t adress;          /**< The I2C address of the compass sensor. */
+    uint32_t dataReadyOverruns = 0; /**< Number of samples lost in data ready mode. */
+    volatile uint32_t sequence = 0; /**< Sequence number of the last acquired sample, only accessed by nextSequence(). */
+#if defined(ARDUINO_ARCH_ESP32)
+    portMUX_TYPE sequenceLock = portMUX_INITIALIZER_UNLOCKED; /**< Lock of the sequence number across both cores. */
+#endif
+    uint32_t timeout = MULTICOMPASS_TIMEOUT; /**< Timeout of a transfer in microseconds. */
+    CompassStatus lastStatus = COMPASS_OK;   /**< Status of the last transfer. */
+    uint8_t retries = 1;                     /**< Number of repeated attempts of a failed synchronous transfer. */
+    uint8_t recoveryThreshold = 3;           /**< Failed transfers in a row that start recoverBus(), 0 disables it. */
 private:
+    /**
+     * @brief Sets the calibration and the scale to their defaults, shared by the constructors.
+     */
+    void initialize();
+
+    /**
+     * @brief Derives the coefficients of a calibration state.
+     * @param state A pointer to the state, its coefficients are overwritten.
+     */
+    void buildCoefficients(CompassCalibrationState *state);
+
+    /**
+     * @brief Converts a raw value of the current field range to the raw units of the calibration.
+     * @param raw The raw value.
+     * @param axis The axis, 0 to 2.
+     * @return The value in the raw units of the calibration.
+     */
+    CompassRawValue toCalibrationUnits(CompassRawValue raw, uint8_t axis);
+
+#if !defined(MULTICOMPASS_NO_FLOAT)
+    /**
+     * @brief Calculates a heading with the selected method, adds the declination and normalizes it to one turn.
+     * @param y The east component.
+     * @param x The north component.
+     * @return The heading in the selected unit.
+     */
+    float computeHeading(float y, float x);
+#endif
+
+    /**
+     * @brief Sets the register pointer of the sensor.
+     * @param reg The register to select.
+     * @return The status of the transmission.
+     */
+    CompassStatus selectRegister(uint8_t reg);
+
+    /**
+     * @brief Reads consecutive registers once, waiting at most the configured timeout.
+     * @param reg The first register to read from.
+     * @param buffer A pointer to the buffer where the bytes will be stored.
+     * @param length The number of bytes to read.
+     * @return The status of the transfer.
+     */
+    CompassStatus transfer(uint8_t reg, uint8_t *buffer, uint8_t length);
+
+    /**
+     * @brief Counts one attempt of a transfer by its result.
+     * @param status The status of the attempt.
+     */
+    void countAttempt(CompassStatus status);
+
+    /**
+     * @brief Adds the duration of a transfer to the metrics.
+     * @param latency The duration in microseconds.
+     * @param blocking Whether the caller waited for the transfer.
+     */
+    void recordLatency(uint32_t latency, bool blocking);
+
+    /**
+     * @brief Records the final status of a synchronous transfer and starts the automatic recovery if necessary.
+     * @param status The final status of the transfer.
+     * @return true if the transfer was successful, false otherwise.
+     */
+    bool completeTransfer(CompassStatus status);
+
+    /**
+     * @brief Completes the pending asynchronous read and notifies the callback.
+     * @param status The final status of the read.
+     */
+    void finishRead(CompassStatus status);
+
+#if defined(ARDUINO_ARCH_ESP32)
+    /**
+     * @brief Task body of the asynchronous reads.
+     * @param arg A pointer to the MultiCompass instance.
+     */
+    static void asyncTaskLoop(void *arg);
+
+    TaskHandle_t asyncTask = NULL; /**< Task executing the asynchronous reads. */
+#endif
+    CompassCalibrationState calibrationStates[2]; /**< The published and the edited calibration state. */
+    volatile uint8_t activeCalibration;           /**< Index of the published calibration state. */
+#if defined(ARDUINO_ARCH_ESP32)
+    portMUX_TYPE calibrationLock = portMUX_INITIALIZER_UNLOCKED; /**< Writer lock of the calibration, held from edit to publish. */
+#endif
+    CompassTransaction transaction = {}; /**< The pending or last asynchronous read. */
+    CompassBusCounters busCounters = {}; /**< Transfer and error counters. */
+    CompassMetrics metrics = {};         /**< Latency histogram and blocked time of the current window. */
+    uint32_t metricsStart = 0;           /**< millis() at the start of the window. */
+    uint32_t metricsSequence = 0;        /**< Sequence number at the start of the window. */
+    uint32_t metricsOverruns = 0;        /**< dataReadyOverruns at the start of the window. */
+    int8_t sdaPin = -1;                  /**< The GPIO of SDA, -1 if unknown. */
+    int8_t sclPin = -1;                  /**< The GPIO of SCL, -1 if unknown. */
+    uint32_t busClock = 0;               /**< The clock of the bus in Hz, 0 for the default. */
+    bool recovering = false;             /**< recoverBus() is running. */
+    MultiCompassFilter *filter = NULL;           /**< Filter stage of CompassData. */
+    MultiCompassFilterFixed *filterFixed = NULL; /**< Filter stage of the fixed point pipeline. */
+    MultiCompassWireTransport wireTransport; /**< Transport of the Wire object passed to the constructor. */
+    MultiCompassTransport *transport;        /**< The transport of all transfers. */
+#if !defined(MULTICOMPASS_NO_FLOAT)
+    CompassHeadingMethod headingMethod = COMPASS_HEADING_ATAN2; /**< Method of the float headings. */
+    CompassHeadingUnit headingUnit = COMPASS_UNIT_RADIANS;      /**< Unit of the float headings. */
+    float headingTurn = 2 * PI;                                 /**< A full turn in the unit of the float headings. */
+    float fieldTolerance = 0;        /**< Allowed relative deviation of the field norm, 0 if the check is disabled. */
+    float fieldRate = 0;             /**< Allowed relative change of the field norm per second, 0 if disabled. */
+    bool fieldPause = true;          /**< Whether calibration() skips anomalous samples. */
+    float fieldBaseline = 0;         /**< Running baseline of the calibrated field norm. */
+    float fieldNorm = 0;             /**< Field norm of the last checked sample. */
+    uint32_t fieldTime = 0;          /**< Timestamp of the last checked sample. */
+    volatile uint8_t fieldSamples = 0; /**< Samples in the baseline, only written by the sampling path. */
+    volatile uint8_t fieldResets = 0;  /**< Number of baseline resets requested by resetFieldBaseline(). */
+    uint8_t fieldResetsHandled = 0;    /**< Number of requested resets the sampling path already applied. */
+    uint8_t fieldFlagged = 0;        /**< Samples flagged in a row. */
+#endif
+    MultiCompassSampleBuffer *dataReadyBuffer = NULL; /**< Buffer receiving the data ready samples. */
+    volatile uint8_t dataReadyCount = 0;               /**< Number of interrupts, only written by the interrupt. */
+    volatile uint32_t dataReadyTimestamp = 0;          /**< Time of the last interrupt in microseconds. */
+    uint8_t dataReadyHandled = 0;                      /**< Number of interrupts already handled. */
+    uint8_t dataReadyPin = 0;                          /**< The GPIO of the DRDY pin. */
+    bool dataReadyEnabled = false;                     /**< Whether the data ready interrupt is attached. */
+#if defined(ARDUINO_ARCH_ESP32)
+    TaskHandle_t dataReadyTask = NULL; /**< Task reading the sensor in data ready mode. */
+#endif
 };
 
 #endif
\ No newline at end of file
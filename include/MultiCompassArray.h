@@ -0,0 +1,138 @@
+/**
+ * @file MultiCompassArray.h
+ * @brief Header file for MultiCompassArray class
+ * This file contains the declarations for the MultiCompassArray class which reads several compass sensors,
+ * grouped by their I2C bus, and delivers all readings in one timestamped frame.
+ */
+
+#ifndef MULTICOMPASS_ARRAY_H
+#define MULTICOMPASS_ARRAY_H
+
+#include "MultiCompass.h"
+
+#if defined(ARDUINO_ARCH_ESP32)
+#include "freertos/semphr.h"
+#endif
+
+#ifndef MULTICOMPASS_ARRAY_SIZE
+#define MULTICOMPASS_ARRAY_SIZE 8 ///< Maximal number of sensors in one MultiCompassArray
+#endif
+
+#if MULTICOMPASS_ARRAY_SIZE > 31
+#error "MULTICOMPASS_ARRAY_SIZE has to fit into the valid mask of a frame"
+#endif
+
+#ifndef MULTICOMPASS_ARRAY_BUSES
+#define MULTICOMPASS_ARRAY_BUSES 2 ///< Maximal number of I2C buses in one MultiCompassArray
+#endif
+
+typedef struct
+{
+    unsigned long timestamp;                   ///< Time in microseconds the frame was started.
+    uint8_t count;                             ///< Number of sensors in the frame.
+    uint32_t validMask;                        ///< Bit n is set if sensor n was read successfully.
+    CompassData data[MULTICOMPASS_ARRAY_SIZE]; ///< The scaled and filtered readings with their headings, in the order the sensors were added.
+} MultiCompassFrame;
+
+/**
+ * @class MultiCompassArray
+ * @brief Class for reading several compass sensors on one or more I2C buses as one frame.
+ * The sensors are grouped by the bus of their transport, see MultiCompassTransport::getBus(). Sensors of the same bus are read one after another,
+ * different buses are read in parallel on ESP32 once startTasks() was called.
+ */
+class MultiCompassArray
+{
+public:
+    /**
+     * @brief Constructor for MultiCompassArray class.
+     */
+    MultiCompassArray();
+
+    /**
+     * @brief Destructor for MultiCompassArray class, stops the bus tasks.
+     */
+    ~MultiCompassArray();
+
+    /**
+     * @brief Adds a sensor to the array. Its bus is taken from the sensor.
+     * @param compass A pointer to the sensor, has to stay valid while the array is used.
+     * @return true if the sensor was added, false if there is no free sensor or bus slot.
+     */
+    bool addSensor(MultiCompass *compass);
+
+    /**
+     * @brief Gets the number of sensors in the array.
+     * @return The number of sensors.
+     */
+    uint8_t getSensorCount();
+
+    /**
+     * @brief Gets the number of different buses in the array.
+     * @return The number of buses.
+     */
+    uint8_t getBusCount();
+
+    /**
+     * @brief Gets a sensor of the array.
+     * @param index The index of the sensor, in the order the sensors were added.
+     * @return A pointer to the sensor, NULL if the index is invalid.
+     */
+    MultiCompass *getSensor(uint8_t index);
+
+    /**
+     * @brief Reads all sensors into one frame.
+     * Every sensor runs its MultiCompass::update() chain, so the readings are scaled, filtered and carry a heading.
+     * With running bus tasks all buses are read in parallel, otherwise one bus after another.
+     * @param frame A pointer to a MultiCompassFrame struct where the readings will be stored.
+     * @param x The X axis of the sensors.
+     * @param y The Y axis of the sensors.
+     * @param z The Z axis of the sensors.
+     * @return true if all sensors were read, false otherwise.
+     */
+    bool readFrame(MultiCompassFrame *frame, int x = 0, int y = 0, int z = 1);
+
+#if defined(ARDUINO_ARCH_ESP32)
+    /**
+     * @brief Starts one task per bus, the tasks are distributed over both cores.
+     * @param priority The FreeRTOS priority of the tasks.
+     * @return true if all tasks were created, false otherwise.
+     */
+    bool startTasks(UBaseType_t priority = 5);
+
+    /**
+     * @brief Stops the bus tasks, readFrame() then reads the buses one after another.
+     */
+    void stopTasks();
+#endif
+
+private:
+    /**
+     * @brief Reads all sensors of one bus into the pending frame.
+     * @param bus The index of the bus.
+     * @return A bit mask of the sensors that were read successfully.
+     */
+    uint32_t readBus(uint8_t bus);
+
+#if defined(ARDUINO_ARCH_ESP32)
+    /**
+     * @brief Task body of a bus task.
+     * @param arg A pointer to the MultiCompassArray instance.
+     */
+    static void busTaskLoop(void *arg);
+
+    TaskHandle_t busTasks[MULTICOMPASS_ARRAY_BUSES];   /**< The task of each bus. */
+    SemaphoreHandle_t busDone;                          /**< Given by a bus task when its bus was read. */
+    volatile uint32_t busMasks[MULTICOMPASS_ARRAY_BUSES]; /**< Result of the last read of each bus. */
+    volatile uint8_t nextTaskBus;                       /**< Bus index handed to the next created task. */
+#endif
+
+    MultiCompass *sensors[MULTICOMPASS_ARRAY_SIZE];     /**< The sensors of the array. */
+    uint8_t sensorBus[MULTICOMPASS_ARRAY_SIZE];         /**< The bus index of each sensor. */
+    const void *buses[MULTICOMPASS_ARRAY_BUSES];        /**< The identities of the different buses of the sensors. */
+    uint8_t sensorCount;                                /**< The number of sensors. */
+    uint8_t busCount;                                   /**< The number of buses. */
+    MultiCompassFrame *pendingFrame;                    /**< The frame that is currently read. */
+    int axes[3];                                        /**< The axes of the headings of the pending frame. */
+};
+
+#endif
@@ -0,0 +1,221 @@
+/**
+ * @file MultiCompassAutoCalibration.h
+ * @brief Header file for MultiCompassAutoCalibration class
+ * This file contains the declarations for the MultiCompassAutoCalibration class which refines the hard and soft iron
+ * calibration of a sensor in the background, while the sampling path keeps running at full rate.
+ */
+
+#ifndef MULTICOMPASS_AUTOCALIBRATION_H
+#define MULTICOMPASS_AUTOCALIBRATION_H
+
+#include "MultiCompass.h"
+#include "MultiCompassCalibration.h"
+#include "MultiCompassRingBuffer.h"
+
+#if defined(MULTICOMPASS_NO_FLOAT)
+#error "MultiCompassAutoCalibration needs float support, it is not available with MULTICOMPASS_NO_FLOAT"
+#endif
+
+#ifndef MULTICOMPASS_AUTOCAL_QUEUE
+#if defined(__AVR__)
+#define MULTICOMPASS_AUTOCAL_QUEUE 8 ///< Capacity of the queue from the sampling path to the worker, has to be a power of two
+#else
+#define MULTICOMPASS_AUTOCAL_QUEUE 32 ///< Capacity of the queue from the sampling path to the worker, has to be a power of two
+#endif
+#endif
+
+#ifndef MULTICOMPASS_AUTOCAL_WINDOW
+#if defined(__AVR__)
+#define MULTICOMPASS_AUTOCAL_WINDOW 128 ///< Samples of each fit
+#else
+#define MULTICOMPASS_AUTOCAL_WINDOW 512 ///< Samples of each fit
+#endif
+#endif
+
+#ifndef MULTICOMPASS_AUTOCAL_EVAL
+#if defined(__AVR__)
+#define MULTICOMPASS_AUTOCAL_EVAL 8 ///< Samples of each window held out of the fit to compare the candidate with the published calibration
+#else
+#define MULTICOMPASS_AUTOCAL_EVAL 32 ///< Samples of each window held out of the fit to compare the candidate with the published calibration
+#endif
+#endif
+
+#ifndef MULTICOMPASS_AUTOCAL_DECIMATION
+#define MULTICOMPASS_AUTOCAL_DECIMATION 4 ///< Only every n-th offered sample enters the queue
+#endif
+
+#ifndef MULTICOMPASS_AUTOCAL_MAX_ERROR
+#define MULTICOMPASS_AUTOCAL_MAX_ERROR 0.1f ///< Largest fit error of a candidate, larger errors mean a poor coverage of the sphere
+#endif
+
+#ifndef MULTICOMPASS_AUTOCAL_MARGIN
+#define MULTICOMPASS_AUTOCAL_MARGIN 0.9f ///< A candidate is published if its residual is below this share of the published one
+#endif
+
+#ifndef MULTICOMPASS_AUTOCAL_SETTLED
+#define MULTICOMPASS_AUTOCAL_SETTLED 0.02f ///< Offset change between two candidates, relative to the field, below which the calibration is converged
+#endif
+
+#ifndef MULTICOMPASS_AUTOCAL_RESIDUAL
+#define MULTICOMPASS_AUTOCAL_RESIDUAL 0.05f ///< Residual of the published calibration below which the calibration is converged
+#endif
+
+#ifndef MULTICOMPASS_AUTOCAL_PERIOD
+#define MULTICOMPASS_AUTOCAL_PERIOD 20 ///< Milliseconds the worker task sleeps between two runs of process()
+#endif
+
+typedef struct
+{
+    float x; ///< X axis in the raw units of the calibration.
+    float y; ///< Y axis in the raw units of the calibration.
+    float z; ///< Z axis in the raw units of the calibration.
+} CompassCalibrationSample;
+
+typedef struct
+{
+    uint32_t samples;   ///< Samples added to the fits.
+    uint32_t dropped;   ///< Samples dropped because the worker did not keep up.
+    uint16_t fits;      ///< Completed windows.
+    uint16_t published; ///< Candidates published to the sampling path.
+    uint16_t rejected;  ///< Candidates that failed or were not better than the published calibration.
+    uint16_t rollbacks; ///< Returns to the last known-good calibration because it matched the field better.
+    float fitError;     ///< Fit error of the last candidate, negative if it failed.
+    float residual;     ///< RMS deviation of the calibrated field norm from 1 of the published calibration on the last window.
+    float offsetChange; ///< Offset change of the last candidate relative to the field.
+    bool converged;     ///< The residual and the offset change are below their limits.
+} CompassAutoCalibrationStatus;
+
+/**
+ * @class MultiCompassAutoCalibration
+ * @brief Class for a continuous hard and soft iron calibration in the background.
+ * The sampling path offers every sample with addSample(), which only decimates it into a lock-free queue.
+ * process() drains the queue into an ellipsoid fit. After each window it compares the candidate, the published and the
+ * last known-good calibration on samples of the window that were held out of the fit, and publishes the best with
+ * editCalibration() and publishCalibration().
+ * Every window starts a new fit, so the calibration follows changes of the magnetic environment.
+ * The publish takes the writer lock of the sensor, so range changes and setters of the sampling path may run
+ * at the same time, and the baseline of the field check is reset through a request the sampling path applies.
+ */
+class MultiCompassAutoCalibration
+{
+public:
+    /**
+     * @brief Constructor for MultiCompassAutoCalibration class.
+     * @param compass A pointer to the sensor whose calibration is refined.
+     */
+    MultiCompassAutoCalibration(MultiCompass *compass);
+
+    /**
+     * @brief Drops the current window, the previous calibration and the status.
+     * May only be called while the worker task is stopped.
+     */
+    void reset();
+
+    /**
+     * @brief Sets how many offered samples are skipped between two queued ones.
+     * @param decimation Every n-th sample enters the queue, at least 1.
+     */
+    void setDecimation(uint8_t decimation);
+
+    /**
+     * @brief Offers an acquired sample, called from the sampling path.
+     * Flagged samples are skipped, the others are decimated and queued without blocking.
+     * @param data A pointer to a CompassData struct containing the raw sensor data.
+     */
+    void addSample(const CompassData *data);
+
+    /**
+     * @brief Drains the queue into the fit and evaluates the candidate once the window is complete.
+     * Called by the worker task or, without one, from loop().
+     * @return true if a calibration was published, false otherwise.
+     */
+    bool process();
+
+    /**
+     * @brief Publishes the last known-good calibration again.
+     * That is the calibration the auto calibration started from, or the last published one that held for a whole window.
+     * @return true if a known-good calibration existed, false otherwise.
+     */
+    bool rollback();
+
+    /**
+     * @brief Gets the convergence metrics.
+     * @return A reference to the status, written by the worker.
+     */
+    const CompassAutoCalibrationStatus &getStatus();
+
+#if defined(ARDUINO_ARCH_ESP32)
+    /**
+     * @brief Starts a low priority worker task which runs process(), by default on the core without the Arduino loop.
+     * @param priority The FreeRTOS priority of the task.
+     * @param core The core the task is pinned to.
+     * @return true if the task was created, false otherwise.
+     */
+    bool startTask(UBaseType_t priority = 1, BaseType_t core = 0);
+
+    /**
+     * @brief Stops the worker task.
+     */
+    void stopTask();
+#endif
+
+private:
+    /**
+     * @brief Solves the fit of the completed window and publishes the best calibration, then starts the next window.
+     * @return true if a calibration was published, false otherwise.
+     */
+    bool finishWindow();
+
+    /**
+     * @brief Calculates the RMS deviation of the calibrated field norm from 1 on the kept samples of the window.
+     * @param calibration The calibration to evaluate, in the raw units of the calibration.
+     * @return The residual.
+     */
+    float evaluate(const CompassSoftIron *calibration);
+
+    /**
+     * @brief Expresses the min/max calibration of the settings as a diagonal soft iron calibration.
+     * @param settings The min/max calibration.
+     * @param calibration A pointer to the soft iron calibration where the result will be stored.
+     */
+    static void fromSettings(const CompassSetting *settings, CompassSoftIron *calibration);
+
+    /**
+     * @brief Publishes a candidate and keeps the replaced calibration as rollback target if it was known to be good.
+     * @param calibration The calibration to publish.
+     */
+    void publish(const CompassSoftIron *calibration);
+
+    /**
+     * @brief Publishes a calibration to the sensor.
+     * @param calibration The calibration to publish.
+     */
+    void apply(const CompassSoftIron *calibration);
+
+#if defined(ARDUINO_ARCH_ESP32)
+    /**
+     * @brief Task body of the worker, runs process() every MULTICOMPASS_AUTOCAL_PERIOD milliseconds.
+     * @param arg A pointer to the MultiCompassAutoCalibration instance.
+     */
+    static void taskLoop(void *arg);
+#endif
+
+    MultiCompass *compass;                      /**< The sensor whose calibration is refined. */
+    MultiCompassCalibration fit;                /**< Ellipsoid fit of the current window. */
+    MultiCompassRingBuffer<CompassCalibrationSample, MULTICOMPASS_AUTOCAL_QUEUE> queue; /**< Samples from the sampling path. */
+    CompassCalibrationSample kept[MULTICOMPASS_AUTOCAL_EVAL]; /**< Samples held out of the fit, evenly spread over the window. */
+    CompassSoftIron previous;                   /**< The last known-good calibration, the target of rollback(). */
+    CompassSoftIron lastCandidate;              /**< The last successful candidate, valid if it exists. */
+    CompassAutoCalibrationStatus status;        /**< Convergence metrics. */
+    uint16_t windowCount;                       /**< Samples in the current window. */
+    uint8_t decimation;                         /**< Every n-th offered sample is queued. */
+    uint8_t skipped;                            /**< Offered samples since the last queued one, only written by the sampling path. */
+    volatile uint32_t dropped;                  /**< Samples the queue could not take, only written by the sampling path. */
+    bool hasPrevious;                           /**< Whether previous holds a calibration. */
+    bool currentGood;                           /**< Whether the published calibration is known to be good. */
+#if defined(ARDUINO_ARCH_ESP32)
+    TaskHandle_t task = NULL; /**< Worker task. */
+#endif
+};
+
+#endif
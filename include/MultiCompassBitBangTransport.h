@@ -0,0 +1,97 @@
+/**
+ * @file MultiCompassBitBangTransport.h
+ * @brief Header file for the MultiCompassBitBangTransport class
+ * This file contains an I2C master on two GPIOs, for boards without a free hardware bus.
+ */
+
+#ifndef MULTICOMPASS_BITBANG_TRANSPORT_H
+#define MULTICOMPASS_BITBANG_TRANSPORT_H
+
+#include "MultiCompassTransport.h"
+
+#ifndef MULTICOMPASS_BITBANG_DELAY
+#define MULTICOMPASS_BITBANG_DELAY 5 ///< Half clock period in microseconds, about 100 kHz
+#endif
+
+#ifndef MULTICOMPASS_BITBANG_STRETCH
+#define MULTICOMPASS_BITBANG_STRETCH 1000 ///< Longest clock stretching of a sensor in microseconds
+#endif
+
+/**
+ * @class MultiCompassBitBangTransport
+ * @brief Reaches the sensor through an I2C master in software.
+ * The lines are driven open drain: low as output, high by releasing them to the pull-ups.
+ * readRegisters() is a single transaction with a repeated start, clock stretching of the sensor is honoured.
+ * Transports that share a line report the same bus, so MultiCompassArray does not drive the lines from two tasks.
+ */
+class MultiCompassBitBangTransport : public MultiCompassBufferedTransport
+{
+public:
+    /**
+     * @brief Constructor for MultiCompassBitBangTransport class, releases both lines.
+     * @param sda The GPIO of SDA.
+     * @param scl The GPIO of SCL.
+     * @param halfPeriod The half clock period in microseconds.
+     */
+    MultiCompassBitBangTransport(uint8_t sda, uint8_t scl, uint8_t halfPeriod = MULTICOMPASS_BITBANG_DELAY);
+
+    /**
+     * @brief Destructor for MultiCompassBitBangTransport class.
+     */
+    ~MultiCompassBitBangTransport();
+
+    CompassStatus write(uint8_t address, uint8_t reg, const uint8_t *buffer, uint8_t length, uint32_t timeout);
+    void request(uint8_t address, uint8_t length, uint32_t timeout);
+    CompassStatus readRegisters(uint8_t address, uint8_t reg, uint8_t *buffer, uint8_t length, uint32_t timeout);
+    const void *getBus();
+
+private:
+    /**
+     * @brief Sends a START condition, or a repeated START within a transaction.
+     * @return COMPASS_OK, or COMPASS_ERROR_BUS if another device holds SDA low.
+     */
+    CompassStatus start();
+
+    /**
+     * @brief Sends a STOP condition.
+     */
+    void stop();
+
+    /**
+     * @brief Releases SCL and waits while the sensor stretches the clock.
+     * @return true if SCL went high, false after MULTICOMPASS_BITBANG_STRETCH microseconds.
+     */
+    bool releaseClock();
+
+    /**
+     * @brief Clocks out one byte and reads the acknowledge bit.
+     * @param value The byte.
+     * @return COMPASS_OK if it was acknowledged, COMPASS_ERROR_NACK or COMPASS_ERROR_TIMEOUT otherwise.
+     */
+    CompassStatus writeByte(uint8_t value);
+
+    /**
+     * @brief Clocks in one byte and answers with an acknowledge bit.
+     * @param value A pointer to the byte.
+     * @param acknowledge true to request another byte, false after the last one.
+     * @return COMPASS_OK, or COMPASS_ERROR_TIMEOUT if the clock stayed low.
+     */
+    CompassStatus readByte(uint8_t *value, bool acknowledge);
+
+    /**
+     * @brief Sends the address of a read and clocks in a block of bytes, then a STOP condition.
+     * @param address The I2C address of the sensor.
+     * @param buffer A pointer to the buffer where the bytes will be stored.
+     * @param length The number of bytes.
+     * @return The status of the transaction.
+     */
+    CompassStatus receive(uint8_t address, uint8_t *buffer, uint8_t length);
+
+    uint8_t sda;        /**< The GPIO of SDA. */
+    uint8_t scl;        /**< The GPIO of SCL. */
+    uint8_t halfPeriod; /**< The half clock period in microseconds. */
+    MultiCompassBitBangTransport *next; /**< The next transport in the list of all bit-bang transports. */
+    static MultiCompassBitBangTransport *first; /**< The oldest bit-bang transport. */
+};
+
+#endif
@@ -0,0 +1,109 @@
+/**
+ * @file MultiCompassCalibration.h
+ * @brief Header file for MultiCompassCalibration class
+ * This file contains the declarations for the MultiCompassCalibration class which fits an ellipsoid to a stream
+ * of raw samples and derives the hard iron offset and the soft iron matrix of a sensor.
+ */
+
+#ifndef MULTICOMPASS_CALIBRATION_H
+#define MULTICOMPASS_CALIBRATION_H
+
+#include "MultiCompass.h"
+
+#if defined(MULTICOMPASS_NO_FLOAT)
+#error "MultiCompassCalibration needs float support, it is not available with MULTICOMPASS_NO_FLOAT"
+#endif
+
+#ifndef MULTICOMPASS_CALIBRATION_NORM
+#define MULTICOMPASS_CALIBRATION_NORM 2048.0f ///< Raw value that is mapped to 1.0 before the samples are accumulated
+#endif
+
+#define MULTICOMPASS_CALIBRATION_TERMS 9                                                               ///< Number of parameters of the ellipsoid
+#define MULTICOMPASS_CALIBRATION_PACKED (MULTICOMPASS_CALIBRATION_TERMS * (MULTICOMPASS_CALIBRATION_TERMS + 1) / 2) ///< Size of the packed normal matrix
+
+/**
+ * @class MultiCompassCalibration
+ * @brief Class for an online hard and soft iron calibration with constant memory.
+ * Each sample only updates the sums of a linear least squares fit of the ellipsoid
+ * a x^2 + b y^2 + c z^2 + 2 d xy + 2 e xz + 2 f yz + 2 g x + 2 h y + 2 i z = 1,
+ * so no samples are stored. The fit is solved on demand and cached until new samples arrive.
+ * The result maps the raw samples onto the unit sphere, like the min/max calibration maps them to +-1.
+ */
+class MultiCompassCalibration
+{
+public:
+    /**
+     * @brief Constructor for MultiCompassCalibration class.
+     */
+    MultiCompassCalibration();
+
+    /**
+     * @brief Drops all accumulated samples and the last result.
+     */
+    void reset();
+
+    /**
+     * @brief Adds a raw sample to the fit.
+     * @param x The raw X axis of the sensor.
+     * @param y The raw Y axis of the sensor.
+     * @param z The raw Z axis of the sensor.
+     */
+    void addSample(float x, float y, float z);
+
+    /**
+     * @brief Adds the raw values of a sample to the fit.
+     * @param data A pointer to a CompassData struct containing the raw sensor data.
+     */
+    void addSample(const CompassData *data);
+
+    /**
+     * @brief Gets the number of accumulated samples.
+     * @return The number of samples.
+     */
+    uint32_t getSampleCount();
+
+    /**
+     * @brief Solves the fit if new samples arrived since the last solution.
+     * @return true if the samples describe a valid ellipsoid, false otherwise.
+     */
+    bool solve();
+
+    /**
+     * @brief Gets the calibration of the last solution, solves the fit first if necessary.
+     * @param result A pointer to a CompassSoftIron struct where the calibration will be stored.
+     * @return true if the result is valid, false otherwise.
+     */
+    bool getSoftIron(CompassSoftIron *result);
+
+    /**
+     * @brief Gets the root mean square error of the last solution.
+     * The error is the deviation of the ellipsoid equation from 1, which is about twice the relative radius error.
+     * @return The error, negative if there is no valid solution.
+     */
+    float getFitError();
+
+private:
+    /**
+     * @brief Solves the packed symmetric linear system with a Cholesky decomposition.
+     * @param matrix The packed lower triangle of the system, overwritten with the decomposition.
+     * @param vector The right side, overwritten with the solution.
+     * @return true if the system is positive definite, false otherwise.
+     */
+    static bool solveCholesky(float *matrix, float *vector);
+
+    /**
+     * @brief Calculates the symmetric square root of a positive definite 3x3 matrix with Jacobi rotations.
+     * @param matrix The row major matrix, overwritten with its square root.
+     * @return true if the matrix is positive definite, false otherwise.
+     */
+    static bool squareRoot(float *matrix);
+
+    float sums[MULTICOMPASS_CALIBRATION_PACKED]; /**< Packed lower triangle of the sum of phi * phi^T. */
+    float vector[MULTICOMPASS_CALIBRATION_TERMS]; /**< Sum of phi. */
+    uint32_t count;                              /**< Number of accumulated samples. */
+    bool solved;                                 /**< The result belongs to the current sums. */
+    float fitError;                              /**< Root mean square error of the result, negative if invalid. */
+    CompassSoftIron result;                      /**< The last solution. */
+};
+
+#endif
@@ -0,0 +1,83 @@
+/**
+ * @file MultiCompassDriver.h
+ * @brief Header file for the MultiCompassDriver class template
+ * This file contains the compile time driver base. A sensor class derives from MultiCompassDriver<SensorClass>,
+ * which keeps the virtual MultiCompass interface for generic code and adds a statically dispatched acquisition chain.
+ */
+
+#ifndef MULTICOMPASS_DRIVER_H
+#define MULTICOMPASS_DRIVER_H
+
+#include "MultiCompass.h"
+
+/**
+ * @class MultiCompassDriver
+ * @brief CRTP base of the sensor drivers.
+ * Generic code, like MultiCompassArray, uses a driver through MultiCompass pointers and the virtual functions.
+ * Code that knows the sensor type calls update(), which resolves readRawSample() and checkSample() of the driver
+ * at compile time. Without indirect calls the compiler can inline the whole read, scale and heading chain,
+ * across translation units with link time optimization, which the AVR toolchain enables by default.
+ * @tparam Driver The sensor class deriving from MultiCompassDriver<Driver>.
+ */
+template <class Driver>
+class MultiCompassDriver : public MultiCompass
+{
+public:
+    /**
+     * @brief Constructor for the MultiCompassDriver class.
+     * @param wire Pointer to the Wire object for I2C communication.
+     */
+    MultiCompassDriver(TwoWire *wire) : MultiCompass(wire) {}
+
+    /**
+     * @brief Constructor for the MultiCompassDriver class with another bus.
+     * @param transport Pointer to the transport, e.g. a MultiCompassMockTransport.
+     */
+    MultiCompassDriver(MultiCompassTransport *transport) : MultiCompass(transport) {}
+
+    /**
+     * @brief Reads one sample, scales and filters it and calculates its heading without virtual calls.
+     * Overrides MultiCompass::update(), so generic code like MultiCompassArray gets the same chain.
+     * @param data A pointer to a CompassData struct where the sample will be stored.
+     * @param x The X axis of the sensor.
+     * @param y The Y axis of the sensor.
+     * @param z The Z axis of the sensor.
+     * @return true if the sensor was read, false otherwise.
+     */
+    bool update(CompassData *data, int x = 0, int y = 0, int z = 1)
+    {
+        Driver *driver = static_cast<Driver *>(this);
+        CompassRawSample sample;
+        uint32_t timestamp = micros();
+        // The qualified calls bypass the virtual dispatch.
+        if (!driver->Driver::readRawSample(&sample))
+        {
+            return false;
+        }
+        data->rawX = sample.x;
+        data->rawY = sample.y;
+        data->rawZ = sample.z;
+        data->timestamp = timestamp;
+        data->sequence = this->nextSequence();
+        data->flags = 0;
+        driver->Driver::checkSample(data);
+        scaleData(data);
+        // The norm is taken from the scaled axes instead of scaling the sample a second time.
+        checkScaledField(data);
+        filterData(data);
+        calculateHeading(data, x, y, z);
+        filterHeading(data);
+        return true;
+    }
+
+    /**
+     * @brief Gets the name of the sensor, taken from the static name of the driver.
+     * @return The name of the sensor.
+     */
+    const char *getName()
+    {
+        return Driver::name();
+    }
+};
+
+#endif
@@ -0,0 +1,495 @@
+/**
+ * @file MultiCompassFilter.h
+ * @brief Header file for the MultiCompassFilter classes
+ * This file contains the filter stage that runs between MultiCompass::scaleData() and MultiCompass::calculateHeading():
+ * a median for spike rejection, a moving average and a cascade of low-pass biquads per axis, plus a low-pass
+ * for the heading. All storage is static, the sizes are fixed at compile time.
+ * Without float support only the median and the moving average are available, the low-pass design needs float math.
+ */
+
+#ifndef MULTICOMPASS_FILTER_H
+#define MULTICOMPASS_FILTER_H
+
+#include "MultiCompass.h"
+
+#ifndef MULTICOMPASS_FILTER_MEDIAN
+#if defined(__AVR__)
+#define MULTICOMPASS_FILTER_MEDIAN 3 ///< Longest median window
+#else
+#define MULTICOMPASS_FILTER_MEDIAN 7 ///< Longest median window
+#endif
+#endif
+
+#ifndef MULTICOMPASS_FILTER_AVERAGE
+#if defined(__AVR__)
+#define MULTICOMPASS_FILTER_AVERAGE 4 ///< Longest moving average window
+#else
+#define MULTICOMPASS_FILTER_AVERAGE 16 ///< Longest moving average window
+#endif
+#endif
+
+#ifndef MULTICOMPASS_FILTER_SECTIONS
+#if defined(__AVR__)
+#define MULTICOMPASS_FILTER_SECTIONS 1 ///< Number of biquad sections per axis, a low-pass has twice this order
+#else
+#define MULTICOMPASS_FILTER_SECTIONS 2 ///< Number of biquad sections per axis, a low-pass has twice this order
+#endif
+#endif
+
+#define MULTICOMPASS_BIQUAD_SHIFT 28 ///< Fractional bits of the fixed point biquad coefficients
+#define MULTICOMPASS_BIQUAD_GUARD 8  ///< Fractional bits of the fixed point biquad state beyond Q14
+
+#if !defined(MULTICOMPASS_NO_FLOAT)
+typedef struct
+{
+    float b0; ///< Feed forward coefficient of the current input.
+    float b1; ///< Feed forward coefficient of the previous input.
+    float b2; ///< Feed forward coefficient of the second previous input.
+    float a1; ///< Feedback coefficient of the previous output, the leading a0 is normalized to 1.
+    float a2; ///< Feedback coefficient of the second previous output.
+} CompassBiquadCoefficients;
+
+/**
+ * @class MultiCompassBiquad
+ * @brief A second order IIR section in transposed direct form II.
+ */
+class MultiCompassBiquad
+{
+public:
+    /**
+     * @brief Constructor for the MultiCompassBiquad class, the section starts as a pass through.
+     */
+    MultiCompassBiquad();
+
+    /**
+     * @brief Sets the coefficients and resets the state.
+     * @param coefficients A pointer to the coefficients.
+     */
+    void setCoefficients(const CompassBiquadCoefficients *coefficients);
+
+    /**
+     * @brief Resets the state, the next input primes the section as if it had been constant before.
+     */
+    void reset();
+
+    /**
+     * @brief Filters one value.
+     * @param value The input value.
+     * @return The output value.
+     */
+    float update(float value);
+
+    /**
+     * @brief Calculates the coefficients of a low-pass, following the audio EQ cookbook.
+     * @param cutoff The cutoff frequency in Hz, has to be below half the sample rate.
+     * @param sampleRate The sample rate in Hz.
+     * @param q The quality factor, 0.7071 for a second order Butterworth low-pass.
+     * @param coefficients A pointer to a CompassBiquadCoefficients struct where the coefficients will be stored.
+     */
+    static void lowPass(float cutoff, float sampleRate, float q, CompassBiquadCoefficients *coefficients);
+
+private:
+    CompassBiquadCoefficients coefficients; /**< The normalized coefficients. */
+    float z1;                               /**< First state of the transposed direct form II. */
+    float z2;                               /**< Second state of the transposed direct form II. */
+    bool primed;                            /**< The state was initialized from an input. */
+};
+#endif
+
+/**
+ * @class MultiCompassBiquadFixed
+ * @brief A second order IIR section for Q14 values with integer operations only.
+ * It uses the direct form I, which cannot overflow internally. The coefficients have 28 fractional bits
+ * and the output history 8 bits more than Q14, which keeps low cutoff frequencies stable and free of dead bands.
+ * The products need 64 bit accumulators, which the AVR toolchain emulates in software.
+ */
+class MultiCompassBiquadFixed
+{
+public:
+    /**
+     * @brief Constructor for the MultiCompassBiquadFixed class, the section starts as a pass through.
+     */
+    MultiCompassBiquadFixed();
+
+#if !defined(MULTICOMPASS_NO_FLOAT)
+    /**
+     * @brief Converts the coefficients to fixed point and resets the state.
+     * @param coefficients A pointer to the coefficients, each has to stay within +-8.
+     */
+    void setCoefficients(const CompassBiquadCoefficients *coefficients);
+#endif
+
+    /**
+     * @brief Resets the state, the next input primes the section as if it had been constant before.
+     */
+    void reset();
+
+    /**
+     * @brief Filters one value.
+     * @param value The input value in Q14.
+     * @return The output value in Q14.
+     */
+    int16_t update(int16_t value);
+
+private:
+    int32_t b[3];  /**< Feed forward coefficients, scaled by 2^MULTICOMPASS_BIQUAD_SHIFT. */
+    int32_t a[2];  /**< Feedback coefficients, scaled by 2^MULTICOMPASS_BIQUAD_SHIFT. */
+    int16_t x1;    /**< Previous input. */
+    int16_t x2;    /**< Second previous input. */
+    int32_t y1;    /**< Previous output with MULTICOMPASS_BIQUAD_GUARD extra bits. */
+    int32_t y2;    /**< Second previous output with MULTICOMPASS_BIQUAD_GUARD extra bits. */
+    bool primed;   /**< The state was initialized from an input. */
+};
+
+/**
+ * @class MultiCompassMedian
+ * @brief A running median over the last values, which removes single spikes without smearing them.
+ * The window is kept sorted, so each value costs one insertion into SIZE items.
+ * @tparam T The type of the values.
+ * @tparam SIZE The longest window.
+ */
+template <typename T, uint8_t SIZE>
+class MultiCompassMedian
+{
+    static_assert(SIZE >= 1 && SIZE <= 32, "SIZE has to be between 1 and 32");
+
+public:
+    /**
+     * @brief Constructor for the MultiCompassMedian class, the window starts with a length of 1, a pass through.
+     */
+    MultiCompassMedian() : length(1) { reset(); }
+
+    /**
+     * @brief Sets the length of the window and resets it. Odd lengths give a true median.
+     * @param length The length, limited to 1..SIZE.
+     */
+    void setLength(uint8_t length)
+    {
+        this->length = constrain(length, 1, SIZE);
+        reset();
+    }
+
+    /**
+     * @brief Drops all values of the window.
+     */
+    void reset()
+    {
+        index = 0;
+        count = 0;
+    }
+
+    /**
+     * @brief Adds a value to the window.
+     * @param value The new value.
+     * @return The median of the window, of the values seen so far while it fills.
+     */
+    T update(T value)
+    {
+        if (count == length)
+        {
+            // Remove the oldest value from the sorted copy.
+            T oldest = values[index];
+            uint8_t i = 0;
+            while (i + 1 < count && sorted[i] != oldest)
+            {
+                i++;
+            }
+            for (count--; i < count; i++)
+            {
+                sorted[i] = sorted[i + 1];
+            }
+        }
+        // Insert the new value into the sorted copy.
+        uint8_t i = count;
+        while (i > 0 && sorted[i - 1] > value)
+        {
+            sorted[i] = sorted[i - 1];
+            i--;
+        }
+        sorted[i] = value;
+        count++;
+        values[index] = value;
+        index = index + 1 < length ? index + 1 : 0;
+        return sorted[count / 2];
+    }
+
+private:
+    T values[SIZE];  ///< The window in arrival order.
+    T sorted[SIZE];  ///< The window in ascending order.
+    uint8_t length;  ///< The current length of the window.
+    uint8_t index;   ///< The slot of the oldest value.
+    uint8_t count;   ///< The number of values in the window.
+};
+
+/**
+ * @class MultiCompassMovingAverage
+ * @brief A moving average over the last values with a running sum, so each value costs one addition and one subtraction.
+ * @tparam T The type of the values.
+ * @tparam SUM The type of the running sum, wide enough for SIZE values.
+ * @tparam SIZE The longest window.
+ */
+template <typename T, typename SUM, uint8_t SIZE>
+class MultiCompassMovingAverage
+{
+    static_assert(SIZE >= 1 && SIZE <= 128, "SIZE has to be between 1 and 128");
+
+public:
+    /**
+     * @brief Constructor for the MultiCompassMovingAverage class, the window starts with a length of 1, a pass through.
+     */
+    MultiCompassMovingAverage() : length(1) { reset(); }
+
+    /**
+     * @brief Sets the length of the window and resets it.
+     * @param length The length, limited to 1..SIZE.
+     */
+    void setLength(uint8_t length)
+    {
+        this->length = constrain(length, 1, SIZE);
+        reset();
+    }
+
+    /**
+     * @brief Drops all values of the window.
+     */
+    void reset()
+    {
+        sum = 0;
+        index = 0;
+        count = 0;
+    }
+
+    /**
+     * @brief Adds a value to the window.
+     * @param value The new value.
+     * @return The average of the window, of the values seen so far while it fills.
+     */
+    T update(T value)
+    {
+        if (count == length)
+        {
+            sum -= values[index];
+        }
+        else
+        {
+            count++;
+        }
+        values[index] = value;
+        sum += value;
+        if (++index == length)
+        {
+            // Rebuild the sum once per window, so float rounding errors cannot accumulate.
+            index = 0;
+            sum = 0;
+            for (uint8_t i = 0; i < count; i++)
+            {
+                sum += values[i];
+            }
+        }
+        return (T)(sum / (SUM)count);
+    }
+
+private:
+    T values[SIZE];  ///< The window in arrival order.
+    SUM sum;         ///< The sum of the window.
+    uint8_t length;  ///< The current length of the window.
+    uint8_t index;   ///< The slot of the oldest value.
+    uint8_t count;   ///< The number of values in the window.
+};
+
+/**
+ * @class MultiCompassFilterStage
+ * @brief The filter stage of one sensor, applied by MultiCompass::filterData() and MultiCompass::filterHeading().
+ * Each axis runs through a median, a moving average and a cascade of biquads, in this order, so spikes are removed
+ * before the linear filters spread them. Every part starts as a pass through and is enabled by its setter.
+ * The heading is filtered as a unit vector of its cosine and sine, so it does not jump at the wrap from 2*PI to 0.
+ * Use the MultiCompassFilter and MultiCompassFilterFixed types instead of the template.
+ * @tparam DATA The sample type, CompassData or CompassFixedData.
+ * @tparam T The type of a scaled axis.
+ * @tparam SUM The type of the moving average sum.
+ * @tparam BIQUAD The biquad class for T.
+ */
+template <typename DATA, typename T, typename SUM, typename BIQUAD>
+class MultiCompassFilterStage
+{
+public:
+    /**
+     * @brief Sets the length of the median window of each axis.
+     * @param length The window length, 1 disables the median, at most MULTICOMPASS_FILTER_MEDIAN.
+     */
+    void setMedian(uint8_t length)
+    {
+        for (uint8_t i = 0; i < 3; i++)
+        {
+            median[i].setLength(length);
+        }
+    }
+
+    /**
+     * @brief Sets the length of the moving average window of each axis.
+     * @param length The window length, 1 disables the average, at most MULTICOMPASS_FILTER_AVERAGE.
+     */
+    void setAverage(uint8_t length)
+    {
+        for (uint8_t i = 0; i < 3; i++)
+        {
+            average[i].setLength(length);
+        }
+    }
+
+#if !defined(MULTICOMPASS_NO_FLOAT)
+    /**
+     * @brief Configures the biquads of each axis as a Butterworth low-pass of twice the given number of sections.
+     * @param cutoff The cutoff frequency in Hz, 0 disables the low-pass.
+     * @param sampleRate The sample rate in Hz, usually the output rate of the sensor.
+     * @param sections The number of biquad sections, at most MULTICOMPASS_FILTER_SECTIONS.
+     */
+    void setLowPass(float cutoff, float sampleRate, uint8_t sections = 1)
+    {
+        sectionCount = cutoff > 0 ? min(sections, (uint8_t)MULTICOMPASS_FILTER_SECTIONS) : 0;
+        for (uint8_t k = 0; k < sectionCount; k++)
+        {
+            // The pole pairs of a Butterworth filter of order 2 * n have the quality factors 1 / (2 cos((2k + 1) PI / (4 n))).
+            CompassBiquadCoefficients coefficients;
+            float q = 0.5f / cosf((2 * k + 1) * (float)PI / (4 * sectionCount));
+            MultiCompassBiquad::lowPass(cutoff, sampleRate, q, &coefficients);
+            for (uint8_t i = 0; i < 3; i++)
+            {
+                biquads[i][k].setCoefficients(&coefficients);
+            }
+        }
+    }
+
+    /**
+     * @brief Configures the second order Butterworth low-pass of the heading.
+     * @param cutoff The cutoff frequency in Hz, 0 disables the heading filter.
+     * @param sampleRate The sample rate in Hz.
+     */
+    void setHeadingLowPass(float cutoff, float sampleRate)
+    {
+        headingEnabled = cutoff > 0;
+        if (headingEnabled)
+        {
+            CompassBiquadCoefficients coefficients;
+            MultiCompassBiquad::lowPass(cutoff, sampleRate, 0.7071f, &coefficients);
+            headingCosine.setCoefficients(&coefficients);
+            headingSine.setCoefficients(&coefficients);
+        }
+    }
+#endif
+
+    /**
+     * @brief Drops the history of all filters, e.g. after the calibration changed.
+     */
+    void reset()
+    {
+        for (uint8_t i = 0; i < 3; i++)
+        {
+            median[i].reset();
+            average[i].reset();
+            for (uint8_t k = 0; k < MULTICOMPASS_FILTER_SECTIONS; k++)
+            {
+                biquads[i][k].reset();
+            }
+        }
+        headingCosine.reset();
+        headingSine.reset();
+    }
+
+    /**
+     * @brief Filters the scaled axes of a sample in place.
+     * @param data A pointer to the sample.
+     */
+    void filter(DATA *data)
+    {
+        data->scaledX = filterAxis(0, data->scaledX);
+        data->scaledY = filterAxis(1, data->scaledY);
+        data->scaledZ = filterAxis(2, data->scaledZ);
+    }
+
+    /**
+     * @brief Filters the heading of a sample in place.
+     * @param data A pointer to the sample.
+     */
+    void filterHeading(DATA *data)
+    {
+        if (!headingEnabled)
+        {
+            return;
+        }
+        T cosine, sine;
+        toVector(data->heading, &cosine, &sine);
+        // The filtered vector is shorter than one while the heading turns, its direction is all that counts.
+        data->heading = fromVector(headingSine.update(sine), headingCosine.update(cosine), data->heading);
+    }
+
+private:
+    /**
+     * @brief Runs one axis through the median, the average and the biquads.
+     * @param axis The index of the axis.
+     * @param value The scaled value.
+     * @return The filtered value.
+     */
+    T filterAxis(uint8_t axis, T value)
+    {
+        value = median[axis].update(value);
+        value = average[axis].update(value);
+        for (uint8_t k = 0; k < sectionCount; k++)
+        {
+            value = biquads[axis][k].update(value);
+        }
+        return value;
+    }
+
+#if !defined(MULTICOMPASS_NO_FLOAT)
+    /**
+     * @brief Converts a heading in radians to a unit vector.
+     */
+    static void toVector(float heading, float *cosine, float *sine)
+    {
+        *cosine = cosf(heading);
+        *sine = sinf(heading);
+    }
+#endif
+
+    /**
+     * @brief Converts a binary angle to a unit vector in Q14.
+     */
+    static void toVector(uint16_t heading, int16_t *cosine, int16_t *sine)
+    {
+        MultiCompass::sinCosFixed(heading, sine, cosine);
+    }
+
+#if !defined(MULTICOMPASS_NO_FLOAT)
+    /**
+     * @brief Converts a vector to a heading in radians between 0 and 2*PI, keeps the last heading for a zero vector.
+     */
+    static float fromVector(float sine, float cosine, float heading)
+    {
+        if (sine == 0 && cosine == 0)
+        {
+            return heading;
+        }
+        heading = atan2f(sine, cosine);
+        return heading < 0 ? heading + 2 * (float)PI : heading;
+    }
+#endif
+
+    /**
+     * @brief Converts a Q14 vector to a binary angle, keeps the last heading for a zero vector.
+     */
+    static uint16_t fromVector(int16_t sine, int16_t cosine, uint16_t heading)
+    {
+        return (sine == 0 && cosine == 0) ? heading : MultiCompass::atan2Fixed(sine, cosine);
+    }
+
+    MultiCompassMedian<T, MULTICOMPASS_FILTER_MEDIAN> median[3];              ///< The median of each axis.
+    MultiCompassMovingAverage<T, SUM, MULTICOMPASS_FILTER_AVERAGE> average[3]; ///< The moving average of each axis.
+    BIQUAD biquads[3][MULTICOMPASS_FILTER_SECTIONS];                          ///< The biquad cascade of each axis.
+    uint8_t sectionCount = 0;                                                  ///< The number of active biquad sections.
+    BIQUAD headingCosine;                                                      ///< The low-pass of the heading cosine.
+    BIQUAD headingSine;                                                        ///< The low-pass of the heading sine.
+    bool headingEnabled = false;                                               ///< The heading is filtered.
+};
+
+#endif
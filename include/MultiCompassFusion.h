@@ -0,0 +1,109 @@
+/**
+ * @file MultiCompassFusion.h
+ * @brief Header file for MultiCompassFusion class
+ * This file contains the declarations for the MultiCompassFusion class which combines the readings of redundant
+ * sensors of a MultiCompassArray into one heading.
+ */
+
+#ifndef MULTICOMPASS_FUSION_H
+#define MULTICOMPASS_FUSION_H
+
+#include "MultiCompass.h"
+#include "MultiCompassArray.h"
+
+#if defined(MULTICOMPASS_NO_FLOAT)
+#error "MultiCompassFusion needs float support, it is not available with MULTICOMPASS_NO_FLOAT"
+#endif
+
+#ifndef MULTICOMPASS_FUSION_GATE
+#define MULTICOMPASS_FUSION_GATE 0.2f ///< Distance from the median vector beyond which a sensor is voted out, 1.0 is the field
+#endif
+
+#ifndef MULTICOMPASS_FUSION_ALPHA
+#define MULTICOMPASS_FUSION_ALPHA 0.0625f ///< Weight of a frame in the noise estimate of each sensor
+#endif
+
+#ifndef MULTICOMPASS_FUSION_NOISE
+#define MULTICOMPASS_FUSION_NOISE 0.01f ///< Initial noise variance of each sensor
+#endif
+
+#ifndef MULTICOMPASS_FUSION_FLOOR
+#define MULTICOMPASS_FUSION_FLOOR 0.0001f ///< Smallest noise variance, so a single quiet sensor cannot take all the weight
+#endif
+
+#ifndef MULTICOMPASS_FUSION_ANOMALY_WEIGHT
+#define MULTICOMPASS_FUSION_ANOMALY_WEIGHT 0.1f ///< Factor of the weight of a sample flagged with COMPASS_FLAG_ANOMALY
+#endif
+
+/**
+ * @class MultiCompassFusion
+ * @brief Class for a robust heading from the redundant sensors of a MultiCompassArray.
+ * The calibrated field vectors are combined instead of the headings, so there is no wrap at 0 and 2*PI.
+ * Sensors further than MULTICOMPASS_FUSION_GATE from the component wise median are voted out, the others are averaged
+ * with weights from their noise and flags. The noise of each sensor is its running variance around the vector fused from the other sensors.
+ * The scaled vectors of all sensors have to share the axes of the platform, a rotated mounting can be folded into the
+ * soft iron matrix of the sensor.
+ */
+class MultiCompassFusion
+{
+public:
+    /**
+     * @brief Constructor for MultiCompassFusion class.
+     * @param array A pointer to the array whose frames are fused, has to stay valid while the fusion is used.
+     */
+    MultiCompassFusion(MultiCompassArray *array);
+
+    /**
+     * @brief Resets the noise estimates of all sensors.
+     */
+    void reset();
+
+    /**
+     * @brief Fuses the scaled readings of a frame into one sample.
+     * The heading is calculated with the declination, method and unit of the first sensor of the array.
+     * @param frame A pointer to a frame read by MultiCompassArray::readFrame(), its scaled axes are used as delivered.
+     * @param result A pointer to a CompassData struct where the fused scaled vector and heading will be stored.
+     * @param x The X axis of the sensor.
+     * @param y The Y axis of the sensor.
+     * @param z The Z axis of the sensor.
+     * @return true if at least one sensor contributed, false otherwise.
+     */
+    bool fuse(const MultiCompassFrame *frame, CompassData *result, int x = 0, int y = 0, int z = 1);
+
+    /**
+     * @brief Gets the sensors that contributed to the last fused sample.
+     * @return A bit mask, bit n is set if sensor n contributed.
+     */
+    uint32_t getUsedMask();
+
+    /**
+     * @brief Gets the noise estimate of a sensor.
+     * @param index The index of the sensor.
+     * @return The RMS distance of its vector from the vector fused from the other sensors, 1.0 is the field.
+     */
+    float getNoise(uint8_t index);
+
+    /**
+     * @brief Gets how often a sensor was voted out.
+     * @param index The index of the sensor.
+     * @return The number of frames the sensor was an outlier in.
+     */
+    uint32_t getOutlierCount(uint8_t index);
+
+private:
+    /**
+     * @brief Calculates the median of a few values.
+     * @param values The values, reordered.
+     * @param count The number of values.
+     * @return The median.
+     */
+    static float median(float *values, uint8_t count);
+
+    MultiCompassArray *array;                        /**< The array whose frames are fused. */
+    float variance[MULTICOMPASS_ARRAY_SIZE];         /**< Running noise variance of each sensor. */
+    uint32_t outliers[MULTICOMPASS_ARRAY_SIZE];      /**< Number of frames each sensor was voted out. */
+    uint32_t usedMask;                               /**< Sensors of the last fused sample. */
+    uint32_t sequence;                               /**< Number of fused samples. */
+};
+
+#endif
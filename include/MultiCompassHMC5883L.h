@@ -13,6 +13,7 @@
 #include <Wire.h>
 
 #include "MultiCompass.h"
+#include "MultiCompassDriver.h"
 
 const uint8_t HMC5883L_ADDRESS = (0x1E); ///< I2C address of the HMC5883L module
 
@@ -30,6 +31,33 @@ const uint8_t HMC5883L_ADDRESS = (0x1E); ///< I2C address of the HMC5883L module
 #define HMC5883L_REGISTER_IDENT_B (0x0B)
 #define HMC5883L_REGISTER_IDENT_C (0x0C)
 
+#define HMC5883L_DATA_LENGTH (6) ///< Number of output bytes from OUT_X_M to OUT_Y_L
+#define HMC5883L_REGISTER_COUNT (13) ///< Number of registers from CONFIG_A to IDENT_C
+#define HMC5883L_REPLAY_LAYOUT {HMC5883L_REGISTER_OUT_X_M, {0, 4, 2}, true} ///< CompassReplayLayout of the output registers, X, Z, Y and MSB first
+
+#define HMC5883L_IDENT_A ('H') ///< Value of IDENT_A
+#define HMC5883L_IDENT_B ('4') ///< Value of IDENT_B
+#define HMC5883L_IDENT_C ('3') ///< Value of IDENT_C
+
+#define HMC5883L_DEFAULT_CONFIG_A (0x10) ///< Power on value of CONFIG_A, 15 Hz without averaging
+#define HMC5883L_DEFAULT_CONFIG_B (0x20) ///< Power on value of CONFIG_B, 1.3 Ga
+#define HMC5883L_DEFAULT_MODE (0x01)     ///< Power on value of MODE, single measurement
+
+#define HMC5883L_CONFIG_BYTES (4) ///< Number of configuration bytes stored with the calibration
+
+#define HMC5883L_MEASUREMENT_TIME (6000) ///< Duration of a single measurement in microseconds
+
+#define HMC5883L_SELFTEST_POSITIVE (0x71) ///< CONFIG_A of the self test, 8 samples, 15 Hz, positive bias
+#define HMC5883L_SELFTEST_NEGATIVE (0x72) ///< CONFIG_A of the self test, 8 samples, 15 Hz, negative bias
+#define HMC5883L_SELFTEST_CONFIG_B (0xA0) ///< CONFIG_B of the self test, 4.7 Ga
+#define HMC5883L_SELFTEST_LOW (243)       ///< Smallest valid bias reading at 4.7 Ga
+#define HMC5883L_SELFTEST_HIGH (575)      ///< Largest valid bias reading at 4.7 Ga
+#define HMC5883L_SELFTEST_WAIT (67)       ///< Time between two conversions at 15 Hz in milliseconds
+
+#define HMC5883L_OVERFLOW (-4096)     ///< Value of an axis that saturated
+#define HMC5883L_AUTORANGE_HIGH (1900) ///< Peak value that selects the next less sensitive field range
+#define HMC5883L_AUTORANGE_LOW (1024)  ///< Peak value the next more sensitive field range has to stay below
+
 typedef enum
 {
     HMC5883L_SAMPLES_8 = 0b11,
@@ -74,7 +102,7 @@ typedef enum
  * This class provides a way to interface with the HMC5883L compass module via the Arduino framework and the Wire library.
  * It provides methods to set and get various parameters of the module, and also to obtain compass data and perform calibration.
  */
-class MultiCompassHMC5883L : public MultiCompass
+class MultiCompassHMC5883L : public MultiCompassDriver<MultiCompassHMC5883L>
 {
 public:
     /**
@@ -83,8 +111,39 @@ public:
      */
     MultiCompassHMC5883L(TwoWire *wire1);
 
+    /**
+     * @brief Constructor for the MultiCompassHMC5883L class with another bus.
+     * @param transport A pointer to the transport, e.g. a MultiCompassMockTransport replaying recorded samples.
+     */
+    MultiCompassHMC5883L(MultiCompassTransport *transport);
+
+    /**
+     * @brief Gets the name of the sensor type.
+     * @return "HMC5883L".
+     */
+    static const char *name() { return "HMC5883L"; }
+
+    /**
+     * @brief Identifies the module and loads its configuration.
+     * CONFIG_A to IDENT_C are read in a single burst, which confirms the address, checks the identification "H43"
+     * and refreshes the shadow copies. The optional self test adds about 300 milliseconds.
+     * @param selfTest Whether to run selfTest() and apply its gain corrections.
+     * @return COMPASS_SETUP_OK if the module is ready, otherwise the reason of the failure.
+     */
+    CompassSetupStatus begin(bool selfTest = false);
+
+    /**
+     * @brief Runs the built-in self test and derives the gain correction of each axis.
+     * The internal coil excites each axis with a known field, positive and negative, so the ambient field cancels out.
+     * Afterwards the previous configuration is written again.
+     * @return COMPASS_SETUP_OK if all axes are within the limits of the datasheet, otherwise the reason of the failure.
+     */
+    CompassSetupStatus selfTest();
+
     /**
      * @brief Sets the measurement mode of the HMC5883L module.
+     * The setters and getters work on shadow copies of the registers, so a setter is a single write
+     * and a getter needs no bus access. Call loadConfig() to refresh the copies from the module.
      * @param mode The measurement mode to set.
      */
     void setMode(HMC5883L_Mode mode);
@@ -131,27 +190,167 @@ public:
      */
     HMC5883L_Samples getAveragedSamples();
 
+    /**
+     * @brief Sets the whole configuration of the HMC5883L module with a single transaction.
+     * @param samples The number of averaged samples to set.
+     * @param samplerate The output data rate to set.
+     * @param range The field range to set.
+     * @param mode The measurement mode to set.
+     * @return true if the configuration was written, false otherwise.
+     */
+    bool setConfig(HMC5883L_Samples samples, HMC5883L_OutputRate samplerate, HMC5883L_FieldRange range, HMC5883L_Mode mode);
+
+    /**
+     * @brief Writes the shadow copies of CONFIG_A, CONFIG_B and MODE in a single transaction.
+     * @return true if the registers were written, false otherwise.
+     */
+    bool applyConfig();
+
+    /**
+     * @brief Refreshes the shadow copies of CONFIG_A, CONFIG_B and MODE from the module in a single transaction.
+     * @return true if the registers were read, false otherwise.
+     */
+    bool loadConfig();
+
+    /**
+     * @brief Gets the configuration that is stored with the calibration.
+     * @param buffer A pointer to the buffer where CONFIG_A, CONFIG_B, MODE and the calibration range will be stored.
+     * @param length The size of the buffer.
+     * @return The number of configuration bytes, 0 if the buffer is too small.
+     */
+    uint8_t getConfigBytes(uint8_t *buffer, uint8_t length);
+
+    /**
+     * @brief Restores the configuration that was stored with the calibration and writes it to the module.
+     * @param buffer A pointer to the configuration bytes.
+     * @param length The number of configuration bytes.
+     * @return true if the configuration was written, false otherwise.
+     */
+    bool setConfigBytes(const uint8_t *buffer, uint8_t length);
+
+    /**
+     * @brief Checks whether stored configuration bytes belong to this sensor, without applying them.
+     * @param buffer A pointer to the configuration bytes.
+     * @param length The number of configuration bytes.
+     * @return true if the number of bytes and the calibration range are valid, false otherwise.
+     */
+    bool checkConfigBytes(const uint8_t *buffer, uint8_t length);
+
     /**
      * @brief Obtains compass data from the HMC5883L module.
      * @param data A pointer to a CompassData object in which to store the compass data.
+     * @return true if the module was read, false otherwise.
+     */
+    bool getData(CompassData *data);
+
+    /**
+     * @brief Obtains compass data and the status register from the HMC5883L module.
+     * All output registers and the status register are read in a single burst transaction.
+     * @param data A pointer to a CompassData object in which to store the compass data.
+     * @param status A pointer to a byte in which to store the status register.
+     * @return true if the module was read, false otherwise.
+     */
+    bool getData(CompassData *data, uint8_t *status);
+
+    /**
+     * @brief Reads one raw sample from the HMC5883L module in a single burst transaction.
+     * The DRDY pin of the HMC5883L is active low, so use FALLING when enabling the data ready mode.
+     * @param sample A pointer to a CompassRawSample object in which to store the raw sample.
+     * @return true if a sample was read, false otherwise.
+     */
+    bool readRawSample(CompassRawSample *sample);
+
+    /**
+     * @brief Starts a single measurement. The module returns to idle mode by itself once it is completed.
+     * If the data ready mode is enabled, its interrupt signals the completion, otherwise measurementTime is waited.
+     * Enable the data ready mode without buffer when the samples should only be read by getTriggeredData().
+     * @return true if the measurement was started, false otherwise.
+     */
+    bool triggerMeasurement();
+
+    /**
+     * @brief Checks without blocking whether the triggered measurement is completed.
+     * @return true if the measurement can be read, false otherwise.
      */
-    void getData(CompassData *data);
+    bool isMeasurementReady();
 
     /**
-     * @brief Performs calibration of the HMC5883L module.
-     *
-     * This method performs calibration of the HMC5883L module by taking a number of readings and calculating the offset values.
-     * The calibration period can be set by modifying the calibrationPeriod variable.
-     *
+     * @brief Reads the triggered measurement once it is completed, without blocking before that.
      * @param data A pointer to a CompassData object in which to store the compass data.
-     *
-     * @return A boolean indicating whether the calibration was successful or not.
+     * @return true if the measurement was read, false if it is still pending or no measurement was triggered.
      */
-    bool calibration(CompassData *data);
+    bool getTriggeredData(CompassData *data);
 
-    int calibrationPeriod = 1000; ///< The calibration period, in milliseconds.
+    /**
+     * @brief Flags saturated samples and, with auto-ranging enabled, adapts the field range to the signal.
+     * @param data A pointer to a CompassData object containing the raw sensor data.
+     */
+    void checkSample(CompassData *data);
+
+    /**
+     * @brief Enables or disables the automatic selection of the field range.
+     * The range is raised immediately on a saturated sample and lowered once autoRangeHold samples in a row
+     * would fit into the next more sensitive range with margin. Every range change also updates rawScale,
+     * so the scaled values keep the units of the calibration.
+     * @param enable true to enable auto-ranging.
+     */
+    void setAutoRange(bool enable);
+
+    /**
+     * @brief Checks whether auto-ranging is enabled.
+     * @return true if auto-ranging is enabled, false otherwise.
+     */
+    bool isAutoRange();
+
+    /**
+     * @brief Gets the gain of a field range.
+     * @param range The field range.
+     * @return The gain in LSB per gauss.
+     */
+    static uint16_t getGain(HMC5883L_FieldRange range);
+
+    uint32_t measurementTime = HMC5883L_MEASUREMENT_TIME; ///< Time a triggered measurement takes without data ready interrupt, in microseconds.
+    HMC5883L_FieldRange calibrationRange = HMC5883L_FIELDRANGE_1_3GA; ///< The field range the calibration settings were recorded with.
+    uint8_t autoRangeHold = 16; ///< Number of weak samples in a row before auto-ranging selects a more sensitive range.
+#if defined(MULTICOMPASS_NO_FLOAT)
+    uint16_t gainCorrection[3] = {MULTICOMPASS_RAW_SCALE_ONE, MULTICOMPASS_RAW_SCALE_ONE, MULTICOMPASS_RAW_SCALE_ONE}; ///< Gain correction of each axis from the self test, folded into rawScale, 4096 == 1.0.
+#else
+    float gainCorrection[3] = {1, 1, 1}; ///< Gain correction of each axis from the self test, folded into rawScale.
+#endif
 
 private:
+    // Start with the power on values until loadConfig() reads the module.
+    uint8_t configA = HMC5883L_DEFAULT_CONFIG_A;   ///< Shadow copy of CONFIG_A.
+    uint8_t configB = HMC5883L_DEFAULT_CONFIG_B;   ///< Shadow copy of CONFIG_B.
+    uint8_t modeRegister = HMC5883L_DEFAULT_MODE; ///< Shadow copy of MODE.
+
+    bool triggerPending = false; ///< Whether a triggered measurement is not read yet.
+    uint32_t triggerTime = 0;    ///< Time the measurement was triggered, in microseconds.
+    uint8_t triggerCount = 0;    ///< Number of data ready edges when the measurement was triggered.
+
+    bool autoRange = false;  ///< Whether auto-ranging is enabled.
+    uint8_t weakCount = 0;   ///< Number of weak samples in a row.
+    uint8_t settleCount = 0; ///< Number of samples that may still use the previous field range.
+
+    /**
+     * @brief Updates rawScale and the coefficients for the field range in the shadow copy of CONFIG_B.
+     */
+    void updateRawScale();
+
+    /**
+     * @brief Measures the self test field with one bias direction.
+     * @param bias CONFIG_A with the bias bits.
+     * @param sample A pointer to a CompassRawSample object in which to store the measurement.
+     * @return COMPASS_SETUP_OK if the measurement was read, otherwise the reason of the failure.
+     */
+    CompassSetupStatus measureBias(uint8_t bias, CompassRawSample *sample);
+
+    /**
+     * @brief Converts the output register block to raw axis values.
+     * @param buffer The six output bytes, starting at OUT_X_M.
+     * @param sample A pointer to a CompassRawSample object in which to store the raw values.
+     */
+    void decodeData(const uint8_t *buffer, CompassRawSample *sample);
 };
 
 #endif
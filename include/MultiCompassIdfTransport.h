@@ -0,0 +1,72 @@
+/**
+ * @file MultiCompassIdfTransport.h
+ * @brief Header file for the MultiCompassIdfTransport class
+ * This file contains the backend for the i2c_master driver of ESP-IDF 5.2 and later, including arduino-esp32 3.x.
+ */
+
+#ifndef MULTICOMPASS_IDF_TRANSPORT_H
+#define MULTICOMPASS_IDF_TRANSPORT_H
+
+#include "MultiCompassTransport.h"
+
+#if defined(ESP_PLATFORM) && defined(__has_include)
+#if __has_include("driver/i2c_master.h")
+#define MULTICOMPASS_IDF_TRANSPORT ///< Defined if the i2c_master driver is available
+#endif
+#endif
+
+#if defined(MULTICOMPASS_IDF_TRANSPORT)
+
+#include "driver/i2c_master.h"
+
+/**
+ * @class MultiCompassIdfTransport
+ * @brief Reaches the sensor through a bus of the ESP-IDF i2c_master driver.
+ * readRegisters() is a single i2c_master_transmit_receive() with a repeated start, the driver moves the bytes through
+ * the hardware FIFO in its interrupt, so the caller blocks on a semaphore instead of polling the bus.
+ * The device of an address is added to the bus on its first transfer.
+ */
+class MultiCompassIdfTransport : public MultiCompassBufferedTransport
+{
+public:
+    /**
+     * @brief Constructor for MultiCompassIdfTransport class.
+     * @param bus The handle of a bus created with i2c_new_master_bus().
+     * @param clock The SCL frequency of the sensor in Hz.
+     */
+    MultiCompassIdfTransport(i2c_master_bus_handle_t bus, uint32_t clock = 400000);
+
+    /**
+     * @brief Destructor for MultiCompassIdfTransport class, removes the device from the bus.
+     */
+    ~MultiCompassIdfTransport();
+
+    CompassStatus write(uint8_t address, uint8_t reg, const uint8_t *buffer, uint8_t length, uint32_t timeout);
+    void request(uint8_t address, uint8_t length, uint32_t timeout);
+    CompassStatus readRegisters(uint8_t address, uint8_t reg, uint8_t *buffer, uint8_t length, uint32_t timeout);
+    const void *getBus();
+
+private:
+    /**
+     * @brief Adds the device of an address to the bus, replacing the device of another address.
+     * @param address The I2C address of the sensor.
+     * @return true if the device is ready, false otherwise.
+     */
+    bool attach(uint8_t address);
+
+    /**
+     * @brief Converts an error of the driver to a CompassStatus.
+     * @param error The value returned by the driver.
+     * @return The matching CompassStatus.
+     */
+    static CompassStatus status(esp_err_t error);
+
+    i2c_master_bus_handle_t bus;            /**< The bus of the sensor. */
+    i2c_master_dev_handle_t device = NULL;  /**< The device of the last used address. */
+    uint8_t deviceAddress = 0;              /**< The address of device. */
+    uint32_t clock;                         /**< The SCL frequency in Hz. */
+};
+
+#endif
+
+#endif
@@ -0,0 +1,104 @@
+/**
+ * @file MultiCompassMockTransport.h
+ * @brief Header file for the MultiCompassMockTransport class
+ * This file contains a transport that emulates the register file of one sensor in memory and replays recorded
+ * samples through its output registers, so the drivers and the math pipeline run without hardware, e.g. on the host.
+ */
+
+#ifndef MULTICOMPASS_MOCK_TRANSPORT_H
+#define MULTICOMPASS_MOCK_TRANSPORT_H
+
+#include "MultiCompass.h"
+
+#define MULTICOMPASS_MOCK_BUFFER 32 ///< Largest read of one request, the size of the Wire buffer
+
+typedef struct
+{
+    uint8_t reg;       ///< First output register, reading it loads the next sample.
+    uint8_t offset[3]; ///< Offset of the X, Y and Z axis from reg.
+    bool bigEndian;    ///< The MSB of each axis comes first.
+} CompassReplayLayout;
+
+/**
+ * @class MultiCompassMockTransport
+ * @brief Emulates one sensor on the bus.
+ * Writes are stored in a register file of 256 bytes and reads return it from the register pointer on,
+ * which increments after every byte. With a replay, every read that starts at the first output register
+ * loads the next recorded sample in the byte order of the sensor, e.g. HMC5883L_REPLAY_LAYOUT.
+ */
+class MultiCompassMockTransport : public MultiCompassTransport
+{
+public:
+    /**
+     * @brief Constructor for MultiCompassMockTransport class.
+     * @param address The I2C address that is acknowledged, all other addresses fail with COMPASS_ERROR_NACK.
+     */
+    MultiCompassMockTransport(uint8_t address);
+
+    /**
+     * @brief Sets a register, e.g. the identification of the sensor before begin().
+     * @param reg The register.
+     * @param value The value.
+     */
+    void setRegister(uint8_t reg, uint8_t value);
+
+    /**
+     * @brief Gets a register, e.g. to check the configuration written by the driver.
+     * @param reg The register.
+     * @return The value.
+     */
+    uint8_t getRegister(uint8_t reg);
+
+    /**
+     * @brief Sets the samples that are replayed through the output registers.
+     * @param samples A pointer to the samples, they are not copied.
+     * @param count The number of samples.
+     * @param layout A pointer to the layout of the output registers, it is copied.
+     * @param loop Whether to start again after the last sample, otherwise further reads fail with COMPASS_ERROR_NACK.
+     */
+    void setReplay(const CompassRawSample *samples, size_t count, const CompassReplayLayout *layout, bool loop = true);
+
+    /**
+     * @brief Gets the number of replayed samples.
+     * @return The number of samples loaded into the output registers since setReplay().
+     */
+    size_t getReplayPosition();
+
+    /**
+     * @brief Lets the next transactions fail, e.g. to test the retries and the recovery.
+     * @param status The status of the failed transactions.
+     * @param count The number of failed transactions.
+     */
+    void failNext(CompassStatus status, uint8_t count = 1);
+
+    CompassStatus write(uint8_t address, uint8_t reg, const uint8_t *buffer, uint8_t length, uint32_t timeout);
+    void request(uint8_t address, uint8_t length, uint32_t timeout);
+    int available();
+    int read();
+
+    uint32_t writes = 0;   /**< Number of write transactions. */
+    uint32_t requests = 0; /**< Number of read requests. */
+
+private:
+    /**
+     * @brief Loads the next sample into the output registers.
+     * @return true if a sample was loaded, false if the replay is finished.
+     */
+    bool loadSample();
+
+    uint8_t address;                           /**< The acknowledged I2C address. */
+    uint8_t registers[256];                    /**< The register file. */
+    uint8_t pointer = 0;                       /**< The register pointer. */
+    uint8_t received[MULTICOMPASS_MOCK_BUFFER]; /**< The bytes of the last request. */
+    uint8_t receivedLength = 0;                /**< The number of bytes of the last request. */
+    uint8_t receivedPosition = 0;              /**< The number of bytes already read. */
+    const CompassRawSample *samples = NULL;    /**< The replayed samples. */
+    size_t sampleCount = 0;                    /**< The number of replayed samples. */
+    size_t position = 0;                       /**< The number of samples loaded since setReplay(). */
+    CompassReplayLayout layout;                /**< The layout of the output registers. */
+    bool loop = true;                          /**< Start again after the last sample. */
+    CompassStatus failure = COMPASS_OK;        /**< Status of the injected failures. */
+    uint8_t failures = 0;                      /**< Number of remaining injected failures. */
+};
+
+#endif
@@ -0,0 +1,246 @@
+/**
+ * @file MultiCompassQMC5883L.h
+ * @brief This is the header file for the MultiCompassQMC5883L class, which is derived from the MultiCompass class.
+ * This class provides a way to interface with the QMC5883L compass module, found on most current GY-271 boards,
+ * via the Arduino framework and the Wire library.
+ */
+
+#ifndef MULTICOMPASS_QMC5883L_H
+#define MULTICOMPASS_QMC5883L_H
+
+#include <Arduino.h>
+#include <Wire.h>
+
+#include "MultiCompass.h"
+#include "MultiCompassDriver.h"
+
+const uint8_t QMC5883L_ADDRESS = (0x0D); ///< I2C address of the QMC5883L module
+
+#define QMC5883L_REGISTER_OUT_X_L (0x00)
+#define QMC5883L_REGISTER_OUT_X_M (0x01)
+#define QMC5883L_REGISTER_OUT_Y_L (0x02)
+#define QMC5883L_REGISTER_OUT_Y_M (0x03)
+#define QMC5883L_REGISTER_OUT_Z_L (0x04)
+#define QMC5883L_REGISTER_OUT_Z_M (0x05)
+#define QMC5883L_REGISTER_STATUS (0x06)
+#define QMC5883L_REGISTER_TEMP_L (0x07)
+#define QMC5883L_REGISTER_TEMP_M (0x08)
+#define QMC5883L_REGISTER_CONTROL_1 (0x09)
+#define QMC5883L_REGISTER_CONTROL_2 (0x0A)
+#define QMC5883L_REGISTER_SET_RESET (0x0B)
+#define QMC5883L_REGISTER_CHIP_ID (0x0D)
+
+#define QMC5883L_DATA_LENGTH (6) ///< Number of output bytes from OUT_X_L to OUT_Z_M
+#define QMC5883L_REPLAY_LAYOUT {QMC5883L_REGISTER_OUT_X_L, {0, 2, 4}, false} ///< CompassReplayLayout of the output registers, X, Y, Z and LSB first
+
+#define QMC5883L_STATUS_DRDY (0x01) ///< New data is ready
+#define QMC5883L_STATUS_OVL (0x02)  ///< At least one axis is out of range
+#define QMC5883L_STATUS_DOR (0x04)  ///< A measurement was skipped because the data was not read
+
+#define QMC5883L_CONTROL_2_SOFT_RST (0x80) ///< Resets all registers
+#define QMC5883L_CONTROL_2_ROL_PNT (0x40)  ///< Lets the register pointer roll over from the status register to OUT_X_L
+#define QMC5883L_CONTROL_2_INT_DISABLE (0x01) ///< Disables the DRDY pin
+
+#define QMC5883L_DEFAULT_CONTROL_1 (0x00) ///< Power on value of CONTROL_1, standby
+#define QMC5883L_DEFAULT_CONTROL_2 (0x00) ///< Power on value of CONTROL_2, DRDY pin enabled
+#define QMC5883L_SET_RESET_PERIOD (0x01) ///< Recommended value of the SET/RESET period register
+#define QMC5883L_CHIP_ID (0xFF)          ///< Value of the chip id register
+
+#define QMC5883L_CONFIG_BYTES (3) ///< Number of configuration bytes stored with the calibration
+
+#define QMC5883L_OVERFLOW (-32768) ///< Value of all axes of a sample that was out of range
+
+typedef enum
+{
+    QMC5883L_OVERSAMPLING_512 = 0b00,
+    QMC5883L_OVERSAMPLING_256 = 0b01,
+    QMC5883L_OVERSAMPLING_128 = 0b10,
+    QMC5883L_OVERSAMPLING_64 = 0b11,
+} QMC5883L_Oversampling;
+
+typedef enum
+{
+    QMC5883L_OUTPUTRATE_200HZ = 0b11,
+    QMC5883L_OUTPUTRATE_100HZ = 0b10,
+    QMC5883L_OUTPUTRATE_50HZ = 0b01,
+    QMC5883L_OUTPUTRATE_10HZ = 0b00,
+} QMC5883L_OutputRate;
+
+typedef enum
+{
+    QMC5883L_FIELDRANGE_8GA = 0b01,
+    QMC5883L_FIELDRANGE_2GA = 0b00,
+} QMC5883L_FieldRange;
+
+typedef enum
+{
+    QMC5883L_MODE_CONTINOUS = 0b01,
+    QMC5883L_MODE_STANDBY = 0b00,
+} QMC5883L_Mode;
+
+/**
+ * @class MultiCompassQMC5883L
+ * @brief A class for interfacing with the QMC5883L compass module.
+ * It shares the burst read, data ready, batch and scaling machinery of MultiCompass. The module delivers
+ * little endian X, Y, Z values with 16 bit and supports up to 200 Hz. Its DRDY pin is active high,
+ * so use RISING when enabling the data ready mode.
+ */
+class MultiCompassQMC5883L : public MultiCompassDriver<MultiCompassQMC5883L>
+{
+public:
+    /**
+     * @brief Constructor for the MultiCompassQMC5883L class.
+     * @param wire1 A pointer to a TwoWire object representing the I2C bus to which the QMC5883L module is connected.
+     */
+    MultiCompassQMC5883L(TwoWire *wire1);
+
+    /**
+     * @brief Constructor for the MultiCompassQMC5883L class with another bus.
+     * @param transport A pointer to the transport, e.g. a MultiCompassMockTransport replaying recorded samples.
+     */
+    MultiCompassQMC5883L(MultiCompassTransport *transport);
+
+    /**
+     * @brief Gets the name of the sensor type.
+     * @return "QMC5883L".
+     */
+    static const char *name() { return "QMC5883L"; }
+
+    /**
+     * @brief Checks the chip id, sets the recommended SET/RESET period and writes the configuration.
+     * @param selfTest Ignored, the QMC5883L has no self test.
+     * @return COMPASS_SETUP_OK if the module is ready, otherwise the reason of the failure.
+     */
+    CompassSetupStatus begin(bool selfTest = false);
+
+    /**
+     * @brief Sets the measurement mode of the QMC5883L module.
+     * The setters and getters work on shadow copies of the registers, so a setter is a single write
+     * and a getter needs no bus access. Call loadConfig() to refresh the copies from the module.
+     * @param mode The measurement mode to set.
+     */
+    void setMode(QMC5883L_Mode mode);
+
+    /**
+     * @brief Gets the measurement mode of the QMC5883L module.
+     * @return The current measurement mode.
+     */
+    QMC5883L_Mode getMode();
+
+    /**
+     * @brief Sets the field range of the QMC5883L module.
+     * @param range The field range to set.
+     */
+    void setFieldRange(QMC5883L_FieldRange range);
+
+    /**
+     * @brief Gets the field range of the QMC5883L module.
+     * @return The current field range.
+     */
+    QMC5883L_FieldRange getFieldRange();
+
+    /**
+     * @brief Sets the output data rate of the QMC5883L module.
+     * @param samplerate The output data rate to set.
+     */
+    void setOutputRate(QMC5883L_OutputRate samplerate);
+
+    /**
+     * @brief Gets the output data rate of the QMC5883L module.
+     * @return The current output data rate.
+     */
+    QMC5883L_OutputRate getOutputRate();
+
+    /**
+     * @brief Sets the over sampling ratio of the QMC5883L module. Higher ratios reduce the noise and raise the power.
+     * @param oversampling The over sampling ratio to set.
+     */
+    void setOversampling(QMC5883L_Oversampling oversampling);
+
+    /**
+     * @brief Gets the over sampling ratio of the QMC5883L module.
+     * @return The current over sampling ratio.
+     */
+    QMC5883L_Oversampling getOversampling();
+
+    /**
+     * @brief Sets the whole configuration of the QMC5883L module with a single transaction.
+     * @param oversampling The over sampling ratio to set.
+     * @param samplerate The output data rate to set.
+     * @param range The field range to set.
+     * @param mode The measurement mode to set.
+     * @return true if the configuration was written, false otherwise.
+     */
+    bool setConfig(QMC5883L_Oversampling oversampling, QMC5883L_OutputRate samplerate, QMC5883L_FieldRange range, QMC5883L_Mode mode);
+
+    /**
+     * @brief Writes the shadow copies of CONTROL_1 and CONTROL_2 in a single transaction.
+     * @return true if the registers were written, false otherwise.
+     */
+    bool applyConfig();
+
+    /**
+     * @brief Refreshes the shadow copies of CONTROL_1 and CONTROL_2 from the module in a single transaction.
+     * @return true if the registers were read, false otherwise.
+     */
+    bool loadConfig();
+
+    /**
+     * @brief Gets the configuration that is stored with the calibration.
+     * @param buffer A pointer to the buffer where CONTROL_1, CONTROL_2 and the calibration range will be stored.
+     * @param length The size of the buffer.
+     * @return The number of configuration bytes, 0 if the buffer is too small.
+     */
+    uint8_t getConfigBytes(uint8_t *buffer, uint8_t length);
+
+    /**
+     * @brief Restores the configuration that was stored with the calibration and writes it to the module.
+     * @param buffer A pointer to the configuration bytes.
+     * @param length The number of configuration bytes.
+     * @return true if the configuration was written, false otherwise.
+     */
+    bool setConfigBytes(const uint8_t *buffer, uint8_t length);
+
+    /**
+     * @brief Checks whether stored configuration bytes belong to this sensor, without applying them.
+     * @param buffer A pointer to the configuration bytes.
+     * @param length The number of configuration bytes.
+     * @return true if the number of bytes and the calibration range are valid, false otherwise.
+     */
+    bool checkConfigBytes(const uint8_t *buffer, uint8_t length);
+
+    /**
+     * @brief Reads one raw sample and the status register from the QMC5883L module in a single burst transaction.
+     * If the status reports an overflow, all axes are set to QMC5883L_OVERFLOW.
+     * @param sample A pointer to a CompassRawSample object in which to store the raw sample.
+     * @return true if a sample was read, false otherwise.
+     */
+    bool readRawSample(CompassRawSample *sample);
+
+    /**
+     * @brief Flags samples that were out of range.
+     * @param data A pointer to a CompassData object containing the raw sensor data.
+     */
+    void checkSample(CompassData *data);
+
+    /**
+     * @brief Gets the gain of a field range.
+     * @param range The field range.
+     * @return The gain in LSB per gauss.
+     */
+    static uint16_t getGain(QMC5883L_FieldRange range);
+
+    QMC5883L_FieldRange calibrationRange = QMC5883L_FIELDRANGE_2GA; ///< The field range the calibration settings were recorded with.
+
+private:
+    // Start with the power on values until loadConfig() reads the module.
+    uint8_t control1 = QMC5883L_DEFAULT_CONTROL_1; ///< Shadow copy of CONTROL_1.
+    uint8_t control2 = QMC5883L_DEFAULT_CONTROL_2; ///< Shadow copy of CONTROL_2.
+
+    /**
+     * @brief Updates rawScale and the coefficients for the field range in the shadow copy of CONTROL_1.
+     */
+    void updateRawScale();
+};
+
+#endif
@@ -0,0 +1,109 @@
+/**
+ * @file MultiCompassRingBuffer.h
+ * @brief Header file for the MultiCompassRingBuffer class
+ * This file contains a fixed-size, lock-free ring buffer for exactly one producer and one consumer.
+ * It is used to hand samples from an interrupt or a background task to the main loop without locks.
+ */
+
+#ifndef MULTICOMPASS_RINGBUFFER_H
+#define MULTICOMPASS_RINGBUFFER_H
+
+#include <stdint.h>
+
+#if defined(ARDUINO_ARCH_ESP32) || defined(__ARM_ARCH)
+#define MULTICOMPASS_MEMORY_BARRIER() __sync_synchronize() ///< Hardware barrier for multi-core and ARM targets
+#else
+#define MULTICOMPASS_MEMORY_BARRIER() __asm__ __volatile__("" ::: "memory") ///< Compiler barrier for single-core targets
+#endif
+
+/**
+ * @class MultiCompassRingBuffer
+ * @brief A single-producer/single-consumer ring buffer with a fixed capacity.
+ * The producer only writes the head index and the consumer only writes the tail index, so no locks are needed.
+ * The indices are single bytes, which makes every index access atomic even on 8-bit targets.
+ * @tparam T The type of the stored items.
+ * @tparam SIZE The capacity of the buffer, has to be a power of two between 2 and 128.
+ */
+template <typename T, uint8_t SIZE>
+class MultiCompassRingBuffer
+{
+    static_assert(SIZE >= 2 && SIZE <= 128 && (SIZE & (SIZE - 1)) == 0, "SIZE has to be a power of two between 2 and 128");
+
+public:
+    /**
+     * @brief Constructor for the MultiCompassRingBuffer class.
+     */
+    MultiCompassRingBuffer() : head(0), tail(0) {}
+
+    /**
+     * @brief Adds an item to the buffer. May only be called by the producer.
+     * @param item The item to add.
+     * @return true if the item was stored, false if the buffer is full.
+     */
+    bool push(const T &item)
+    {
+        uint8_t h = head;
+        if ((uint8_t)(h - tail) >= SIZE)
+        {
+            return false;
+        }
+        items[h & (SIZE - 1)] = item;
+        // Publish the item before the new head becomes visible to the consumer.
+        MULTICOMPASS_MEMORY_BARRIER();
+        head = h + 1;
+        return true;
+    }
+
+    /**
+     * @brief Removes the oldest item from the buffer. May only be called by the consumer.
+     * @param item A reference where the removed item will be stored.
+     * @return true if an item was removed, false if the buffer is empty.
+     */
+    bool pop(T &item)
+    {
+        uint8_t t = tail;
+        if (t == head)
+        {
+            return false;
+        }
+        MULTICOMPASS_MEMORY_BARRIER();
+        item = items[t & (SIZE - 1)];
+        // Finish reading the item before the slot is handed back to the producer.
+        MULTICOMPASS_MEMORY_BARRIER();
+        tail = t + 1;
+        return true;
+    }
+
+    /**
+     * @brief Gets the number of items currently stored in the buffer.
+     * @return The number of stored items.
+     */
+    uint8_t available() const
+    {
+        return (uint8_t)(head - tail);
+    }
+
+    /**
+     * @brief Gets the capacity of the buffer.
+     * @return The maximal number of stored items.
+     */
+    uint8_t capacity() const
+    {
+        return SIZE;
+    }
+
+    /**
+     * @brief Drops all stored items. May only be called by the consumer.
+     */
+    void clear()
+    {
+        tail = head;
+    }
+
+private:
+    T items[SIZE];          ///< The storage of the items.
+    volatile uint8_t head;  ///< Free running write index, only written by the producer.
+    volatile uint8_t tail;  ///< Free running read index, only written by the consumer.
+};
+
+#endif
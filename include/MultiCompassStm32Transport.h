@@ -0,0 +1,64 @@
+/**
+ * @file MultiCompassStm32Transport.h
+ * @brief Header file for the MultiCompassStm32Transport class
+ * This file contains the backend for an I2C peripheral of the STM32 HAL, e.g. in STM32duino or a CubeMX project.
+ */
+
+#ifndef MULTICOMPASS_STM32_TRANSPORT_H
+#define MULTICOMPASS_STM32_TRANSPORT_H
+
+#include "MultiCompassTransport.h"
+
+#if defined(HAL_I2C_MODULE_ENABLED)
+
+#define MULTICOMPASS_STM32_CACHE_LINE 32 ///< Size of a D-cache line of the Cortex-M7
+#define MULTICOMPASS_STM32_DMA_BUFFER ((MULTICOMPASS_TRANSPORT_BUFFER + MULTICOMPASS_STM32_CACHE_LINE - 1) & ~(MULTICOMPASS_STM32_CACHE_LINE - 1)) ///< DMA buffer rounded up to whole cache lines
+
+/**
+ * @class MultiCompassStm32Transport
+ * @brief Reaches the sensor through an I2C handle of the STM32 HAL.
+ * If a receive DMA channel is linked to the handle, bursts are read with HAL_I2C_Mem_Read_DMA() and asynchronous reads
+ * run entirely in the DMA, available() reports the bytes once the transfer is complete. Without DMA the blocking HAL
+ * functions are used. The DMA always writes into a buffer of the transport that covers whole cache lines, on parts
+ * with a D-cache (F7, H7) its lines are invalidated around the transfer before the bytes are copied out, so the
+ * buffers of the caller need no alignment. The transport itself has to be in memory the DMA can reach, e.g. not in
+ * the DTCM. Bursts longer than MULTICOMPASS_TRANSPORT_BUFFER use the blocking functions.
+ */
+class MultiCompassStm32Transport : public MultiCompassBufferedTransport
+{
+public:
+    /**
+     * @brief Constructor for MultiCompassStm32Transport class.
+     * @param handle The initialized I2C handle.
+     */
+    MultiCompassStm32Transport(I2C_HandleTypeDef *handle);
+
+    CompassStatus write(uint8_t address, uint8_t reg, const uint8_t *buffer, uint8_t length, uint32_t timeout);
+    void request(uint8_t address, uint8_t length, uint32_t timeout);
+    void abort();
+    int available();
+    const void *getBus();
+    CompassStatus readRegisters(uint8_t address, uint8_t reg, uint8_t *buffer, uint8_t length, uint32_t timeout);
+
+private:
+    /**
+     * @brief Converts the result of a HAL function to a CompassStatus.
+     * @param result The value returned by the HAL.
+     * @return The matching CompassStatus.
+     */
+    CompassStatus status(HAL_StatusTypeDef result);
+
+    /**
+     * @brief Discards the cached lines of the DMA buffer, so the CPU reads what the DMA wrote to memory.
+     */
+    void invalidateDmaBuffer();
+
+    I2C_HandleTypeDef *handle; /**< The I2C handle of the bus. */
+    uint8_t pendingLength = 0; /**< Length of the running DMA receive of request(), 0 if none. */
+    uint8_t pendingAddress = 0; /**< I2C address of the running DMA receive of request(). */
+    uint8_t dmaBuffer[MULTICOMPASS_STM32_DMA_BUFFER] __attribute__((aligned(MULTICOMPASS_STM32_CACHE_LINE))); /**< The target of every DMA receive. */
+};
+
+#endif
+
+#endif
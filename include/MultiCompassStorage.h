@@ -0,0 +1,98 @@
+/**
+ * @file MultiCompassStorage.h
+ * @brief Header file for the MultiCompassStorage classes
+ * This file contains the storage interface used by MultiCompass::saveCalibration() and MultiCompass::loadCalibration()
+ * and its backends for the ESP32 non-volatile storage and the AVR EEPROM.
+ */
+
+#ifndef MULTICOMPASS_STORAGE_H
+#define MULTICOMPASS_STORAGE_H
+
+#if ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#if defined(ARDUINO_ARCH_ESP32)
+#include <Preferences.h>
+#elif defined(__AVR__)
+#include <EEPROM.h>
+#endif
+
+/**
+ * @class MultiCompassStorage
+ * @brief Interface of a non-volatile storage that holds one calibration blob.
+ */
+class MultiCompassStorage
+{
+public:
+    /**
+     * @brief Destructor for MultiCompassStorage class.
+     */
+    virtual ~MultiCompassStorage() {}
+
+    /**
+     * @brief Reads the stored blob.
+     * @param buffer A pointer to the buffer where the blob will be stored.
+     * @param length The size of the buffer.
+     * @return The number of bytes read, 0 if nothing is stored.
+     */
+    virtual size_t read(uint8_t *buffer, size_t length) = 0;
+
+    /**
+     * @brief Replaces the stored blob.
+     * @param buffer A pointer to the blob.
+     * @param length The length of the blob.
+     * @return true if the blob was stored, false otherwise.
+     */
+    virtual bool write(const uint8_t *buffer, size_t length) = 0;
+};
+
+#if defined(ARDUINO_ARCH_ESP32)
+/**
+ * @class MultiCompassPreferencesStorage
+ * @brief Stores the blob as one key of the ESP32 non-volatile storage through the Preferences library.
+ */
+class MultiCompassPreferencesStorage : public MultiCompassStorage
+{
+public:
+    /**
+     * @brief Constructor for MultiCompassPreferencesStorage class.
+     * Use a different key for every sensor that shares the namespace.
+     * @param name The namespace, at most 15 characters.
+     * @param key The key of the blob, at most 15 characters.
+     */
+    MultiCompassPreferencesStorage(const char *name = "multicompass", const char *key = "calibration");
+
+    size_t read(uint8_t *buffer, size_t length);
+    bool write(const uint8_t *buffer, size_t length);
+
+private:
+    const char *name; /**< The namespace of the blob. */
+    const char *key;  /**< The key of the blob. */
+};
+#elif defined(__AVR__)
+/**
+ * @class MultiCompassEEPROMStorage
+ * @brief Stores the blob at a fixed address of the AVR EEPROM.
+ */
+class MultiCompassEEPROMStorage : public MultiCompassStorage
+{
+public:
+    /**
+     * @brief Constructor for MultiCompassEEPROMStorage class.
+     * Every sensor needs its own region of MULTICOMPASS_BLOB_SIZE bytes.
+     * @param address The first EEPROM address of the blob.
+     */
+    MultiCompassEEPROMStorage(int address = 0);
+
+    size_t read(uint8_t *buffer, size_t length);
+    bool write(const uint8_t *buffer, size_t length);
+
+private:
+    int address; /**< The first EEPROM address of the blob. */
+};
+#endif
+
+#endif
@@ -0,0 +1,114 @@
+/**
+ * @file MultiCompassStream.h
+ * @brief Header file for the MultiCompassStream class
+ * This file contains a binary encoder that writes raw samples as packed 10 byte records in COBS framed,
+ * CRC protected batches to any Print, e.g. Serial. tools/multicompass_decode.py decodes the stream on the host.
+ */
+
+#ifndef MULTICOMPASS_STREAM_H
+#define MULTICOMPASS_STREAM_H
+
+#include "MultiCompass.h"
+
+#ifndef MULTICOMPASS_STREAM_BATCH
+#if defined(__AVR__)
+#define MULTICOMPASS_STREAM_BATCH 4 ///< Number of records per frame
+#else
+#define MULTICOMPASS_STREAM_BATCH 16 ///< Number of records per frame
+#endif
+#endif
+
+#define MULTICOMPASS_STREAM_VERSION 1 ///< Layout version of a frame
+#define MULTICOMPASS_STREAM_HEADER 11 ///< Size of the frame header: version, sensor, count, timestamp and sequence
+#define MULTICOMPASS_RECORD_SIZE 10   ///< Size of a packed record
+#define MULTICOMPASS_STREAM_PAYLOAD (MULTICOMPASS_STREAM_HEADER + MULTICOMPASS_STREAM_BATCH * MULTICOMPASS_RECORD_SIZE + 2) ///< Size of the largest frame before COBS encoding
+
+#define COMPASS_RECORD_DELTA_SATURATED 0x80 ///< Record flag, the time since the previous record exceeded 65535 microseconds, only set by pack() as write() starts a new frame instead
+
+typedef struct
+{
+    int16_t x;        ///< Raw X axis.
+    int16_t y;        ///< Raw Y axis.
+    int16_t z;        ///< Raw Z axis.
+    uint16_t delta;   ///< Microseconds since the previous record, saturated at 65535.
+    uint8_t flags;    ///< COMPASS_FLAG_* bits of the sample and COMPASS_RECORD_DELTA_SATURATED.
+    uint8_t sequence; ///< Low byte of the sequence number, gaps show lost samples.
+} CompassPackedSample;
+
+/**
+ * @class MultiCompassStream
+ * @brief Streams the samples of one sensor in a compact binary format.
+ * Each frame holds up to MULTICOMPASS_STREAM_BATCH records and starts with the full timestamp and sequence number
+ * of its first record, so a lost frame does not corrupt the following ones. The frame is protected by the same
+ * CRC-16 as the calibration blob and COBS encoded, which leaves 0x00 as the unique frame delimiter.
+ * A record takes about 12 bytes on the wire, compared to around 50 bytes of formatted text.
+ */
+class MultiCompassStream
+{
+public:
+    /**
+     * @brief Constructor for the MultiCompassStream class.
+     * @param output A pointer to the Print the frames are written to.
+     * @param sensor The number of the sensor in the frame header, to tell several streams on one output apart.
+     */
+    MultiCompassStream(Print *output, uint8_t sensor = 0);
+
+    /**
+     * @brief Adds a sample to the current frame, the frame is written once it is full.
+     * Only the raw values, the timestamp, the sequence number and the flags are stored. A sample more than
+     * 65535 microseconds after the previous one starts a new frame, whose header holds its full timestamp.
+     * @param data A pointer to a CompassData struct containing the raw sensor data.
+     * @return true if the sample was added, false if writing the previous frame failed.
+     */
+    bool write(const CompassData *data);
+
+    /**
+     * @brief Adds an array of samples.
+     * @param data A pointer to an array of CompassData structs containing the raw sensor data.
+     * @param count The number of samples.
+     * @return The number of samples added.
+     */
+    size_t write(const CompassData *data, size_t count);
+
+    /**
+     * @brief Drains the data ready buffer of a sensor into the stream, through getDataBatch() so every sample is checked.
+     * @param compass A pointer to the sensor.
+     * @return The number of samples added.
+     */
+    size_t drain(MultiCompass *compass);
+
+    /**
+     * @brief Writes the current frame, even if it is not full.
+     * @return true if the frame was written or was empty, false otherwise.
+     */
+    bool flush();
+
+    /**
+     * @brief Packs a sample into a record.
+     * @param data A pointer to a CompassData struct containing the raw sensor data.
+     * @param previous The timestamp of the previous record in microseconds.
+     * @param record A pointer to a CompassPackedSample struct where the record will be stored.
+     */
+    static void pack(const CompassData *data, uint32_t previous, CompassPackedSample *record);
+
+    /**
+     * @brief Encodes a block with consistent overhead byte stuffing, the result contains no 0x00.
+     * @param input A pointer to the data.
+     * @param length The length of the data, at most 254 bytes.
+     * @param output A pointer to the buffer, with space for length + 1 bytes.
+     * @return The length of the encoded data.
+     */
+    static size_t encodeCobs(const uint8_t *input, size_t length, uint8_t *output);
+
+    uint32_t frames = 0;  /**< Number of written frames. */
+    uint32_t dropped = 0; /**< Number of frames that could not be written completely. */
+
+private:
+    Print *output;                                   /**< The output of the frames. */
+    uint8_t sensor;                                  /**< The sensor number in the frame header. */
+    uint8_t count = 0;                               /**< Number of records in the current frame. */
+    uint32_t lastTimestamp = 0;                      /**< Timestamp of the last record. */
+    uint8_t payload[MULTICOMPASS_STREAM_PAYLOAD];    /**< Header, records and CRC of the current frame. */
+};
+
+#endif
@@ -0,0 +1,235 @@
+/**
+ * @file MultiCompassTransport.h
+ * @brief Header file for the MultiCompassTransport classes
+ * This file contains the bus interface below MultiCompass::writeBytes() and MultiCompass::readBytes(),
+ * its backend for the Arduino Wire library and the base of the backends with their own receive buffer.
+ */
+
+#ifndef MULTICOMPASS_TRANSPORT_H
+#define MULTICOMPASS_TRANSPORT_H
+
+#if ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include <Wire.h>
+
+typedef enum
+{
+    COMPASS_OK = 0,            ///< The transfer was successful.
+    COMPASS_BUSY,              ///< A transfer is still in progress.
+    COMPASS_ERROR_NACK,        ///< The sensor did not acknowledge its address or data.
+    COMPASS_ERROR_TIMEOUT,     ///< The sensor did not answer within the timeout.
+    COMPASS_ERROR_BUS,         ///< Any other error reported by the bus.
+} CompassStatus;
+
+#ifndef MULTICOMPASS_TRANSPORT_BUFFER
+#define MULTICOMPASS_TRANSPORT_BUFFER 32 ///< Receive buffer of a MultiCompassBufferedTransport, the longest burst of a sensor
+#endif
+
+/**
+ * @class MultiCompassTransport
+ * @brief Interface of the bus a sensor is connected to.
+ * The steps match an I2C register access: a write of the register pointer, optionally followed by data,
+ * and a read request whose bytes are collected without blocking, so the asynchronous reads can use it as well.
+ * Synchronous reads go through readRegisters(), which a backend overrides with the native burst read of its platform.
+ */
+class MultiCompassTransport
+{
+public:
+    /**
+     * @brief Destructor for MultiCompassTransport class.
+     */
+    virtual ~MultiCompassTransport() {}
+
+    /**
+     * @brief Writes the register pointer and a block of data in one transaction.
+     * @param address The I2C address of the sensor.
+     * @param reg The first register.
+     * @param buffer A pointer to the data, NULL if length is 0.
+     * @param length The number of data bytes, 0 only sets the register pointer.
+     * @param timeout The timeout in microseconds, a backend without a timeout of its own may ignore it.
+     * @return The status of the transaction.
+     */
+    virtual CompassStatus write(uint8_t address, uint8_t reg, const uint8_t *buffer, uint8_t length, uint32_t timeout) = 0;
+
+    /**
+     * @brief Starts reading bytes from the current register pointer.
+     * @param address The I2C address of the sensor.
+     * @param length The number of bytes.
+     * @param timeout The timeout in microseconds, a backend without a timeout of its own may ignore it.
+     */
+    virtual void request(uint8_t address, uint8_t length, uint32_t timeout) = 0;
+
+    /**
+     * @brief Abandons a request whose bytes did not arrive within the timeout, so the next transfer finds the bus idle.
+     * The default has nothing to abort, as its request() already returned.
+     */
+    virtual void abort() {}
+
+    /**
+     * @brief Gets the identity of the physical bus, transports with the same identity cannot transfer in parallel.
+     * The default is the transport itself, e.g. for a mock that emulates its own bus.
+     * @return A pointer that identifies the bus.
+     */
+    virtual const void *getBus() { return this; }
+
+    /**
+     * @brief Gets the number of received bytes that were not read yet.
+     * @return The number of bytes.
+     */
+    virtual int available() = 0;
+
+    /**
+     * @brief Reads the next received byte.
+     * @return The byte, -1 if none is available.
+     */
+    virtual int read() = 0;
+
+    /**
+     * @brief Reads consecutive registers in one burst, waiting at most the timeout.
+     * The default selects the register, requests the bytes and collects them.
+     * @param address The I2C address of the sensor.
+     * @param reg The first register.
+     * @param buffer A pointer to the buffer where the bytes will be stored.
+     * @param length The number of bytes.
+     * @param timeout The timeout in microseconds.
+     * @return The status of the transfer.
+     */
+    virtual CompassStatus readRegisters(uint8_t address, uint8_t reg, uint8_t *buffer, uint8_t length, uint32_t timeout);
+
+    /**
+     * @brief Copies the requested bytes once all of them arrived, without blocking.
+     * @param buffer A pointer to the buffer where the bytes will be stored.
+     * @param length The number of requested bytes.
+     * @param start The time in microseconds the transfer was started.
+     * @param timeout The timeout in microseconds.
+     * @return COMPASS_OK when the bytes were copied, COMPASS_BUSY while waiting, COMPASS_ERROR_TIMEOUT after the timeout.
+     * A timed out request is aborted.
+     */
+    CompassStatus collect(uint8_t *buffer, uint8_t length, unsigned long start, uint32_t timeout);
+};
+
+/**
+ * @struct MultiCompassWireTraits
+ * @brief Maps the byte access of a Wire compatible bus class, resolved at compile time.
+ * This is the only place that knows the send()/receive() names of the cores before Arduino 1.0.
+ * A bus class with other names, e.g. a software I2C library, gets its own specialization.
+ * @tparam Bus The bus class.
+ */
+template <typename Bus>
+struct MultiCompassWireTraits
+{
+#if ARDUINO >= 100
+    static inline void send(Bus *bus, uint8_t value) { bus->write(value); }
+    static inline void send(Bus *bus, const uint8_t *buffer, uint8_t length) { bus->write(buffer, length); }
+    static inline int receive(Bus *bus) { return bus->read(); }
+#else
+    static inline void send(Bus *bus, uint8_t value) { bus->send(value); }
+    static inline void send(Bus *bus, const uint8_t *buffer, uint8_t length) { bus->send((uint8_t *)buffer, length); }
+    static inline int receive(Bus *bus) { return bus->receive(); }
+#endif
+
+    /**
+     * @brief Converts the result of endTransmission() to a CompassStatus.
+     * @param result The value returned by endTransmission().
+     * @return The matching CompassStatus.
+     */
+    static inline CompassStatus status(uint8_t result)
+    {
+        switch (result)
+        {
+        case 0:
+            return COMPASS_OK;
+        case 2: // Address not acknowledged.
+        case 3: // Data not acknowledged.
+            return COMPASS_ERROR_NACK;
+        case 5: // Timeout of cores that support it.
+            return COMPASS_ERROR_TIMEOUT;
+        default:
+            return COMPASS_ERROR_BUS;
+        }
+    }
+};
+
+/**
+ * @class MultiCompassWireBusTransport
+ * @brief Reaches the sensor through an object of a Wire compatible bus class.
+ * All calls are resolved at compile time through the traits, only the transport itself is virtual.
+ * @tparam Bus The bus class, TwoWire for the Arduino Wire library.
+ * @tparam Traits The byte access of the bus class.
+ */
+template <typename Bus, typename Traits = MultiCompassWireTraits<Bus> >
+class MultiCompassWireBusTransport : public MultiCompassTransport
+{
+public:
+    /**
+     * @brief Constructor for MultiCompassWireBusTransport class.
+     * @param wire Pointer to the bus object for I2C communication.
+     */
+    MultiCompassWireBusTransport(Bus *wire) : wire(wire) {}
+
+    CompassStatus write(uint8_t address, uint8_t reg, const uint8_t *buffer, uint8_t length, uint32_t timeout)
+    {
+        // The Wire library has its own timeout, see MultiCompass::enableWireTimeout().
+        (void)timeout;
+        wire->beginTransmission(address);
+        Traits::send(wire, reg);
+        if (length > 0)
+        {
+            Traits::send(wire, buffer, length);
+        }
+        return Traits::status(wire->endTransmission());
+    }
+
+    void request(uint8_t address, uint8_t length, uint32_t timeout)
+    {
+        (void)timeout;
+        wire->requestFrom(address, length);
+    }
+
+    int available()
+    {
+        return wire->available();
+    }
+
+    int read()
+    {
+        return Traits::receive(wire);
+    }
+
+    const void *getBus()
+    {
+        return wire;
+    }
+
+private:
+    Bus *wire; /**< Pointer to the bus object for I2C communication. */
+};
+
+/**
+ * @typedef MultiCompassWireTransport
+ * @brief The transport of a TwoWire object, used by the MultiCompass(TwoWire *) constructors.
+ */
+typedef MultiCompassWireBusTransport<TwoWire> MultiCompassWireTransport;
+
+/**
+ * @class MultiCompassBufferedTransport
+ * @brief Base of the backends that receive a whole burst into their own buffer, e.g. with DMA.
+ * A backend fills rxBuffer in request() and sets rxLength, available() and read() hand the bytes out.
+ */
+class MultiCompassBufferedTransport : public MultiCompassTransport
+{
+public:
+    int available();
+    int read();
+
+protected:
+    uint8_t rxBuffer[MULTICOMPASS_TRANSPORT_BUFFER]; /**< The received bytes. */
+    uint8_t rxLength = 0;                            /**< Number of received bytes. */
+    uint8_t rxIndex = 0;                             /**< Index of the next byte to read. */
+};
+
+#endif
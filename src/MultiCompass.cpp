@@ -16,33 +16,178 @@
  */
 
 #include "MultiCompass.h"
+#include "MultiCompassFilter.h"
+#include "MultiCompassStorage.h"
 #include <math.h>
+#include <string.h>
+#if defined(__AVR__)
+#include <util/atomic.h>
+#endif
+
+#if defined(ARDUINO_ARCH_ESP32)
+#define MULTICOMPASS_ISR_ATTR IRAM_ATTR
+
+// The ESP32 core passes the instance to the interrupt handler.
+static void MULTICOMPASS_ISR_ATTR dataReadyHandler(void *arg)
+{
+    ((MultiCompass *)arg)->onDataReady();
+}
+
+// Task body of the data ready mode, sleeps until the interrupt signals a new sample.
+static void dataReadyTaskLoop(void *arg)
+{
+    MultiCompass *compass = (MultiCompass *)arg;
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        compass->handleDataReady();
+    }
+}
+#else
+#define MULTICOMPASS_ISR_ATTR
+
+// Without interrupt arguments every instance needs its own handler, so a small table maps slots to instances.
+static MultiCompass *dataReadyInstances[MULTICOMPASS_DATAREADY_SLOTS] = {};
+
+template <uint8_t SLOT>
+static void dataReadyHandler()
+{
+    dataReadyInstances[SLOT]->onDataReady();
+}
+
+static void (*const dataReadyHandlers[MULTICOMPASS_DATAREADY_SLOTS])() = {
+    dataReadyHandler<0>,
+    dataReadyHandler<1>,
+    dataReadyHandler<2>,
+    dataReadyHandler<3>,
+};
+#endif
 /**
  * @brief Create a new MultiCompass instance with the given TwoWire object.
  * @param wire A pointer to the TwoWire object to use for communication.
  */
-MultiCompass::MultiCompass(TwoWire *wire)
+MultiCompass::MultiCompass(TwoWire *wire) : wireTransport(wire)
 {
     // Store a reference to the provided TwoWire object.
     mywire = wire;
+    transport = &wireTransport;
+    initialize();
+}
+
+/**
+ * @brief Create a new MultiCompass instance that uses another transport.
+ * @param transport A pointer to the transport to use for communication.
+ */
+MultiCompass::MultiCompass(MultiCompassTransport *transport) : wireTransport(NULL)
+{
+    mywire = NULL;
+    this->transport = transport;
+    initialize();
+}
 
+/**
+ * @brief Set the calibration and the scale to their defaults.
+ */
+void MultiCompass::initialize()
+{
     // Initialize the compass's calibration settings to default values.
-    settings.heading = 0;
-    settings.minX = 100000;
-    settings.minY = 100000;
-    settings.minZ = 100000;
-    settings.maxX = -100000;
-    settings.maxY = -100000;
-    settings.maxZ = -100000;
+    CompassCalibrationState *state = &calibrationStates[0];
+    state->settings.heading = 0;
+    state->settings.minX = MULTICOMPASS_BOUND_LIMIT;
+    state->settings.minY = MULTICOMPASS_BOUND_LIMIT;
+    state->settings.minZ = MULTICOMPASS_BOUND_LIMIT;
+    state->settings.maxX = -MULTICOMPASS_BOUND_LIMIT;
+    state->settings.maxY = -MULTICOMPASS_BOUND_LIMIT;
+    state->settings.maxZ = -MULTICOMPASS_BOUND_LIMIT;
+    state->settings.lastCalibration = 0;
+#if defined(MULTICOMPASS_NO_FLOAT)
+    state->rawScale[0] = MULTICOMPASS_RAW_SCALE_ONE;
+    state->rawScale[1] = MULTICOMPASS_RAW_SCALE_ONE;
+    state->rawScale[2] = MULTICOMPASS_RAW_SCALE_ONE;
+#else
+    state->softIron.valid = false;
+    state->rawScale[0] = 1;
+    state->rawScale[1] = 1;
+    state->rawScale[2] = 1;
+#endif
+    buildCoefficients(state);
+    activeCalibration = 0;
+}
+/**
+ * @brief Check that a device acknowledges the address. The generic compass cannot identify its sensor.
+ * @param selfTest Ignored, the generic compass has no self test.
+ * @return COMPASS_SETUP_OK if the address was acknowledged, COMPASS_SETUP_NO_RESPONSE otherwise.
+ */
+CompassSetupStatus MultiCompass::begin(bool selfTest)
+{
+    (void)selfTest;
+    enableWireTimeout();
+    // Writing only the register pointer changes nothing on the device.
+    return writeBytes(0, NULL, 0) ? COMPASS_SETUP_OK : COMPASS_SETUP_NO_RESPONSE;
+}
+
+/**
+ * @brief Get a short description of a transfer status.
+ * @param status The status.
+ * @return The description.
+ */
+const char *MultiCompass::getStatusName(CompassStatus status)
+{
+    switch (status)
+    {
+    case COMPASS_OK:
+        return "ok";
+    case COMPASS_BUSY:
+        return "busy";
+    case COMPASS_ERROR_NACK:
+        return "not acknowledged";
+    case COMPASS_ERROR_TIMEOUT:
+        return "timeout";
+    default:
+        return "bus error";
+    }
+}
+
+/**
+ * @brief Get a short description of a setup status.
+ * @param status The status.
+ * @return The description.
+ */
+const char *MultiCompass::getSetupStatusName(CompassSetupStatus status)
+{
+    switch (status)
+    {
+    case COMPASS_SETUP_OK:
+        return "ok";
+    case COMPASS_SETUP_NO_RESPONSE:
+        return "no response";
+    case COMPASS_SETUP_WRONG_ID:
+        return "wrong identification";
+    case COMPASS_SETUP_CONFIG_FAILED:
+        return "configuration failed";
+    default:
+        return "self test failed";
+    }
+}
+
+/**
+ * @brief Get the name of the sensor. The generic compass has no specific sensor.
+ * @return The name of the sensor.
+ */
+const char *MultiCompass::getName()
+{
+    return "MultiCompass";
 }
+
 /**
  * @brief Set the magnetic declination angle for the compass.
- * @param declinationAngle The new magnetic declination angle in radians.
+ * @param declinationAngle The new magnetic declination angle in radians, or as binary angle without float support.
  */
-void MultiCompass::setDeclinationAngle(float declinationAngle)
+void MultiCompass::setDeclinationAngle(CompassAngleValue declinationAngle)
 {
     // Update the heading calibration setting to the new magnetic declination angle.
-    settings.heading = declinationAngle;
+    editCalibration()->settings.heading = declinationAngle;
+    publishCalibration();
 }
 
 /**
@@ -52,195 +197,2499 @@ void MultiCompass::setDeclinationAngle(float declinationAngle)
 void MultiCompass::setCalibration(CompassSetting *setting)
 {
     // Set the new calibration settings based on the provided object.
-    settings.minX = setting->minX;
-    settings.minY = setting->minY;
-    settings.minZ = setting->minZ;
-    settings.maxX = setting->maxX;
-    settings.maxY = setting->maxY;
-    settings.maxZ = setting->maxZ;
-    settings.heading = setting->heading;
-    settings.lastCalibration = 0;
+    CompassSetting *settings = &editCalibration()->settings;
+    settings->minX = setting->minX;
+    settings->minY = setting->minY;
+    settings->minZ = setting->minZ;
+    settings->maxX = setting->maxX;
+    settings->maxY = setting->maxY;
+    settings->maxZ = setting->maxZ;
+    settings->heading = setting->heading;
+    settings->lastCalibration = 0;
+    publishCalibration();
+#if !defined(MULTICOMPASS_NO_FLOAT)
+    // The norm of another calibration needs a new baseline.
+    resetFieldBaseline();
+#endif
 };
 
 /**
  * @brief Get the current calibration settings for the compass.
  * @param settings A pointer to a CompassSetting object where the current calibration settings will be stored.
  */
-void getCalibration(CompassSetting *settings)
+void MultiCompass::getCalibration(CompassSetting *settings)
 {
     // Copy the current calibration settings to the provided object.
-    memcpy(settings, &settings, sizeof(settings));
+    memcpy(settings, &getCalibration(), sizeof(*settings));
 };
 
 /**
- * @brief Scale the provided CompassData object based on the minimum and maximum values in the settings.
- * @param data A pointer to a CompassData object containing the necessary data to be scaled.
+ * @brief Get the live calibration settings without copying them.
+ * @return A reference to the published calibration settings.
  */
-void MultiCompass::scaleData(CompassData *data)
+const CompassSetting &MultiCompass::getCalibration()
 {
-    // Calculate the scaled X, Y, and Z values.
-    data->scaledX = data->rawX - (settings.maxX + settings.minX) / 2;
-    data->scaledY = data->rawY - (settings.maxY + settings.minY) / 2;
-    data->scaledZ = data->rawZ - (settings.maxZ + settings.minZ) / 2;
+    return calibrationStates[activeCalibration].settings;
+}
 
-    data->scaledX /= (abs(settings.maxX) + abs(settings.minX)) / 2;
-    data->scaledY /= (abs(settings.maxY) + abs(settings.minY)) / 2;
-    data->scaledZ /= (abs(settings.maxZ) + abs(settings.minZ)) / 2;
-};
+#if !defined(MULTICOMPASS_NO_FLOAT)
+/**
+ * @brief Get the live soft iron calibration without copying it.
+ * @return A reference to the published soft iron calibration.
+ */
+const CompassSoftIron &MultiCompass::getSoftIronCalibration()
+{
+    return calibrationStates[activeCalibration].softIron;
+}
+#endif
 
 /**
- * @brief Calculate the heading using the provided CompassData object and axis values.
- * @param data A pointer to a CompassData object containing the necessary data for calculation.
- * @param x An integer value representing the x-axis value to use in the calculation. Default value is 0.
- * @param y An integer value representing the y-axis value to use in the calculation. Default value is 0.
- * @param z An integer value representing the z-axis value to use in the calculation. Default value is 1.
+ * @brief Get the live coefficients without copying them.
+ * @return A reference to the published coefficients.
  */
-void MultiCompass::calculateHeading(CompassData *data, int x = 0, int y = 0, int z = 1)
+const CompassCoefficients &MultiCompass::getCoefficients()
 {
-    float axis1 = 0, axis2 = 0;
-    if (x != 0)
+    return calibrationStates[activeCalibration].coefficients;
+}
+
+/**
+ * @brief Get the published calibration state as one consistent snapshot.
+ * @return A reference to the published state, valid until the second next publishCalibration().
+ */
+const CompassCalibrationState &MultiCompass::acquireCalibration()
+{
+    uint8_t active = activeCalibration;
+    // Do not read the state before the index that published it.
+    MULTICOMPASS_MEMORY_BARRIER();
+    return calibrationStates[active];
+}
+
+/**
+ * @brief Take the writer lock and start editing the calibration on the unpublished copy of the state.
+ * Two writers would copy into the same buffer and both switch the index, so the lock is held until the publish.
+ * @return A pointer to the copy, initialized with the published state.
+ */
+CompassCalibrationState *MultiCompass::editCalibration()
+{
+#if defined(ARDUINO_ARCH_ESP32)
+    // A background calibration task and the sampling path may write from different cores.
+    portENTER_CRITICAL(&calibrationLock);
+#endif
+    uint8_t active = activeCalibration;
+    calibrationStates[active ^ 1] = calibrationStates[active];
+    return &calibrationStates[active ^ 1];
+}
+
+/**
+ * @brief Rebuild the coefficients of the edited copy, make it the published state and release the writer lock.
+ */
+void MultiCompass::publishCalibration()
+{
+    uint8_t edited = activeCalibration ^ 1;
+    buildCoefficients(&calibrationStates[edited]);
+    // The whole state has to be visible before the index that publishes it.
+    MULTICOMPASS_MEMORY_BARRIER();
+    activeCalibration = edited;
+#if defined(ARDUINO_ARCH_ESP32)
+    portEXIT_CRITICAL(&calibrationLock);
+#endif
+}
+
+#if !defined(MULTICOMPASS_NO_FLOAT)
+/**
+ * @brief Set a hard and soft iron calibration, which replaces the min/max calibration while it is set.
+ * @param calibration A pointer to a CompassSoftIron object containing the calibration.
+ */
+void MultiCompass::setSoftIronCalibration(const CompassSoftIron *calibration)
+{
+    CompassSoftIron *softIron = &editCalibration()->softIron;
+    *softIron = *calibration;
+    softIron->valid = true;
+    publishCalibration();
+    resetFieldBaseline();
+}
+
+/**
+ * @brief Remove the soft iron calibration and use the min/max calibration again.
+ */
+void MultiCompass::clearSoftIronCalibration()
+{
+    editCalibration()->softIron.valid = false;
+    publishCalibration();
+    resetFieldBaseline();
+}
+#endif
+
+#define BLOB_HEADER 4                               ///< Magic, version and payload length
+#define BLOB_FIXED_PAYLOAD (7 * 4 + 1 + 12 * 4 + 1) ///< Payload without the configuration bytes
+
+#if defined(MULTICOMPASS_NO_FLOAT)
+#define BLOB_RADIANS 51472 ///< 2*PI / 65536 in Q29, which is also 2*PI in Q13
+
+/**
+ * @brief Store a fixed point value as a float in four little endian bytes, with integer operations only.
+ * The bits below the 24 bit mantissa are truncated.
+ * @param buffer A pointer to the destination.
+ * @param value The fixed point value.
+ * @param shift The number of fractional bits of value.
+ */
+static void putFixed(uint8_t *buffer, int32_t value, uint8_t shift)
+{
+    uint32_t bits = 0;
+    if (value != 0)
     {
-        axis1 = data->scaledY * x;
-        axis2 = data->scaledZ * x;
+        // Normalize the magnitude to 1.mantissa * 2^31, every shift lowers the exponent.
+        uint32_t magnitude = value < 0 ? -(uint32_t)value : (uint32_t)value;
+        int16_t exponent = 127 + 31 - shift;
+        while (!(magnitude & 0x80000000UL))
+        {
+            magnitude <<= 1;
+            exponent--;
+        }
+        bits = ((uint32_t)exponent << 23) | ((magnitude >> 8) & 0x7FFFFFUL);
+        if (value < 0)
+        {
+            bits |= 0x80000000UL;
+        }
     }
-    else if (y != 0)
+    for (uint8_t i = 0; i < 4; i++)
     {
-        axis1 = data->scaledX * y;
-        axis2 = data->scaledZ * y;
+        buffer[i] = bits >> (8 * i);
     }
-    else if (z != 0)
+}
+
+/**
+ * @brief Load a float from four little endian bytes as a rounded fixed point value, with integer operations only.
+ * Values beyond the 31 bit range saturate, which includes infinity and NaN.
+ * @param buffer A pointer to the source.
+ * @param shift The number of fractional bits of the result.
+ * @return The fixed point value.
+ */
+static int32_t getFixed(const uint8_t *buffer, uint8_t shift)
+{
+    uint32_t bits = 0;
+    for (uint8_t i = 0; i < 4; i++)
     {
-        axis1 = data->scaledX * z;
-        axis2 = data->scaledY * z;
+        bits |= (uint32_t)buffer[i] << (8 * i);
     }
-    
-    // Calculate heading using the provided axis values.
-    data->heading = atan2f(axis2, axis1);
-    
-    // Add the heading offset from the settings.
-    data->heading += settings.heading;
-    
-    // Normalize the heading to be between 0 and 2*PI.
-    if (data->heading < 0)
+    // The float is 1.mantissa * 2^(exponent - 127), i.e. the 24 bit mantissa times 2^(exponent - 150).
+    int16_t exponent = (int16_t)((bits >> 23) & 0xFF) - 150 + shift;
+    uint32_t magnitude = (bits & 0x7FFFFFUL) | 0x800000UL;
+    if ((bits & 0x7F800000UL) == 0 || exponent < -24)
     {
-        data->heading += 2 * PI;
+        // Zero, subnormal or below half of the last fractional bit.
+        return 0;
     }
-    else if (data->heading > 2 * PI)
+    if (exponent > 7)
     {
-        data->heading -= 2 * PI;
+        magnitude = 0x7FFFFFFFUL;
     }
-};
-
+    else if (exponent >= 0)
+    {
+        magnitude <<= exponent;
+    }
+    else
+    {
+        magnitude = (magnitude + (1UL << (-exponent - 1))) >> -exponent;
+    }
+    return (bits & 0x80000000UL) ? -(int32_t)magnitude : (int32_t)magnitude;
+}
+#else
 /**
- * @brief Retrieve data from the MultiCompass sensor and store it in a CompassData object.
- * @param data A pointer to a CompassData object where the retrieved data will be stored.
+ * @brief Store a float as four little endian bytes.
+ * @param buffer A pointer to the destination.
+ * @param value The value to store.
  */
-void getData(CompassData *data)
+static void putFloat(uint8_t *buffer, float value)
 {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        buffer[i] = bits >> (8 * i);
+    }
 }
 
 /**
- * @brief Calibrate the MultiCompass sensor using the provided data.
- * @param data A pointer to a CompassData object containing the data to use for calibration.
- * @return A boolean value indicating whether the calibration was successful or not.
+ * @brief Load a float from four little endian bytes.
+ * @param buffer A pointer to the source.
+ * @return The stored value.
  */
-bool calibration(CompassData *data)
+static float getFloat(const uint8_t *buffer)
 {
-    return false;
+    uint32_t bits = 0;
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        bits |= (uint32_t)buffer[i] << (8 * i);
+    }
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
 }
+#endif
 
 /**
- * @brief Write a byte of data to a specified register of the MultiCompass sensor.
- * @param reg The register to write to.
- * @param value The value to write to the register.
+ * @brief Serialize the calibration and the sensor configuration into a versioned blob with CRC.
+ * Layout: 'M', 'C', version, payload length, payload, CRC-16 over all previous bytes (little endian).
+ * Payload of version 1: min X/Y/Z, max X/Y/Z and declination as floats, a flag byte (bit 0: soft iron valid),
+ * soft iron offset and matrix as floats, the number of configuration bytes and the configuration bytes.
+ * @param buffer A pointer to the buffer where the blob will be stored.
+ * @param length The size of the buffer.
+ * @return The length of the blob, 0 if the buffer is too small.
  */
-void MultiCompass::writeByte(uint8_t reg, uint8_t value)
+size_t MultiCompass::serializeCalibration(uint8_t *buffer, size_t length)
 {
-    // Begin transmission to the specified address.
-    mywire->beginTransmission(adress);
+    uint8_t config[MULTICOMPASS_CONFIG_BYTES];
+    uint8_t configLength = getConfigBytes(config, sizeof(config));
+    size_t payload = BLOB_FIXED_PAYLOAD + configLength;
+    size_t total = BLOB_HEADER + payload + 2;
+    if (length < total)
+    {
+        return 0;
+    }
 
-    // Write the register and value to the wire object.
-#if ARDUINO >= 100
-    mywire->write(reg);
-    mywire->write(value);
+    buffer[0] = 'M';
+    buffer[1] = 'C';
+    buffer[2] = MULTICOMPASS_BLOB_VERSION;
+    buffer[3] = payload;
+
+    const CompassSetting &settings = getCalibration();
+    uint8_t *p = buffer + BLOB_HEADER;
+#if defined(MULTICOMPASS_NO_FLOAT)
+    // The blob keeps its float layout, so it can be exchanged with the builds that have float support.
+    const int16_t bounds[6] = {settings.minX, settings.minY, settings.minZ, settings.maxX, settings.maxY, settings.maxZ};
+    for (uint8_t i = 0; i < 6; i++, p += 4)
+    {
+        putFixed(p, bounds[i], 0);
+    }
+    putFixed(p, (int16_t)settings.heading * (int32_t)BLOB_RADIANS, 29);
+    p += 4;
+    // There is no soft iron calibration, and zero bytes are a float 0.
+    memset(p, 0, 1 + 12 * 4);
+    p += 1 + 12 * 4;
 #else
-    mywire->send(reg);
-    mywire->send(value);
+    const CompassSoftIron &softIron = getSoftIronCalibration();
+    const CompassRawValue bounds[6] = {settings.minX, settings.minY, settings.minZ, settings.maxX, settings.maxY, settings.maxZ};
+    for (uint8_t i = 0; i < 6; i++, p += 4)
+    {
+        putFloat(p, bounds[i]);
+    }
+    putFloat(p, settings.heading);
+    p += 4;
+    *p++ = softIron.valid ? 0x01 : 0x00;
+    for (uint8_t i = 0; i < 3; i++, p += 4)
+    {
+        putFloat(p, softIron.valid ? softIron.offset[i] : 0);
+    }
+    for (uint8_t i = 0; i < 9; i++, p += 4)
+    {
+        putFloat(p, softIron.valid ? softIron.matrix[i] : 0);
+    }
 #endif
+    *p++ = configLength;
+    memcpy(p, config, configLength);
+    p += configLength;
 
-    // End the transmission.
-    mywire->endTransmission();
-};
+    uint16_t crc = crc16(buffer, p - buffer);
+    p[0] = crc;
+    p[1] = crc >> 8;
+    return total;
+}
 
 /**
- * @brief This function reads a single byte from a given register address using I2C communication.
- * @param reg: The register address from where a byte will be read.
- * @return An unsigned 8-bit integer representing the byte read from the given register address.
+ * @brief Restore the calibration and the sensor configuration from a blob, after validating all of it.
+ * @param buffer A pointer to the blob.
+ * @param length The length of the buffer, may be larger than the blob.
+ * @return true if the blob was valid and the configuration was written to the sensor, false otherwise.
  */
-uint8_t MultiCompass::readByte(uint8_t reg)
+bool MultiCompass::deserializeCalibration(const uint8_t *buffer, size_t length)
 {
-    uint8_t value = 0;
-    mywire->beginTransmission(adress); // Start the transmission with the given address.
-#if ARDUINO >= 100
-    mywire->write(reg); // Send the register address to read from.
-#else
-    mywire->send(reg);
+    if (length < BLOB_HEADER + BLOB_FIXED_PAYLOAD + 2 || buffer[0] != 'M' || buffer[1] != 'C' ||
+        buffer[2] != MULTICOMPASS_BLOB_VERSION)
+    {
+        return false;
+    }
+    size_t payload = buffer[3];
+    if (payload < BLOB_FIXED_PAYLOAD || BLOB_HEADER + payload + 2 > length)
+    {
+        return false;
+    }
+    const uint8_t *end = buffer + BLOB_HEADER + payload;
+    if (crc16(buffer, BLOB_HEADER + payload) != (end[0] | (end[1] << 8)))
+    {
+        return false;
+    }
+    uint8_t configLength = buffer[BLOB_HEADER + BLOB_FIXED_PAYLOAD - 1];
+    if (configLength != payload - BLOB_FIXED_PAYLOAD)
+    {
+        return false;
+    }
+#if defined(MULTICOMPASS_NO_FLOAT)
+    if (buffer[BLOB_HEADER + 7 * 4] & 0x01)
+    {
+        // A soft iron calibration cannot be applied without float support.
+        return false;
+    }
 #endif
-   mywire->endTransmission(); // End the transmission
+    // The length of the configuration tells the sensors apart, a blob of another sensor is rejected here.
+    const uint8_t *config = buffer + BLOB_HEADER + BLOB_FIXED_PAYLOAD;
+    if (!checkConfigBytes(config, configLength))
+    {
+        return false;
+    }
 
-    mywire->requestFrom(adress, (uint8_t)1); // Request one byte from the given address.
-    while (mywire->available() == 0)         // Wait until data is available to be read.
+    // The blob is valid. The configuration may change rawScale, so it is applied before the calibration is published.
+    bool configured = setConfigBytes(config, configLength);
+
+    CompassCalibrationState *state = editCalibration();
+    const uint8_t *p = buffer + BLOB_HEADER;
+    CompassRawValue bounds[6];
+    for (uint8_t i = 0; i < 6; i++, p += 4)
     {
-    };
-#if ARDUINO >= 100
-    value = mywire->read(); // Read the byte.
+#if defined(MULTICOMPASS_NO_FLOAT)
+        bounds[i] = constrain(getFixed(p, 0), -32767L, 32767L);
+#elif defined(MULTICOMPASS_COMPACT)
+        bounds[i] = constrain(lroundf(getFloat(p)), -32767L, 32767L);
 #else
-    value = mywire->receive();
+        bounds[i] = getFloat(p);
 #endif
-    return value; // Return the byte read.
+    }
+    state->settings.minX = bounds[0];
+    state->settings.minY = bounds[1];
+    state->settings.minZ = bounds[2];
+    state->settings.maxX = bounds[3];
+    state->settings.maxY = bounds[4];
+    state->settings.maxZ = bounds[5];
+#if defined(MULTICOMPASS_NO_FLOAT)
+    // Wrap the declination to one turn in Q13, then scale it with 65536 / (2*PI) == 41721 / 2^15.
+    int32_t declination = getFixed(p, 13) % BLOB_RADIANS;
+    if (declination < 0)
+    {
+        declination += BLOB_RADIANS;
+    }
+    state->settings.heading = (uint16_t)(((uint32_t)declination * 41721UL) >> 15);
+#else
+    state->settings.heading = getFloat(p);
+#endif
+    p += 4;
+    state->settings.lastCalibration = 0;
+#if !defined(MULTICOMPASS_NO_FLOAT)
+    state->softIron.valid = (*p++ & 0x01) != 0;
+    for (uint8_t i = 0; i < 3; i++, p += 4)
+    {
+        state->softIron.offset[i] = getFloat(p);
+    }
+    for (uint8_t i = 0; i < 9; i++, p += 4)
+    {
+        state->softIron.matrix[i] = getFloat(p);
+    }
+#endif
+    publishCalibration();
+#if !defined(MULTICOMPASS_NO_FLOAT)
+    resetFieldBaseline();
+#endif
+    return configured;
 }
 
 /**
- * @brief This function reads two bytes from a given register address using I2C communication.
- * @param reg: The register address from where two bytes will be read.
- * @param LSB: A boolean flag indicating the order in which bytes will be read. If true, LSB is read first.
- * @return An integer value representing the two bytes read from the given register address.
+ * @brief Serialize the calibration and write it to a storage.
+ * @param storage A pointer to the storage backend.
+ * @return true if the blob was stored, false otherwise.
  */
-int MultiCompass::readTwoBytes(uint8_t reg, bool LSB)
+bool MultiCompass::saveCalibration(MultiCompassStorage *storage)
 {
-    int16_t value = 0;
-    uint8_t vha, vla;
-    mywire->beginTransmission(adress); // Start the transmission with the given address.
-#if ARDUINO >= 100
-    mywire->write(reg); // Send the register address to read from.
-#else
-    mywire->send(reg);
-#endif
-    mywire->endTransmission();                        // End the transmission.
-    mywire->requestFrom((uint8_t)adress, (uint8_t)2); // Request two bytes from the given address.
-    while (!mywire->available())                      // Wait until data is available to be read.
-    {
-    };
-    if (LSB) // If LSB is to be read first.
+    uint8_t buffer[MULTICOMPASS_BLOB_SIZE];
+    size_t length = serializeCalibration(buffer, sizeof(buffer));
+    return length > 0 && storage->write(buffer, length);
+}
+
+/**
+ * @brief Read a blob from a storage and restore the calibration from it.
+ * @param storage A pointer to the storage backend.
+ * @return true if a valid blob was loaded, false otherwise.
+ */
+bool MultiCompass::loadCalibration(MultiCompassStorage *storage)
+{
+    uint8_t buffer[MULTICOMPASS_BLOB_SIZE];
+    size_t length = storage->read(buffer, sizeof(buffer));
+    return deserializeCalibration(buffer, length);
+}
+
+/**
+ * @brief Calculate a CRC-16/CCITT-FALSE checksum (polynomial 0x1021).
+ * @param data A pointer to the data.
+ * @param length The length of the data.
+ * @param crc The start value, or the result of the previous block to continue a checksum.
+ * @return The checksum.
+ */
+uint16_t MultiCompass::crc16(const uint8_t *data, size_t length, uint16_t crc)
+{
+    for (size_t i = 0; i < length; i++)
     {
-#if ARDUINO >= 100
-        vha = mywire->read(); // Read the LSB.
-        vla = mywire->read(); // Read the MSB.
-#else
-        vha = mywire->receive();
-        vla = mywire->receive();
-#endif
+        crc ^= (uint16_t)data[i] << 8;
+        for (uint8_t bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
     }
-    else // If MSB is to be read first.
-    {
-#if ARDUINO >= 100
-        vla = mywire->read(); // Read the MSB.
-        vha = mywire->read(); // Read the LSB.
+    return crc;
+}
+
+/**
+ * @brief Get the sensor configuration that is stored with the calibration. The generic compass has none.
+ * @param buffer A pointer to the buffer where the configuration will be stored.
+ * @param length The size of the buffer.
+ * @return The number of configuration bytes.
+ */
+uint8_t MultiCompass::getConfigBytes(uint8_t *buffer, uint8_t length)
+{
+    (void)buffer;
+    (void)length;
+    return 0;
+}
+
+/**
+ * @brief Restore the sensor configuration that was stored with the calibration. The generic compass has none.
+ * @param buffer A pointer to the configuration bytes.
+ * @param length The number of configuration bytes.
+ * @return true if there was no configuration to apply, false otherwise.
+ */
+bool MultiCompass::setConfigBytes(const uint8_t *buffer, uint8_t length)
+{
+    return checkConfigBytes(buffer, length);
+}
+
+/**
+ * @brief Check whether stored configuration bytes belong to this sensor. The generic compass has none.
+ * @param buffer A pointer to the configuration bytes.
+ * @param length The number of configuration bytes.
+ * @return true if there are no configuration bytes, false otherwise.
+ */
+bool MultiCompass::checkConfigBytes(const uint8_t *buffer, uint8_t length)
+{
+    (void)buffer;
+    return length == 0;
+}
+
+/**
+ * @brief Scale the provided CompassData object with the coefficients derived from the calibration settings.
+ * @param data A pointer to a CompassData object containing the necessary data to be scaled.
+ */
+void MultiCompass::scaleData(CompassData *data)
+{
+#if defined(MULTICOMPASS_NO_FLOAT)
+    // Run the integer pipeline, CompassData holds its Q14 values.
+    CompassRawSample sample = {data->rawX, data->rawY, data->rawZ, data->timestamp, data->sequence};
+    CompassFixedData fixed;
+    scaleData(&sample, &fixed);
+    data->scaledX = fixed.scaledX;
+    data->scaledY = fixed.scaledY;
+    data->scaledZ = fixed.scaledZ;
+#elif defined(MULTICOMPASS_FIXED_POINT)
+    // Run the integer pipeline and convert the result.
+    CompassRawSample sample = {(int16_t)data->rawX, (int16_t)data->rawY, (int16_t)data->rawZ, data->timestamp, data->sequence};
+    CompassFixedData fixed;
+    scaleData(&sample, &fixed);
+    data->scaledX = fixed.scaledX * (1.0f / MULTICOMPASS_FIXED_ONE);
+    data->scaledY = fixed.scaledY * (1.0f / MULTICOMPASS_FIXED_ONE);
+    data->scaledZ = fixed.scaledZ * (1.0f / MULTICOMPASS_FIXED_ONE);
 #else
-        vla = mywire->receive();
-        vha = mywire->receive();
+    const CompassCoefficients &coefficients = getCoefficients();
+    if (coefficients.useMatrix)
+    {
+        // Remove the offset and map the ellipsoid onto the unit sphere.
+        const float *m = coefficients.matrix;
+        float x = data->rawX - coefficients.offset[0];
+        float y = data->rawY - coefficients.offset[1];
+        float z = data->rawZ - coefficients.offset[2];
+        data->scaledX = m[0] * x + m[1] * y + m[2] * z;
+        data->scaledY = m[3] * x + m[4] * y + m[5] * z;
+        data->scaledZ = m[6] * x + m[7] * y + m[8] * z;
+        return;
+    }
+    // Remove the offset and scale each axis with the cached coefficients.
+    data->scaledX = (data->rawX - coefficients.offset[0]) * coefficients.invScale[0];
+    data->scaledY = (data->rawY - coefficients.offset[1]) * coefficients.invScale[1];
+    data->scaledZ = (data->rawZ - coefficients.offset[2]) * coefficients.invScale[2];
 #endif
+};
+
+#if !defined(MULTICOMPASS_NO_FLOAT)
+/**
+ * @brief Set how the float pipeline calculates the heading.
+ * @param method The method, as a CompassHeadingMethod enum value.
+ */
+void MultiCompass::setHeadingMethod(CompassHeadingMethod method)
+{
+    headingMethod = method;
+}
+
+/**
+ * @brief Get how the float pipeline calculates the heading.
+ * @return The method, as a CompassHeadingMethod enum value.
+ */
+CompassHeadingMethod MultiCompass::getHeadingMethod()
+{
+    return headingMethod;
+}
+
+/**
+ * @brief Set the unit of the float headings.
+ * @param unit The unit, as a CompassHeadingUnit enum value.
+ */
+void MultiCompass::setHeadingUnit(CompassHeadingUnit unit)
+{
+    headingUnit = unit;
+    // Keep the value of a full turn, so every heading is scaled with a single multiply.
+    switch (unit)
+    {
+    case COMPASS_UNIT_DEGREES:
+        headingTurn = 360;
+        break;
+    case COMPASS_UNIT_BINARY:
+        headingTurn = MULTICOMPASS_ANGLE_FULL;
+        break;
+    default:
+        headingTurn = 2 * PI;
+        break;
     }
-    value = vha << 8 | vla; // Combine the two bytes to get the final value.
-    return value;           // Return the final value.
+}
+
+/**
+ * @brief Get the unit of the float headings.
+ * @return The unit, as a CompassHeadingUnit enum value.
+ */
+CompassHeadingUnit MultiCompass::getHeadingUnit()
+{
+    return headingUnit;
+}
+#endif
+
+/**
+ * @brief Calculate the heading using the provided CompassData object and axis values.
+ * @param data A pointer to a CompassData object containing the necessary data for calculation.
+ * @param x An integer value representing the x-axis value to use in the calculation. Default value is 0.
+ * @param y An integer value representing the y-axis value to use in the calculation. Default value is 0.
+ * @param z An integer value representing the z-axis value to use in the calculation. Default value is 1.
+ */
+void MultiCompass::calculateHeading(CompassData *data, int x = 0, int y = 0, int z = 1)
+{
+#if defined(MULTICOMPASS_NO_FLOAT)
+    // Run the integer pipeline, CompassData holds its binary angle.
+    CompassFixedData fixed = {data->scaledX, data->scaledY, data->scaledZ, 0};
+    calculateHeading(&fixed, x, y, z);
+    data->heading = fixed.heading;
+#elif defined(MULTICOMPASS_FIXED_POINT)
+    // Run the integer pipeline and convert the binary angle to radians.
+    CompassFixedData fixed;
+    fixed.scaledX = constrain((int32_t)(data->scaledX * MULTICOMPASS_FIXED_ONE), -32767, 32767);
+    fixed.scaledY = constrain((int32_t)(data->scaledY * MULTICOMPASS_FIXED_ONE), -32767, 32767);
+    fixed.scaledZ = constrain((int32_t)(data->scaledZ * MULTICOMPASS_FIXED_ONE), -32767, 32767);
+    calculateHeading(&fixed, x, y, z);
+    data->heading = fixed.heading * (headingTurn / MULTICOMPASS_ANGLE_FULL);
+#else
+    float axis1 = 0, axis2 = 0;
+    if (x != 0)
+    {
+        axis1 = data->scaledY * x;
+        axis2 = data->scaledZ * x;
+    }
+    else if (y != 0)
+    {
+        axis1 = data->scaledX * y;
+        axis2 = data->scaledZ * y;
+    }
+    else if (z != 0)
+    {
+        axis1 = data->scaledX * z;
+        axis2 = data->scaledY * z;
+    }
+
+    // Calculate heading using the provided axis values, the declination and the selected method and unit.
+    data->heading = computeHeading(axis2, axis1);
+#endif
+};
+
+/**
+ * @brief Scale an array of samples with the cached coefficients.
+ * @param data A pointer to an array of CompassData objects containing the raw data.
+ * @param count The number of samples.
+ */
+void MultiCompass::scaleDataBatch(CompassData *data, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        scaleData(&data[i]);
+    }
+}
+
+/**
+ * @brief Calculate the heading of an array of scaled samples.
+ * @param data A pointer to an array of CompassData objects containing the scaled data.
+ * @param count The number of samples.
+ * @param x An integer value representing the x-axis value to use in the calculation.
+ * @param y An integer value representing the y-axis value to use in the calculation.
+ * @param z An integer value representing the z-axis value to use in the calculation.
+ */
+void MultiCompass::calculateHeadingBatch(CompassData *data, size_t count, int x, int y, int z)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        calculateHeading(&data[i], x, y, z);
+    }
+}
+
+#if !defined(MULTICOMPASS_NO_FLOAT)
+/**
+ * @brief Scale an array of raw samples into separate axis arrays.
+ * @param samples A pointer to an array of raw samples.
+ * @param count The number of samples.
+ * @param batch A pointer to a CompassBatch object receiving the scaled axes.
+ */
+void MultiCompass::scaleDataBatch(const CompassRawSample *samples, size_t count, CompassBatch *batch)
+{
+    float *__restrict outX = batch->x;
+    float *__restrict outY = batch->y;
+    float *__restrict outZ = batch->z;
+    const CompassCoefficients &coefficients = getCoefficients();
+
+    if (coefficients.useMatrix)
+    {
+        const float *m = coefficients.matrix;
+        const float offsetX = coefficients.offset[0];
+        const float offsetY = coefficients.offset[1];
+        const float offsetZ = coefficients.offset[2];
+        for (size_t i = 0; i < count; i++)
+        {
+            float x = samples[i].x - offsetX;
+            float y = samples[i].y - offsetY;
+            float z = samples[i].z - offsetZ;
+            outX[i] = m[0] * x + m[1] * y + m[2] * z;
+            outY[i] = m[3] * x + m[4] * y + m[5] * z;
+            outZ[i] = m[6] * x + m[7] * y + m[8] * z;
+        }
+        return;
+    }
+
+    // Fold the offset into the scale, so each axis is a single multiply-add.
+    const float scaleX = coefficients.invScale[0];
+    const float scaleY = coefficients.invScale[1];
+    const float scaleZ = coefficients.invScale[2];
+    const float biasX = -coefficients.offset[0] * scaleX;
+    const float biasY = -coefficients.offset[1] * scaleY;
+    const float biasZ = -coefficients.offset[2] * scaleZ;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        outX[i] = samples[i].x * scaleX + biasX;
+        outY[i] = samples[i].y * scaleY + biasY;
+        outZ[i] = samples[i].z * scaleZ + biasZ;
+    }
+}
+
+/**
+ * @brief Calculate the heading of scaled axis arrays, using the same axis selection as calculateHeading.
+ * @param batch A pointer to a CompassBatch object containing the scaled axes and receiving the headings.
+ * @param count The number of samples.
+ * @param x An integer value representing the x-axis value to use in the calculation.
+ * @param y An integer value representing the y-axis value to use in the calculation.
+ * @param z An integer value representing the z-axis value to use in the calculation.
+ */
+void MultiCompass::calculateHeadingBatch(CompassBatch *batch, size_t count, int x, int y, int z)
+{
+    // Select the axes once for the whole batch instead of per sample.
+    const float *__restrict axis1 = batch->x;
+    const float *__restrict axis2 = batch->y;
+    float sign = z;
+    if (x != 0)
+    {
+        axis1 = batch->y;
+        axis2 = batch->z;
+        sign = x;
+    }
+    else if (y != 0)
+    {
+        axis1 = batch->x;
+        axis2 = batch->z;
+        sign = y;
+    }
+    float *__restrict heading = batch->heading;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        heading[i] = computeHeading(axis2[i] * sign, axis1[i] * sign);
+    }
+}
+
+/**
+ * @brief Precompute the horizontal projection for one attitude.
+ * With the normalized up vector g, east is m x g and north is the field with its vertical part removed,
+ * m - g (g.m). Only the X component of both is needed for the heading, so each reduces to one row.
+ * @param ax The X axis of the accelerometer.
+ * @param ay The Y axis of the accelerometer.
+ * @param az The Z axis of the accelerometer.
+ * @param matrix A pointer to a CompassTiltMatrix object where the projection will be stored.
+ */
+void MultiCompass::prepareTiltCompensation(float ax, float ay, float az, CompassTiltMatrix *matrix)
+{
+    float norm = sqrtf(ax * ax + ay * ay + az * az);
+    if (norm <= 0)
+    {
+        // Without a valid attitude assume the sensor is level.
+        ax = 0;
+        ay = 0;
+        az = 1;
+    }
+    else
+    {
+        float invNorm = 1 / norm;
+        ax *= invNorm;
+        ay *= invNorm;
+        az *= invNorm;
+    }
+
+    matrix->east[0] = 0;
+    matrix->east[1] = az;
+    matrix->east[2] = -ay;
+    matrix->north[0] = 1 - ax * ax;
+    matrix->north[1] = -ax * ay;
+    matrix->north[2] = -ax * az;
+}
+
+/**
+ * @brief Calculate the tilt compensated heading of a scaled sample.
+ * @param data A pointer to a CompassData object containing the scaled data.
+ * @param ax The X axis of the accelerometer.
+ * @param ay The Y axis of the accelerometer.
+ * @param az The Z axis of the accelerometer.
+ */
+void MultiCompass::calculateTiltCompensatedHeading(CompassData *data, float ax, float ay, float az)
+{
+    CompassTiltMatrix matrix;
+    prepareTiltCompensation(ax, ay, az, &matrix);
+    calculateTiltCompensatedHeading(data, &matrix);
+}
+
+/**
+ * @brief Calculate the tilt compensated heading of a scaled sample with a precomputed attitude.
+ * @param data A pointer to a CompassData object containing the scaled data.
+ * @param matrix A pointer to the precomputed CompassTiltMatrix.
+ */
+void MultiCompass::calculateTiltCompensatedHeading(CompassData *data, const CompassTiltMatrix *matrix)
+{
+    float east = matrix->east[1] * data->scaledY + matrix->east[2] * data->scaledZ;
+    float north = matrix->north[0] * data->scaledX + matrix->north[1] * data->scaledY + matrix->north[2] * data->scaledZ;
+    data->heading = computeHeading(east, north);
+}
+
+/**
+ * @brief Calculate the tilt compensated heading of an array of scaled samples sharing one attitude.
+ * @param data A pointer to an array of CompassData objects containing the scaled data.
+ * @param count The number of samples.
+ * @param ax The X axis of the accelerometer.
+ * @param ay The Y axis of the accelerometer.
+ * @param az The Z axis of the accelerometer.
+ */
+void MultiCompass::calculateTiltCompensatedHeadingBatch(CompassData *data, size_t count, float ax, float ay, float az)
+{
+    CompassTiltMatrix matrix;
+    prepareTiltCompensation(ax, ay, az, &matrix);
+    for (size_t i = 0; i < count; i++)
+    {
+        calculateTiltCompensatedHeading(&data[i], &matrix);
+    }
+}
+
+/**
+ * @brief Calculate the tilt compensated heading of scaled axis arrays sharing one attitude.
+ * @param batch A pointer to a CompassBatch object containing the scaled axes and receiving the headings.
+ * @param count The number of samples.
+ * @param ax The X axis of the accelerometer.
+ * @param ay The Y axis of the accelerometer.
+ * @param az The Z axis of the accelerometer.
+ */
+void MultiCompass::calculateTiltCompensatedHeadingBatch(CompassBatch *batch, size_t count, float ax, float ay, float az)
+{
+    CompassTiltMatrix matrix;
+    prepareTiltCompensation(ax, ay, az, &matrix);
+
+    const float *__restrict inX = batch->x;
+    const float *__restrict inY = batch->y;
+    const float *__restrict inZ = batch->z;
+    float *__restrict heading = batch->heading;
+    for (size_t i = 0; i < count; i++)
+    {
+        float east = matrix.east[1] * inY[i] + matrix.east[2] * inZ[i];
+        float north = matrix.north[0] * inX[i] + matrix.north[1] * inY[i] + matrix.north[2] * inZ[i];
+        heading[i] = computeHeading(east, north);
+    }
+}
+
+/**
+ * @brief Calculate a heading with the selected method, add the declination and normalize it to one turn.
+ * @param y The east component.
+ * @param x The north component.
+ * @return The heading in the selected unit.
+ */
+float MultiCompass::computeHeading(float y, float x)
+{
+    float heading = atan2Turn(y, x, headingMethod, headingTurn);
+    heading += getCalibration().heading * (headingTurn / (float)(2 * PI));
+    if (heading < 0)
+    {
+        heading += headingTurn;
+    }
+    else if (heading >= headingTurn)
+    {
+        heading -= headingTurn;
+    }
+    return heading;
+}
+#endif
+
+/**
+ * @brief Scale a raw sample with the cached fixed point coefficients.
+ * @param sample A pointer to a CompassRawSample object containing the raw data.
+ * @param data A pointer to a CompassFixedData object where the Q14 scaled data will be stored.
+ */
+void MultiCompass::scaleData(const CompassRawSample *sample, CompassFixedData *data)
+{
+    const CompassCoefficients &coefficients = getCoefficients();
+    const int16_t raw[3] = {sample->x, sample->y, sample->z};
+    int16_t scaled[3];
+#if !defined(MULTICOMPASS_NO_FLOAT)
+    if (coefficients.useMatrix)
+    {
+        int32_t centered[3];
+        for (uint8_t i = 0; i < 3; i++)
+        {
+            centered[i] = constrain(raw[i] - coefficients.offsetFixed[i], -coefficients.limitFixed[i], coefficients.limitFixed[i]);
+        }
+        for (uint8_t i = 0; i < 3; i++)
+        {
+            // Shift every product on its own, the sum of three unshifted products could exceed 32 bit.
+            const int32_t *m = &coefficients.matrixFixed[i * 3];
+            int32_t value = ((centered[0] * m[0]) >> MULTICOMPASS_FIXED_SCALE_SHIFT) +
+                            ((centered[1] * m[1]) >> MULTICOMPASS_FIXED_SCALE_SHIFT) +
+                            ((centered[2] * m[2]) >> MULTICOMPASS_FIXED_SCALE_SHIFT);
+            scaled[i] = constrain(value, -32767, 32767);
+        }
+        data->scaledX = scaled[0];
+        data->scaledY = scaled[1];
+        data->scaledZ = scaled[2];
+        return;
+    }
+#endif
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        // The centered value is clamped where the result saturates anyway, which keeps the product within 32 bit
+        // for the 16 bit sensors and the largest scale as well.
+        int32_t centered = constrain(raw[i] - coefficients.offsetFixed[i], -coefficients.limitFixed[i], coefficients.limitFixed[i]);
+        int32_t value = (centered * coefficients.scaleFixed[i]) >> MULTICOMPASS_FIXED_SCALE_SHIFT;
+        scaled[i] = constrain(value, -32767, 32767);
+    }
+    data->scaledX = scaled[0];
+    data->scaledY = scaled[1];
+    data->scaledZ = scaled[2];
+}
+
+/**
+ * @brief Calculate the heading of fixed point data, using the same axis selection as the float version.
+ * @param data A pointer to a CompassFixedData object containing the scaled data.
+ * @param x An integer value representing the x-axis value to use in the calculation.
+ * @param y An integer value representing the y-axis value to use in the calculation.
+ * @param z An integer value representing the z-axis value to use in the calculation.
+ */
+void MultiCompass::calculateHeading(CompassFixedData *data, int x, int y, int z)
+{
+    const CompassCoefficients &coefficients = getCoefficients();
+    int32_t axis1 = 0, axis2 = 0;
+    if (x != 0)
+    {
+        axis1 = (int32_t)data->scaledY * x;
+        axis2 = (int32_t)data->scaledZ * x;
+    }
+    else if (y != 0)
+    {
+        axis1 = (int32_t)data->scaledX * y;
+        axis2 = (int32_t)data->scaledZ * y;
+    }
+    else if (z != 0)
+    {
+        axis1 = (int32_t)data->scaledX * z;
+        axis2 = (int32_t)data->scaledY * z;
+    }
+
+    // The binary angle wraps at a full turn, so adding the declination also normalizes the heading.
+    data->heading = atan2Fixed(axis2, axis1) + coefficients.declinationFixed;
+}
+
+// atan(2^-i) as binary angle, shared by both CORDIC modes.
+static const uint16_t cordicAngles[] = {8192, 4836, 2555, 1297, 651, 326, 163, 81, 41, 20, 10, 5, 3, 1};
+
+/**
+ * @brief Calculate atan2 with a CORDIC in vectoring mode.
+ * @param y The y component.
+ * @param x The x component.
+ * @return The angle as binary angle, 65536 == 2*PI.
+ */
+uint16_t MultiCompass::atan2Fixed(int32_t y, int32_t x)
+{
+    uint16_t angle = 0;
+
+    // Rotate into the right half plane, the CORDIC only converges for angles within +-90 degrees.
+    if (x < 0)
+    {
+        x = -x;
+        y = -y;
+        angle = MULTICOMPASS_ANGLE_FULL / 2;
+    }
+
+    // Use the spare bits for precision, the CORDIC gain of 1.65 still fits into 32 bit.
+    x <<= 12;
+    y <<= 12;
+    for (uint8_t i = 0; i < sizeof(cordicAngles) / sizeof(cordicAngles[0]); i++)
+    {
+        int32_t dx = x >> i;
+        int32_t dy = y >> i;
+        if (y > 0)
+        {
+            x += dy;
+            y -= dx;
+            angle += cordicAngles[i];
+        }
+        else
+        {
+            x -= dy;
+            y += dx;
+            angle -= cordicAngles[i];
+        }
+    }
+    return angle;
+}
+
+/**
+ * @brief Calculate the sine and cosine of a binary angle with a CORDIC in rotation mode.
+ * @param angle The angle as binary angle.
+ * @param sine A pointer where the sine will be stored in Q14.
+ * @param cosine A pointer where the cosine will be stored in Q14.
+ */
+void MultiCompass::sinCosFixed(uint16_t angle, int16_t *sine, int16_t *cosine)
+{
+    // Fold the angle into +-90 degrees, the CORDIC only converges there, and mirror the result afterwards.
+    int32_t residual = (int16_t)angle;
+    bool mirrored = residual > (int32_t)(MULTICOMPASS_ANGLE_FULL / 4) || residual < -(int32_t)(MULTICOMPASS_ANGLE_FULL / 4);
+    if (mirrored)
+    {
+        residual = (int16_t)(angle + MULTICOMPASS_ANGLE_FULL / 2);
+    }
+
+    // Start with the reciprocal CORDIC gain of 0.60725 in Q14, extended by the same 12 spare bits as atan2Fixed.
+    int32_t x = 40752041L;
+    int32_t y = 0;
+    for (uint8_t i = 0; i < sizeof(cordicAngles) / sizeof(cordicAngles[0]); i++)
+    {
+        int32_t dx = x >> i;
+        int32_t dy = y >> i;
+        if (residual >= 0)
+        {
+            x -= dy;
+            y += dx;
+            residual -= cordicAngles[i];
+        }
+        else
+        {
+            x += dy;
+            y -= dx;
+            residual += cordicAngles[i];
+        }
+    }
+    x = (x + (1L << 11)) >> 12;
+    y = (y + (1L << 11)) >> 12;
+    *cosine = mirrored ? -x : x;
+    *sine = mirrored ? -y : y;
+}
+
+#if !defined(MULTICOMPASS_NO_FLOAT)
+// atan(i / 256) in 1/65536 of an eighth turn, kept in flash on AVR.
+static const uint16_t octantAngles[256] PROGMEM = {
+    0, 326, 652, 978, 1304, 1630, 1955, 2281, 2607, 2932, 3258, 3583,
+    3909, 4234, 4559, 4884, 5208, 5533, 5857, 6182, 6506, 6830, 7153, 7477,
+    7800, 8123, 8446, 8768, 9090, 9412, 9734, 10055, 10377, 10697, 11018, 11338,
+    11658, 11977, 12296, 12615, 12933, 13251, 13569, 13886, 14203, 14519, 14835, 15151,
+    15466, 15781, 16095, 16409, 16722, 17035, 17347, 17659, 17970, 18281, 18591, 18901,
+    19210, 19519, 19827, 20135, 20442, 20748, 21054, 21360, 21664, 21968, 22272, 22575,
+    22877, 23179, 23480, 23781, 24081, 24380, 24678, 24976, 25274, 25570, 25866, 26161,
+    26456, 26750, 27043, 27336, 27628, 27919, 28209, 28499, 28788, 29076, 29364, 29651,
+    29937, 30222, 30507, 30791, 31074, 31356, 31638, 31919, 32199, 32479, 32757, 33035,
+    33312, 33589, 33864, 34139, 34413, 34686, 34958, 35230, 35501, 35771, 36040, 36308,
+    36576, 36843, 37109, 37374, 37639, 37902, 38165, 38427, 38688, 38949, 39208, 39467,
+    39725, 39982, 40238, 40493, 40748, 41002, 41255, 41507, 41758, 42009, 42258, 42507,
+    42755, 43003, 43249, 43494, 43739, 43983, 44226, 44468, 44710, 44950, 45190, 45429,
+    45667, 45904, 46141, 46376, 46611, 46845, 47078, 47311, 47542, 47773, 48003, 48232,
+    48460, 48687, 48914, 49140, 49365, 49589, 49812, 50035, 50257, 50478, 50698, 50917,
+    51136, 51353, 51570, 51786, 52002, 52216, 52430, 52643, 52855, 53066, 53277, 53487,
+    53696, 53904, 54111, 54318, 54524, 54729, 54933, 55137, 55340, 55542, 55743, 55943,
+    56143, 56342, 56540, 56738, 56935, 57131, 57326, 57520, 57714, 57907, 58099, 58291,
+    58481, 58671, 58861, 59049, 59237, 59424, 59611, 59796, 59981, 60166, 60349, 60532,
+    60714, 60896, 61076, 61256, 61436, 61614, 61792, 61969, 62146, 62322, 62497, 62671,
+    62845, 63018, 63191, 63363, 63534, 63704, 63874, 64043, 64212, 64379, 64547, 64713,
+    64879, 65044, 65209, 65373,
+};
+
+/**
+ * @brief Calculate atan of the first octant with a cubic polynomial.
+ * @param t The tangent between 0 and 1.
+ * @return The angle in eighths of a turn.
+ */
+static float octantPolynomial(float t)
+{
+    // atan(t) / (PI / 4) = t + t (1 - t) (c1 + c2 t), the coefficients keep the error below 0.087 degree.
+    return t + t * (1 - t) * (0.3116f + 0.0844f * t);
+}
+
+/**
+ * @brief Calculate atan of the first octant with the interpolated table.
+ * @param t The tangent between 0 and 1.
+ * @return The angle in eighths of a turn.
+ */
+static float octantTable(float t)
+{
+    float position = t * 256;
+    uint16_t index = (uint16_t)position;
+    if (index >= 255)
+    {
+        // The last interval ends at atan(1), one eighth, which does not fit into the table.
+        float start = pgm_read_word(&octantAngles[255]);
+        return (start + (position - 255) * (65536 - start)) * (1.0f / 65536);
+    }
+    float start = pgm_read_word(&octantAngles[index]);
+    float end = pgm_read_word(&octantAngles[index + 1]);
+    return (start + (position - index) * (end - start)) * (1.0f / 65536);
+}
+
+/**
+ * @brief Calculate atan2 with one of the heading methods.
+ * @param y The y component.
+ * @param x The x component.
+ * @param method The method, as a CompassHeadingMethod enum value.
+ * @param turn The value of a full turn.
+ * @return The angle between 0 and turn.
+ */
+float MultiCompass::atan2Turn(float y, float x, CompassHeadingMethod method, float turn)
+{
+    if (method == COMPASS_HEADING_ATAN2)
+    {
+        float angle = atan2f(y, x) * (turn / (float)(2 * PI));
+        return angle < 0 ? angle + turn : angle;
+    }
+
+    float absX = fabsf(x);
+    float absY = fabsf(y);
+    if (absX == 0 && absY == 0)
+    {
+        // Same result as atan2f(0, 0).
+        return 0;
+    }
+
+    // Reduce to the first octant with a single division, then mirror the angle back in eighths of a turn.
+    bool steep = absY > absX;
+    float t = steep ? absX / absY : absY / absX;
+    float eighths = method == COMPASS_HEADING_TABLE ? octantTable(t) : octantPolynomial(t);
+    if (steep)
+    {
+        eighths = 2 - eighths;
+    }
+    if (x < 0)
+    {
+        eighths = 4 - eighths;
+    }
+    if (y < 0)
+    {
+        eighths = 8 - eighths;
+    }
+    float angle = eighths * (turn / 8);
+    return angle < turn ? angle : angle - turn;
+}
+
+/**
+ * @brief Calculate atan2 with one of the heading methods as binary angle.
+ * @param y The y component.
+ * @param x The x component.
+ * @param method The method, as a CompassHeadingMethod enum value.
+ * @return The angle as binary angle.
+ */
+uint16_t MultiCompass::atan2Angle(float y, float x, CompassHeadingMethod method)
+{
+    // A result that rounds up to a full turn wraps to 0.
+    return (uint16_t)(uint32_t)(atan2Turn(y, x, method, MULTICOMPASS_ANGLE_FULL) + 0.5f);
+}
+#endif
+
+/**
+ * @brief Set the filter stage of CompassData.
+ * @param filter A pointer to the filter, NULL to disable filtering.
+ */
+void MultiCompass::setFilter(MultiCompassFilter *filter)
+{
+    this->filter = filter;
+}
+
+/**
+ * @brief Set the filter stage of the fixed point pipeline.
+ * @param filter A pointer to the filter, NULL to disable filtering.
+ */
+void MultiCompass::setFilter(MultiCompassFilterFixed *filter)
+{
+    filterFixed = filter;
+}
+
+/**
+ * @brief Filter the scaled axes of a sample, overflowed samples are skipped.
+ * @param data A pointer to a CompassData object containing the scaled data.
+ */
+void MultiCompass::filterData(CompassData *data)
+{
+    // A saturated sample carries no information about the field, it must not pull the averages.
+    if (filter != NULL && !(data->flags & COMPASS_FLAG_OVERFLOW))
+    {
+        filter->filter(data);
+    }
+}
+
+/**
+ * @brief Filter the scaled axes of a fixed point sample.
+ * @param data A pointer to a CompassFixedData object containing the scaled data.
+ */
+void MultiCompass::filterData(CompassFixedData *data)
+{
+    if (filterFixed != NULL)
+    {
+        filterFixed->filter(data);
+    }
+}
+
+/**
+ * @brief Filter the heading of a sample.
+ * @param data A pointer to a CompassData object containing the heading.
+ */
+void MultiCompass::filterHeading(CompassData *data)
+{
+    if (filter != NULL && !(data->flags & COMPASS_FLAG_OVERFLOW))
+    {
+#if defined(MULTICOMPASS_NO_FLOAT)
+        // The heading is a binary angle like the one of the fixed point pipeline.
+        filter->filterHeading(data);
+#else
+        if (headingUnit == COMPASS_UNIT_RADIANS)
+        {
+            filter->filterHeading(data);
+            return;
+        }
+        // The filter works in radians.
+        data->heading *= (float)(2 * PI) / headingTurn;
+        filter->filterHeading(data);
+        data->heading *= headingTurn / (float)(2 * PI);
+#endif
+    }
+}
+
+/**
+ * @brief Filter the heading of a fixed point sample.
+ * @param data A pointer to a CompassFixedData object containing the heading.
+ */
+void MultiCompass::filterHeading(CompassFixedData *data)
+{
+    if (filterFixed != NULL)
+    {
+        filterFixed->filterHeading(data);
+    }
+}
+
+/**
+ * @brief Publish a new rawScale together with the coefficients derived from it.
+ * rawScale is part of the calibration state, so a range change cannot tear the coefficients of another writer.
+ * @param x The factor of the X axis.
+ * @param y The factor of the Y axis.
+ * @param z The factor of the Z axis.
+ */
+void MultiCompass::setRawScale(CompassRawScaleValue x, CompassRawScaleValue y, CompassRawScaleValue z)
+{
+    CompassCalibrationState *state = editCalibration();
+    state->rawScale[0] = x;
+    state->rawScale[1] = y;
+    state->rawScale[2] = z;
+    publishCalibration();
+}
+
+/**
+ * @brief Get the largest centered raw value whose product with a fixed point factor stays below a bound.
+ * @param factor The fixed point factor.
+ * @param bound The largest allowed product.
+ * @return The limit, at least the full span of a 16 bit raw value minus its offset.
+ */
+static int32_t fixedLimit(int32_t factor, int32_t bound)
+{
+    const int32_t span = 65535;
+    factor = labs(factor);
+    return factor > 0 && bound / factor < span ? bound / factor : span;
+}
+
+/**
+ * @brief Derive the coefficients of a calibration state from its settings, its soft iron calibration and rawScale.
+ * @param state A pointer to the state, its coefficients are overwritten.
+ */
+void MultiCompass::buildCoefficients(CompassCalibrationState *state)
+{
+    const CompassSetting &settings = state->settings;
+    const CompassRawScaleValue *rawScale = state->rawScale;
+    CompassCoefficients &coefficients = state->coefficients;
+#if defined(MULTICOMPASS_NO_FLOAT)
+    const int32_t minimum[3] = {settings.minX, settings.minY, settings.minZ};
+    const int32_t maximum[3] = {settings.maxX, settings.maxY, settings.maxZ};
+    // The scale is limited to the smallest half range, which keeps the fixed point products in 32 bit.
+    const int32_t maximumScale = (MULTICOMPASS_FIXED_ONE << MULTICOMPASS_FIXED_SCALE_SHIFT) / MULTICOMPASS_FIXED_MIN_RANGE;
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        // The same coefficients as with float support, the offset (max + min) / 2 / rawScale is rounded to counts.
+        int32_t scale = rawScale[i] > 0 ? rawScale[i] : MULTICOMPASS_RAW_SCALE_ONE;
+        int32_t sum = (maximum[i] + minimum[i]) * (MULTICOMPASS_RAW_SCALE_ONE / 2);
+        int32_t offset = (sum + (sum < 0 ? -scale / 2 : scale / 2)) / scale;
+        coefficients.offsetFixed[i] = constrain(offset, -32767L, 32767L);
+        // 2^22 * rawScale / halfRange with rawScale in Q12 is scale * 2^11 / range, range being twice the half range.
+        int32_t range = labs(maximum[i] - minimum[i]);
+        int32_t scaleFixed = range > 0 ? ((scale << 11) + range / 2) / range : maximumScale;
+        coefficients.scaleFixed[i] = min(scaleFixed, maximumScale);
+        // Beyond this limit the scaled value saturates at 32767 anyway.
+        coefficients.limitFixed[i] = fixedLimit(coefficients.scaleFixed[i], (32767L << MULTICOMPASS_FIXED_SCALE_SHIFT) + coefficients.scaleFixed[i]);
+    }
+    // The binary angle needs no normalization.
+    coefficients.declinationFixed = settings.heading;
+#else
+    const CompassSoftIron &softIron = state->softIron;
+    const CompassRawValue minimum[3] = {settings.minX, settings.minY, settings.minZ};
+    const CompassRawValue maximum[3] = {settings.maxX, settings.maxY, settings.maxZ};
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        // The half range is the distance of the bounds, which stays valid when both bounds have the same sign.
+        float halfRange = fabsf(maximum[i] - minimum[i]) / 2;
+        coefficients.offset[i] = (maximum[i] + minimum[i]) / 2.0f;
+        coefficients.invScale[i] = halfRange > 0 ? 1 / halfRange : 0;
+    }
+
+    coefficients.useMatrix = softIron.valid;
+    if (softIron.valid)
+    {
+        // The soft iron calibration replaces the offset and the per axis scale.
+        for (uint8_t i = 0; i < 3; i++)
+        {
+            coefficients.offset[i] = softIron.offset[i];
+            coefficients.invScale[i] = softIron.matrix[i * 4];
+        }
+        for (uint8_t i = 0; i < 9; i++)
+        {
+            coefficients.matrix[i] = softIron.matrix[i];
+        }
+    }
+
+    // The calibration is given in its own raw units, fold the conversion from the current raw units into it:
+    // M (s * raw - offset) == (M s) (raw - offset / s).
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        if (rawScale[i] > 0)
+        {
+            coefficients.offset[i] /= rawScale[i];
+            coefficients.invScale[i] *= rawScale[i];
+        }
+    }
+    if (softIron.valid)
+    {
+        for (uint8_t i = 0; i < 9; i++)
+        {
+            if (rawScale[i % 3] > 0)
+            {
+                coefficients.matrix[i] *= rawScale[i % 3];
+            }
+        }
+    }
+
+    // The scale is limited to the smallest half range, which keeps the fixed point products in 32 bit.
+    const float fixedOne = (float)(MULTICOMPASS_FIXED_ONE << MULTICOMPASS_FIXED_SCALE_SHIFT);
+    const float maximumScale = 1.0f / MULTICOMPASS_FIXED_MIN_RANGE;
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        // Offsets beyond the 16 bit range of the sensors only occur without calibration.
+        coefficients.offsetFixed[i] = constrain(lroundf(coefficients.offset[i]), -32767L, 32767L);
+        float scale = coefficients.invScale[i] > 0 ? coefficients.invScale[i] : maximumScale;
+        coefficients.scaleFixed[i] = lroundf(constrain(scale, -maximumScale, maximumScale) * fixedOne);
+        // Beyond this limit the scaled value saturates at 32767 anyway.
+        coefficients.limitFixed[i] = fixedLimit(coefficients.scaleFixed[i], (32767L << MULTICOMPASS_FIXED_SCALE_SHIFT) + labs(coefficients.scaleFixed[i]));
+    }
+    if (softIron.valid)
+    {
+        for (uint8_t i = 0; i < 9; i++)
+        {
+            coefficients.matrixFixed[i] = lroundf(constrain(coefficients.matrix[i], -maximumScale, maximumScale) * fixedOne);
+        }
+        // A centered axis is multiplied by every entry of its column, the largest one limits it to 32 bit products.
+        for (uint8_t i = 0; i < 3; i++)
+        {
+            int32_t largest = 0;
+            for (uint8_t j = 0; j < 3; j++)
+            {
+                largest = max(largest, (int32_t)labs(coefficients.matrixFixed[j * 3 + i]));
+            }
+            coefficients.limitFixed[i] = fixedLimit(largest, INT32_MAX);
+        }
+    }
+
+    // Normalize the declination to one turn before converting it to a binary angle.
+    float declination = fmodf(settings.heading, (float)(2 * PI));
+    if (declination < 0)
+    {
+        declination += 2 * PI;
+    }
+    coefficients.declinationFixed = (uint16_t)(uint32_t)lroundf(declination * (float)(MULTICOMPASS_ANGLE_FULL / (2 * PI)));
+#endif
+}
+
+/**
+ * @brief Retrieve data from the MultiCompass sensor and store it in a CompassData object.
+ * @param data A pointer to a CompassData object where the retrieved data will be stored.
+ * @return true if the sensor was read, false otherwise.
+ */
+bool MultiCompass::getData(CompassData *data)
+{
+    CompassRawSample sample;
+    if (!acquireSample(&sample))
+    {
+        return false;
+    }
+    data->rawX = sample.x;
+    data->rawY = sample.y;
+    data->rawZ = sample.z;
+    data->timestamp = sample.timestamp;
+    data->sequence = sample.sequence;
+    data->flags = 0;
+    checkSample(data);
+    checkField(data);
+    return true;
+}
+
+/**
+ * @brief Read one sample, scale and filter it and calculate its heading.
+ * @param data A pointer to a CompassData object where the sample will be stored.
+ * @param x The X axis of the sensor.
+ * @param y The Y axis of the sensor.
+ * @param z The Z axis of the sensor.
+ * @return true if the sensor was read, false otherwise.
+ */
+bool MultiCompass::update(CompassData *data, int x, int y, int z)
+{
+    CompassRawSample sample;
+    if (!acquireSample(&sample))
+    {
+        return false;
+    }
+    data->rawX = sample.x;
+    data->rawY = sample.y;
+    data->rawZ = sample.z;
+    data->timestamp = sample.timestamp;
+    data->sequence = sample.sequence;
+    data->flags = 0;
+    checkSample(data);
+    scaleData(data);
+    checkScaledField(data);
+    filterData(data);
+    calculateHeading(data, x, y, z);
+    filterHeading(data);
+    return true;
+}
+
+/**
+ * @brief Acquire several samples, draining the data ready buffer if the data ready mode is active.
+ * @param data A pointer to an array of CompassData objects where the raw data will be stored.
+ * @param count The size of the array.
+ * @return The number of acquired samples.
+ */
+size_t MultiCompass::getDataBatch(CompassData *data, size_t count)
+{
+    if (dataReadyBuffer == NULL)
+    {
+        // Without data ready mode only the current conversion is available.
+        return (count > 0 && getData(data)) ? 1 : 0;
+    }
+
+    size_t acquired = 0;
+    CompassRawSample sample;
+    while (acquired < count && dataReadyBuffer->pop(sample))
+    {
+        data[acquired].rawX = sample.x;
+        data[acquired].rawY = sample.y;
+        data[acquired].rawZ = sample.z;
+        data[acquired].timestamp = sample.timestamp;
+        data[acquired].sequence = sample.sequence;
+        data[acquired].flags = 0;
+        checkSample(&data[acquired]);
+        checkField(&data[acquired]);
+        acquired++;
+    }
+    return acquired;
+}
+
+/**
+ * @brief Inspect an acquired sample. The generic compass does not know the limits of its sensor.
+ * @param data A pointer to a CompassData object containing the raw sensor data.
+ */
+void MultiCompass::checkSample(CompassData *data)
+{
+    (void)data;
+}
+
+#if !defined(MULTICOMPASS_NO_FLOAT)
+/**
+ * @brief Enable the interference check of every acquired sample.
+ * @param tolerance The allowed relative deviation of the norm from the baseline, 0 disables the check.
+ * @param maxRate The allowed relative change of the norm per second, 0 disables the rate check.
+ * @param pauseCalibration Whether calibration() skips flagged samples.
+ */
+void MultiCompass::setFieldCheck(float tolerance, float maxRate, bool pauseCalibration)
+{
+    fieldTolerance = tolerance;
+    fieldRate = maxRate;
+    fieldPause = pauseCalibration;
+    resetFieldBaseline();
+}
+
+/**
+ * @brief Get the baseline of the calibrated field norm.
+ * @return The baseline, 0 while it is learned.
+ */
+float MultiCompass::getFieldBaseline()
+{
+    return fieldSamples >= MULTICOMPASS_FIELD_WARMUP && fieldResets == fieldResetsHandled ? fieldBaseline : 0;
+}
+
+/**
+ * @brief Discard the baseline of the field norm.
+ */
+void MultiCompass::resetFieldBaseline()
+{
+    // The baseline is only written by the sampling path, which applies the request with its next sample.
+    fieldResets = fieldResets + 1;
+}
+
+/**
+ * @brief Get the factor from the current raw units of an axis to the raw units of the calibration.
+ * @param axis The axis, 0 to 2.
+ * @return The factor.
+ */
+float MultiCompass::getRawScale(uint8_t axis)
+{
+    return acquireCalibration().rawScale[axis];
+}
+#endif
+
+/**
+ * @brief Compare the calibrated field norm of an acquired, not yet scaled sample with its baseline.
+ * @param data A pointer to a CompassData object containing the raw sensor data.
+ */
+void MultiCompass::checkField(CompassData *data)
+{
+#if defined(MULTICOMPASS_NO_FLOAT)
+    // The norm needs float support, so samples are never flagged.
+    (void)data;
+#else
+    if (fieldTolerance <= 0)
+    {
+        return;
+    }
+
+    // Scale a copy, the caller decides whether and how the sample itself is scaled.
+    CompassData scaled = *data;
+    scaleData(&scaled);
+    checkScaledField(&scaled);
+    data->flags = scaled.flags;
+#endif
+}
+
+/**
+ * @brief Compare the calibrated field norm of a scaled sample with its baseline.
+ * @param data A pointer to a CompassData object containing the scaled sensor data.
+ */
+void MultiCompass::checkScaledField(CompassData *data)
+{
+#if defined(MULTICOMPASS_NO_FLOAT)
+    (void)data;
+#else
+    // Saturated samples have no meaningful norm.
+    if (fieldTolerance <= 0 || (data->flags & (COMPASS_FLAG_OVERFLOW | COMPASS_FLAG_RANGE_CHANGED)))
+    {
+        return;
+    }
+
+    // Apply a reset requested by another context, the counter is only written by resetFieldBaseline().
+    uint8_t resets = fieldResets;
+    if (resets != fieldResetsHandled)
+    {
+        fieldResetsHandled = resets;
+        fieldSamples = 0;
+        fieldFlagged = 0;
+    }
+
+    float norm = sqrtf(data->scaledX * data->scaledX + data->scaledY * data->scaledY + data->scaledZ * data->scaledZ);
+    if (norm <= 0)
+    {
+        // Without a calibration there is nothing to compare.
+        return;
+    }
+
+    uint32_t elapsed = data->timestamp - fieldTime;
+    float change = fabsf(norm - fieldNorm);
+    fieldNorm = norm;
+    fieldTime = data->timestamp;
+
+    uint8_t samples = fieldSamples;
+    if (samples < MULTICOMPASS_FIELD_WARMUP)
+    {
+        // Average the first samples of a new baseline, the rate is unknown until the first one.
+        fieldBaseline = samples == 0 ? norm : fieldBaseline + (norm - fieldBaseline) / (samples + 1);
+        fieldSamples = samples + 1;
+        return;
+    }
+
+    bool anomaly = fabsf(norm - fieldBaseline) > fieldTolerance * fieldBaseline;
+    // Compare the change with the allowed rate without a division, elapsed is in microseconds.
+    if (fieldRate > 0 && change * 1000000.0f > fieldRate * fieldBaseline * elapsed)
+    {
+        anomaly = true;
+    }
+
+    if (anomaly)
+    {
+        data->flags |= COMPASS_FLAG_ANOMALY;
+        // A disturbance passes, a baseline that rejects everything no longer fits the calibration.
+        if (++fieldFlagged >= MULTICOMPASS_FIELD_STALE)
+        {
+            fieldSamples = 0;
+            fieldFlagged = 0;
+        }
+    }
+    else
+    {
+        // Follow slow changes, e.g. of the temperature, but not the disturbance itself.
+        fieldBaseline += (norm - fieldBaseline) * MULTICOMPASS_FIELD_ALPHA;
+        fieldFlagged = 0;
+    }
+#endif
+}
+
+/**
+ * @brief Convert a raw value of the current field range to the raw units of the calibration.
+ * @param raw The raw value.
+ * @param axis The axis, 0 to 2.
+ * @return The value in the raw units of the calibration, limited to the range of int16_t in compact builds.
+ */
+CompassRawValue MultiCompass::toCalibrationUnits(CompassRawValue raw, uint8_t axis)
+{
+    const CompassRawScaleValue *rawScale = acquireCalibration().rawScale;
+#if defined(MULTICOMPASS_NO_FLOAT)
+    int32_t value = ((int32_t)raw * rawScale[axis] + MULTICOMPASS_RAW_SCALE_ONE / 2) >> 12;
+    return constrain(value, -32767L, 32767L);
+#elif defined(MULTICOMPASS_COMPACT)
+    return constrain(lroundf(raw * rawScale[axis]), -32767L, 32767L);
+#else
+    return raw * rawScale[axis];
+#endif
+}
+
+/**
+ * @brief Calibrate the MultiCompass sensor using the provided data.
+ * Updates the min and max values for each axis based on the current readings
+ * from the compass sensor. Calibration is complete when the time since last calibration
+ * is greater than the calibration period.
+ * @param data A pointer to a CompassData object containing the raw X, Y, and Z values from the compass sensor.
+ * @return true if calibration is complete, false otherwise.
+ */
+bool MultiCompass::calibration(CompassData *data)
+{
+    const CompassSetting &settings = getCalibration();
+
+    // Saturated samples would widen the bounds to the overflow value, disturbed ones to the disturbance.
+    uint8_t skipped = COMPASS_FLAG_OVERFLOW | COMPASS_FLAG_RANGE_CHANGED;
+#if !defined(MULTICOMPASS_NO_FLOAT)
+    if (fieldPause)
+    {
+        skipped |= COMPASS_FLAG_ANOMALY;
+    }
+#endif
+    if (data->flags & skipped)
+    {
+        return (millis() - settings.lastCalibration) > (uint32_t)calibrationPeriod;
+    }
+
+    // Record the bounds in the raw units of the calibration.
+    CompassRawValue x = toCalibrationUnits(data->rawX, 0);
+    CompassRawValue y = toCalibrationUnits(data->rawY, 1);
+    CompassRawValue z = toCalibrationUnits(data->rawZ, 2);
+
+    // Only copy and publish the calibration when the bounds were widened.
+    if (x < settings.minX || y < settings.minY || z < settings.minZ ||
+        x > settings.maxX || y > settings.maxY || z > settings.maxZ)
+    {
+        CompassSetting *edited = &editCalibration()->settings;
+
+        // Update minimum values for each axis.
+        edited->minX = min(x, edited->minX);
+        edited->minY = min(y, edited->minY);
+        edited->minZ = min(z, edited->minZ);
+
+        // Update maximum values for each axis.
+        edited->maxX = max(x, edited->maxX);
+        edited->maxY = max(y, edited->maxY);
+        edited->maxZ = max(z, edited->maxZ);
+
+        edited->lastCalibration = millis();
+        publishCalibration();
+    }
+
+    // Check if calibration is complete.
+    return (millis() - getCalibration().lastCalibration) > (uint32_t)calibrationPeriod;
+}
+
+/**
+ * @brief Write a byte of data to a specified register of the MultiCompass sensor.
+ * @param reg The register to write to.
+ * @param value The value to write to the register.
+ */
+void MultiCompass::writeByte(uint8_t reg, uint8_t value)
+{
+    writeBytes(reg, &value, 1);
+};
+
+/**
+ * @brief Write a block of consecutive registers of the MultiCompass sensor in one transaction.
+ * @param reg The first register to write to.
+ * @param buffer A pointer to the bytes to write.
+ * @param length The number of bytes to write.
+ * @return true if the block was written, false otherwise.
+ */
+bool MultiCompass::writeBytes(uint8_t reg, const uint8_t *buffer, uint8_t length)
+{
+    // Do not interleave with a pending asynchronous transaction.
+    if (transaction.status == COMPASS_BUSY)
+    {
+        lastStatus = COMPASS_BUSY;
+        return false;
+    }
+
+#if !defined(MULTICOMPASS_NO_METRICS)
+    unsigned long start = micros();
+#endif
+    CompassStatus status;
+    for (uint8_t attempt = 0;; attempt++)
+    {
+        // Write the first register and all values, the sensor increments its register pointer after every byte.
+        status = transport->write(adress, reg, buffer, length, timeout);
+        countAttempt(status);
+        if (status == COMPASS_OK || attempt >= retries)
+        {
+            break;
+        }
+        busCounters.retries++;
+    }
+#if !defined(MULTICOMPASS_NO_METRICS)
+    recordLatency(micros() - start, true);
+#endif
+    return completeTransfer(status);
+}
+
+/**
+ * @brief This function reads a single byte from a given register address using I2C communication.
+ * @param reg: The register address from where a byte will be read.
+ * @return An unsigned 8-bit integer representing the byte read from the given register address, 0 on failure.
+ */
+uint8_t MultiCompass::readByte(uint8_t reg)
+{
+    uint8_t value = 0;
+    readBytes(reg, &value, 1);
+    return value; // Return the byte read.
+}
+
+/**
+ * @brief This function reads two bytes from a given register address using I2C communication.
+ * @param reg: The register address from where two bytes will be read.
+ * @param LSB: A boolean flag indicating the order in which bytes will be read. If true, LSB is read first.
+ * @return An integer value representing the two bytes read from the given register address, 0 on failure.
+ */
+int MultiCompass::readTwoBytes(uint8_t reg, bool LSB)
+{
+    int16_t value = 0;
+    uint8_t buffer[2] = {0, 0};
+    uint8_t vha, vla;
+    readBytes(reg, buffer, 2);
+    if (LSB) // If LSB is to be read first.
+    {
+        vha = buffer[0];
+        vla = buffer[1];
+    }
+    else // If MSB is to be read first.
+    {
+        vla = buffer[0];
+        vha = buffer[1];
+    }
+    value = vha << 8 | vla; // Combine the two bytes to get the final value.
+    return value;           // Return the final value.
+}
+
+/**
+ * @brief This function reads a block of consecutive registers in one I2C transaction.
+ * @param reg: The first register address from where the bytes will be read.
+ * @param buffer: A pointer to the buffer where the read bytes will be stored.
+ * @param length: The number of bytes to read.
+ * @return true if all requested bytes were received, false otherwise.
+ */
+bool MultiCompass::readBytes(uint8_t reg, uint8_t *buffer, uint8_t length)
+{
+    // Do not interleave with a pending asynchronous transaction.
+    if (transaction.status == COMPASS_BUSY)
+    {
+        lastStatus = COMPASS_BUSY;
+        return false;
+    }
+#if !defined(MULTICOMPASS_NO_METRICS)
+    unsigned long start = micros();
+#endif
+    CompassStatus status;
+    for (uint8_t attempt = 0;; attempt++)
+    {
+        status = transfer(reg, buffer, length);
+        countAttempt(status);
+        if (status == COMPASS_OK || attempt >= retries)
+        {
+            break;
+        }
+        busCounters.retries++;
+    }
+#if !defined(MULTICOMPASS_NO_METRICS)
+    recordLatency(micros() - start, true);
+#endif
+    return completeTransfer(status); // Return whether the whole block was received.
+}
+
+/**
+ * @brief Count one attempt of a transfer by its result.
+ * @param status The status of the attempt.
+ */
+void MultiCompass::countAttempt(CompassStatus status)
+{
+    switch (status)
+    {
+    case COMPASS_OK:
+    case COMPASS_BUSY:
+        return;
+    case COMPASS_ERROR_NACK:
+        busCounters.nacks++;
+        break;
+    case COMPASS_ERROR_TIMEOUT:
+        busCounters.timeouts++;
+        break;
+    default:
+        busCounters.busErrors++;
+        break;
+    }
+    busCounters.errors++;
+}
+
+/**
+ * @brief Record the final status of a synchronous transfer and recover the bus after too many failures in a row.
+ * @param status The final status of the transfer.
+ * @return true if the transfer was successful, false otherwise.
+ */
+bool MultiCompass::completeTransfer(CompassStatus status)
+{
+    lastStatus = status;
+    busCounters.transfers++;
+    if (status == COMPASS_OK)
+    {
+        busCounters.consecutiveFailures = 0;
+        return true;
+    }
+    busCounters.failures++;
+    if (busCounters.consecutiveFailures < 255)
+    {
+        busCounters.consecutiveFailures++;
+    }
+    // Only recover with known pins, a restart with default pins could move the bus. The recovery itself
+    // writes the configuration, which must not start another recovery.
+    if (recoveryThreshold > 0 && busCounters.consecutiveFailures >= recoveryThreshold && sdaPin >= 0 && sclPin >= 0 && !recovering)
+    {
+        recoverBus();
+        // Keep the status of the failed transfer, the caller has to repeat it.
+        lastStatus = status;
+    }
+    return false;
+}
+
+/**
+ * @brief Get the transport of all transfers of this sensor.
+ * @return A pointer to the transport.
+ */
+MultiCompassTransport *MultiCompass::getTransport()
+{
+    return transport;
+}
+
+/**
+ * @brief Get the transfer and error counters of this sensor.
+ * @return A reference to the counters.
+ */
+const CompassBusCounters &MultiCompass::getBusCounters()
+{
+    return busCounters;
+}
+
+/**
+ * @brief Reset all transfer and error counters of this sensor.
+ */
+void MultiCompass::resetBusCounters()
+{
+    busCounters = {};
+}
+
+/**
+ * @brief Take a snapshot of the metrics of this sensor.
+ * The sample count is derived from the sequence number, so acquiring a sample costs nothing extra.
+ * @param metrics A pointer to a CompassMetrics object where the snapshot will be stored.
+ */
+void MultiCompass::getMetrics(CompassMetrics *metrics)
+{
+    *metrics = this->metrics;
+    metrics->elapsed = millis() - metricsStart;
+    metrics->dataReadyOverruns = dataReadyOverruns - metricsOverruns;
+    // The sequence also advances for every lost sample.
+    metrics->samples = nextSequence(0) - metricsSequence - metrics->dataReadyOverruns;
+#if !defined(MULTICOMPASS_NO_FLOAT)
+    metrics->sampleRate = metrics->elapsed > 0 ? metrics->samples * 1000.0f / metrics->elapsed : 0;
+#endif
+    metrics->bus = busCounters;
+}
+
+/**
+ * @brief Start a new measurement window of the metrics and reset the bus counters.
+ */
+void MultiCompass::resetMetrics()
+{
+    metrics = {};
+    metricsStart = millis();
+    metricsSequence = nextSequence(0);
+    metricsOverruns = dataReadyOverruns;
+    resetBusCounters();
+}
+
+/**
+ * @brief Add the duration of a transfer to the histogram.
+ * @param latency The duration in microseconds.
+ * @param blocking Whether the caller waited for the transfer.
+ */
+void MultiCompass::recordLatency(uint32_t latency, bool blocking)
+{
+    // The bucket is the number of significant bits above the limit of the first bucket.
+    uint32_t scaled = latency >> MULTICOMPASS_LATENCY_SHIFT;
+    uint8_t bucket = 0;
+    while (scaled > 0 && bucket < MULTICOMPASS_LATENCY_BUCKETS - 1)
+    {
+        scaled >>= 1;
+        bucket++;
+    }
+    metrics.latency[bucket]++;
+    if (latency > metrics.maxLatency)
+    {
+        metrics.maxLatency = latency;
+    }
+    if (blocking)
+    {
+        metrics.blockedTime += latency;
+    }
+}
+
+/**
+ * @brief Set the pins and the clock of the bus that recoverBus() uses.
+ * @param sda The GPIO of SDA.
+ * @param scl The GPIO of SCL.
+ * @param frequency The clock of the bus in Hz, 0 keeps the default of the core.
+ */
+void MultiCompass::setBusPins(int8_t sda, int8_t scl, uint32_t frequency)
+{
+    sdaPin = sda;
+    sclPin = scl;
+    busClock = frequency;
+    enableWireTimeout();
+}
+
+/**
+ * @brief Enable the bus timeout of the Wire object, so a stuck bus fails the transfer instead of blocking.
+ */
+void MultiCompass::enableWireTimeout()
+{
+#if defined(WIRE_HAS_TIMEOUT)
+    if (mywire != NULL)
+    {
+        // Resetting the hardware on a timeout lets the next transfer start on a released bus.
+        mywire->setWireTimeout(timeout, true);
+    }
+#endif
+}
+
+// Pull a bus line low like an open drain output.
+static void busLineLow(uint8_t pin)
+{
+    digitalWrite(pin, LOW);
+    pinMode(pin, OUTPUT);
+}
+
+// Release a bus line, the pull-ups take it high.
+static void busLineRelease(uint8_t pin)
+{
+    pinMode(pin, INPUT_PULLUP);
+}
+
+/**
+ * @brief Free a stuck bus, restart the Wire object and write the shadowed configuration again.
+ * A sensor that was interrupted in the middle of a read keeps SDA low until it has clocked out its byte,
+ * so SCL is clocked up to nine times until SDA is released, followed by a STOP condition.
+ * @return true if the bus lines are released and the configuration was written, false otherwise.
+ */
+bool MultiCompass::recoverBus()
+{
+    // The worker task may still use the bus.
+    if (transaction.status == COMPASS_BUSY || recovering)
+    {
+        return false;
+    }
+    recovering = true;
+    busCounters.recoveries++;
+
+    bool released = true;
+    if (mywire != NULL && sdaPin >= 0 && sclPin >= 0)
+    {
+#if ARDUINO >= 100
+        mywire->end();
+#endif
+        busLineRelease(sdaPin);
+        busLineRelease(sclPin);
+        delayMicroseconds(5);
+        for (uint8_t i = 0; i < 9 && digitalRead(sdaPin) == LOW; i++)
+        {
+            busLineLow(sclPin);
+            delayMicroseconds(5);
+            busLineRelease(sclPin);
+            delayMicroseconds(5);
+        }
+        // STOP condition: SDA rises while SCL is high.
+        busLineLow(sdaPin);
+        delayMicroseconds(5);
+        busLineRelease(sclPin);
+        delayMicroseconds(5);
+        busLineRelease(sdaPin);
+        delayMicroseconds(5);
+        released = digitalRead(sdaPin) == HIGH && digitalRead(sclPin) == HIGH;
+
+#if defined(ARDUINO_ARCH_ESP32)
+        mywire->begin(sdaPin, sclPin, busClock);
+#else
+        mywire->begin();
+        if (busClock > 0)
+        {
+            mywire->setClock(busClock);
+        }
+#endif
+        // begin() of the Wire object may reset the timeout.
+        enableWireTimeout();
+    }
+
+    // A brown out may have reset the sensor to its defaults.
+    busCounters.consecutiveFailures = 0;
+    bool configured = applyConfig();
+    recovering = false;
+    return released && configured;
+}
+
+/**
+ * @brief Write the shadowed configuration to the sensor. The generic compass has no configuration.
+ * @return Always true.
+ */
+bool MultiCompass::applyConfig()
+{
+    return true;
+}
+
+/**
+ * @brief Start an asynchronous read of consecutive registers.
+ * @param reg The first register to read from.
+ * @param buffer A pointer to the buffer where the read bytes will be stored, has to stay valid until completion.
+ * @param length The number of bytes to read.
+ * @param callback A function called on completion, may be NULL.
+ * @param arg An argument passed to the callback.
+ * @return COMPASS_OK if the read was started, COMPASS_BUSY if another read is still pending.
+ */
+CompassStatus MultiCompass::startRead(uint8_t reg, uint8_t *buffer, uint8_t length, CompassCallback callback, void *arg)
+{
+    if (transaction.status == COMPASS_BUSY)
+    {
+        return COMPASS_BUSY;
+    }
+    transaction.reg = reg;
+    transaction.buffer = buffer;
+    transaction.length = length;
+    transaction.callback = callback;
+    transaction.arg = arg;
+    transaction.step = COMPASS_STEP_SELECT;
+    transaction.start = micros();
+    transaction.status = COMPASS_BUSY;
+
+#if defined(ARDUINO_ARCH_ESP32)
+    // Hand the transaction over to the worker task.
+    if (asyncTask != NULL)
+    {
+        xTaskNotifyGive(asyncTask);
+    }
+#endif
+    return COMPASS_OK;
+}
+
+/**
+ * @brief Advance the pending asynchronous read by one step.
+ * The register select and request steps block in the transport until their transfer is done, unless it uses DMA.
+ * On ESP32 with a running worker task, this only reports the state of the transaction.
+ * @return COMPASS_BUSY while the read is pending, otherwise the final status of the last read.
+ */
+CompassStatus MultiCompass::pollRead()
+{
+    if (transaction.status != COMPASS_BUSY)
+    {
+        return transaction.status;
+    }
+#if defined(ARDUINO_ARCH_ESP32)
+    if (asyncTask != NULL)
+    {
+        return COMPASS_BUSY;
+    }
+#endif
+
+    CompassStatus status = COMPASS_BUSY;
+    switch (transaction.step)
+    {
+    case COMPASS_STEP_SELECT:
+        // Set the register pointer of the sensor.
+        status = selectRegister(transaction.reg);
+        if (status == COMPASS_OK)
+        {
+            transaction.step = COMPASS_STEP_REQUEST;
+            status = COMPASS_BUSY;
+        }
+        break;
+    case COMPASS_STEP_REQUEST:
+        // Start the read, the bytes are collected by the next steps. Blocking for Wire, non-blocking for DMA.
+        transport->request(adress, transaction.length, timeout);
+        transaction.step = COMPASS_STEP_COLLECT;
+        break;
+    case COMPASS_STEP_COLLECT:
+        status = transport->collect(transaction.buffer, transaction.length, transaction.start, timeout);
+        break;
+    }
+
+    if (status != COMPASS_BUSY)
+    {
+        finishRead(status);
+    }
+    return status;
+}
+
+/**
+ * @brief Block until the pending asynchronous read is completed.
+ * @return The final status of the read.
+ */
+CompassStatus MultiCompass::waitRead()
+{
+    CompassStatus status;
+    do
+    {
+        status = pollRead();
+    } while (status == COMPASS_BUSY);
+    return status;
+}
+
+#if defined(ARDUINO_ARCH_ESP32)
+/**
+ * @brief Start a worker task which executes the asynchronous reads of this instance.
+ * @param priority The FreeRTOS priority of the task.
+ * @param core The core the task is pinned to.
+ * @return true if the task was created, false otherwise.
+ */
+bool MultiCompass::startAsyncTask(UBaseType_t priority, BaseType_t core)
+{
+    if (asyncTask != NULL)
+    {
+        return false;
+    }
+    BaseType_t result = xTaskCreatePinnedToCore(asyncTaskLoop, "MultiCompassI2C", 2048, this, priority, &asyncTask, core);
+    return result == pdPASS;
+}
+
+/**
+ * @brief Stop the worker task. A pending read is then continued by pollRead().
+ */
+void MultiCompass::stopAsyncTask()
+{
+    if (asyncTask != NULL)
+    {
+        vTaskDelete(asyncTask);
+        asyncTask = NULL;
+    }
+}
+
+/**
+ * @brief Task body of the asynchronous reads, sleeps until a read is started and executes it.
+ * @param arg A pointer to the MultiCompass instance.
+ */
+void MultiCompass::asyncTaskLoop(void *arg)
+{
+    MultiCompass *compass = (MultiCompass *)arg;
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        CompassTransaction *t = &compass->transaction;
+        compass->finishRead(compass->transfer(t->reg, t->buffer, t->length));
+    }
+}
+#endif
+
+/**
+ * @brief Complete the pending asynchronous read and notify the callback.
+ * @param status The final status of the read.
+ */
+void MultiCompass::finishRead(CompassStatus status)
+{
+    // Asynchronous reads are counted, but neither repeated nor recovered, both would block the caller.
+    countAttempt(status);
+#if !defined(MULTICOMPASS_NO_METRICS)
+    recordLatency(micros() - transaction.start, false);
+#endif
+    busCounters.transfers++;
+    if (status == COMPASS_OK)
+    {
+        busCounters.consecutiveFailures = 0;
+    }
+    else
+    {
+        busCounters.failures++;
+        if (busCounters.consecutiveFailures < 255)
+        {
+            busCounters.consecutiveFailures++;
+        }
+    }
+    lastStatus = status;
+    // Mark the read as completed first, so the callback can start the next one.
+    transaction.status = status;
+    if (transaction.callback != NULL)
+    {
+        transaction.callback(this, status, transaction.arg);
+    }
+}
+
+/**
+ * @brief Set the register pointer of the sensor.
+ * @param reg The register to select.
+ * @return The status of the transmission.
+ */
+CompassStatus MultiCompass::selectRegister(uint8_t reg)
+{
+    // Send only the first register address to read from.
+    return transport->write(adress, reg, NULL, 0, timeout);
+}
+
+/**
+ * @brief Read consecutive registers, waiting at most the configured timeout.
+ * @param reg The first register to read from.
+ * @param buffer A pointer to the buffer where the bytes will be stored.
+ * @param length The number of bytes to read.
+ * @return The status of the transfer.
+ */
+CompassStatus MultiCompass::transfer(uint8_t reg, uint8_t *buffer, uint8_t length)
+{
+    // One call per burst, the backend uses the fastest read of its platform.
+    return transport->readRegisters(adress, reg, buffer, length, timeout);
+}
+
+/**
+ * @brief Read one raw sample from the sensor. The generic compass has no sensor, so nothing is read.
+ * @param sample A pointer to a CompassRawSample object where the raw sample will be stored.
+ * @return Always false.
+ */
+bool MultiCompass::readRawSample(CompassRawSample *sample)
+{
+    (void)sample;
+    return false;
+}
+
+/**
+ * @brief Advance the sequence number atomically, as the data ready task and the caller both acquire samples.
+ * A 32 bit increment is not atomic on 8 bit targets, and on ESP32 the data ready task may run on the other core.
+ * @param advance The number of samples to advance by, 0 only reads the sequence number.
+ * @return The sequence number after the advance.
+ */
+uint32_t MultiCompass::nextSequence(uint8_t advance)
+{
+    uint32_t result;
+#if defined(ARDUINO_ARCH_ESP32)
+    portENTER_CRITICAL(&sequenceLock);
+    sequence = sequence + advance;
+    result = sequence;
+    portEXIT_CRITICAL(&sequenceLock);
+#elif defined(__AVR__)
+    // Restores the previous interrupt state, so a caller with masked interrupts keeps them masked.
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        sequence = sequence + advance;
+        result = sequence;
+    }
+#elif defined(__ARM_ARCH_PROFILE) && __ARM_ARCH_PROFILE == 'M'
+    // Saves PRIMASK instead of unconditionally enabling the interrupts again.
+    uint32_t primask;
+    __asm__ __volatile__("mrs %0, primask\n\tcpsid i" : "=r"(primask) :: "memory");
+    sequence = sequence + advance;
+    result = sequence;
+    __asm__ __volatile__("msr primask, %0" :: "r"(primask) : "memory");
+#else
+    noInterrupts();
+    sequence = sequence + advance;
+    result = sequence;
+    interrupts();
+#endif
+    return result;
+}
+
+/**
+ * @brief Read one raw sample and stamp it with the time right before the transfer and the next sequence number.
+ * @param sample A pointer to a CompassRawSample object where the raw sample will be stored.
+ * @return true if a sample was read, false otherwise.
+ */
+bool MultiCompass::acquireSample(CompassRawSample *sample)
+{
+    uint32_t timestamp = micros();
+    if (!readRawSample(sample))
+    {
+        return false;
+    }
+    sample->timestamp = timestamp;
+    sample->sequence = nextSequence();
+    return true;
+}
+
+/**
+ * @brief Attach the data ready interrupt and start collecting samples into the given buffer.
+ * @param pin The GPIO the DRDY pin of the sensor is connected to.
+ * @param buffer A pointer to the ring buffer that receives the samples, NULL to only count the edges.
+ * @param mode The interrupt edge that signals new data.
+ * @return true if the interrupt was attached, false otherwise.
+ */
+bool MultiCompass::beginDataReady(uint8_t pin, MultiCompassSampleBuffer *buffer, int mode)
+{
+    int interrupt = digitalPinToInterrupt(pin);
+    if (interrupt == NOT_AN_INTERRUPT)
+    {
+        return false;
+    }
+    endDataReady();
+
+    dataReadyEnabled = true;
+    dataReadyBuffer = buffer;
+    dataReadyPin = pin;
+    dataReadyHandled = dataReadyCount;
+    pinMode(pin, INPUT_PULLUP);
+
+#if defined(ARDUINO_ARCH_ESP32)
+    attachInterruptArg(interrupt, dataReadyHandler, this, mode);
+    return true;
+#else
+    // Search a free handler slot for this instance.
+    for (uint8_t slot = 0; slot < MULTICOMPASS_DATAREADY_SLOTS; slot++)
+    {
+        if (dataReadyInstances[slot] == NULL)
+        {
+            dataReadyInstances[slot] = this;
+            attachInterrupt(interrupt, dataReadyHandlers[slot], mode);
+            return true;
+        }
+    }
+    dataReadyEnabled = false;
+    dataReadyBuffer = NULL;
+    return false;
+#endif
+}
+
+/**
+ * @brief Detach the data ready interrupt and stop collecting samples.
+ */
+void MultiCompass::endDataReady()
+{
+    if (!dataReadyEnabled)
+    {
+        return;
+    }
+    detachInterrupt(digitalPinToInterrupt(dataReadyPin));
+
+#if defined(ARDUINO_ARCH_ESP32)
+    if (dataReadyTask != NULL)
+    {
+        vTaskDelete(dataReadyTask);
+        dataReadyTask = NULL;
+    }
+#else
+    for (uint8_t slot = 0; slot < MULTICOMPASS_DATAREADY_SLOTS; slot++)
+    {
+        if (dataReadyInstances[slot] == this)
+        {
+            dataReadyInstances[slot] = NULL;
+        }
+    }
+#endif
+    dataReadyEnabled = false;
+    dataReadyBuffer = NULL;
+}
+
+/**
+ * @brief Check whether the data ready interrupt is attached.
+ * @return true if the data ready mode is enabled, false otherwise.
+ */
+bool MultiCompass::isDataReadyEnabled()
+{
+    return dataReadyEnabled;
+}
+
+/**
+ * @brief Get the number of data ready edges, the counter wraps at 256.
+ * @return The number of edges seen by the interrupt.
+ */
+uint8_t MultiCompass::getDataReadyCount()
+{
+    return dataReadyCount;
+}
+
+#if defined(ARDUINO_ARCH_ESP32)
+/**
+ * @brief Start a task which reads the sensor whenever the data ready interrupt notifies it.
+ * @param priority The FreeRTOS priority of the task.
+ * @param core The core the task is pinned to.
+ * @return true if the task was created, false otherwise.
+ */
+bool MultiCompass::startDataReadyTask(UBaseType_t priority, BaseType_t core)
+{
+    if (dataReadyBuffer == NULL || dataReadyTask != NULL)
+    {
+        return false;
+    }
+    BaseType_t result = xTaskCreatePinnedToCore(dataReadyTaskLoop, "MultiCompassDRDY", 2048, this, priority, &dataReadyTask, core);
+    return result == pdPASS;
+}
+#endif
+
+/**
+ * @brief Interrupt handler of the data ready mode. Counts the edge and wakes the reading task if there is one.
+ */
+void MULTICOMPASS_ISR_ATTR MultiCompass::onDataReady()
+{
+    // The timestamp is written first, so a reader that sees the new count also sees its timestamp.
+    dataReadyTimestamp = micros();
+    dataReadyCount = dataReadyCount + 1;
+#if defined(ARDUINO_ARCH_ESP32)
+    if (dataReadyTask != NULL)
+    {
+        BaseType_t woken = pdFALSE;
+        vTaskNotifyGiveFromISR(dataReadyTask, &woken);
+        portYIELD_FROM_ISR(woken);
+    }
+#endif
+}
+
+/**
+ * @brief Read the sensor if the data ready interrupt fired and add the sample to the buffer.
+ * @return true if a new sample was added to the buffer, false otherwise.
+ */
+bool MultiCompass::handleDataReady()
+{
+    if (dataReadyBuffer == NULL)
+    {
+        return false;
+    }
+    // The counter is only written by the interrupt, so the difference is safe without locking.
+    // The timestamp is read again if an interrupt occurred in between, as it is not atomic on 8 bit targets.
+    uint8_t count;
+    uint32_t timestamp;
+    do
+    {
+        count = dataReadyCount;
+        timestamp = dataReadyTimestamp;
+    } while (count != dataReadyCount);
+    uint8_t pending = count - dataReadyHandled;
+    if (pending == 0)
+    {
+        return false;
+    }
+    dataReadyHandled = count;
+
+    // The sensor only holds the latest conversion, every additional edge is a lost sample.
+    // The lost samples still advance the sequence, so they show up as a gap.
+    dataReadyOverruns += pending - 1;
+    uint32_t sampleSequence = nextSequence(pending);
+
+    CompassRawSample sample;
+    if (!readRawSample(&sample))
+    {
+        // The sequence already covers this sample, so a failed read counts as lost as well.
+        dataReadyOverruns++;
+        return false;
+    }
+    sample.timestamp = timestamp;
+    sample.sequence = sampleSequence;
+    if (!dataReadyBuffer->push(sample))
+    {
+        dataReadyOverruns++;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Get the number of samples waiting in the data ready buffer.
+ * @return The number of buffered samples.
+ */
+uint8_t MultiCompass::availableSamples()
+{
+    if (dataReadyBuffer == NULL)
+    {
+        return 0;
+    }
+    return dataReadyBuffer->available();
+}
+
+/**
+ * @brief Drain samples from the data ready buffer.
+ * @param samples A pointer to an array where the samples will be stored.
+ * @param maxCount The size of the array.
+ * @return The number of samples copied to the array.
+ */
+uint8_t MultiCompass::readSamples(CompassRawSample *samples, uint8_t maxCount)
+{
+    uint8_t count = 0;
+    if (dataReadyBuffer == NULL)
+    {
+        return 0;
+    }
+    while (count < maxCount && dataReadyBuffer->pop(samples[count]))
+    {
+        count++;
+    }
+    return count;
 }
\ No newline at end of file
@@ -0,0 +1,252 @@
+/*
+ *   Copyright (c) 2023 Malte Hering
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "MultiCompassArray.h"
+
+/**
+ * @brief Create a new, empty MultiCompassArray.
+ */
+MultiCompassArray::MultiCompassArray()
+{
+    sensorCount = 0;
+    busCount = 0;
+    pendingFrame = NULL;
+    axes[0] = 0;
+    axes[1] = 0;
+    axes[2] = 1;
+#if defined(ARDUINO_ARCH_ESP32)
+    busDone = NULL;
+    nextTaskBus = 0;
+    for (uint8_t i = 0; i < MULTICOMPASS_ARRAY_BUSES; i++)
+    {
+        busTasks[i] = NULL;
+        busMasks[i] = 0;
+    }
+#endif
+}
+
+/**
+ * @brief Stop the bus tasks before the array is destroyed.
+ */
+MultiCompassArray::~MultiCompassArray()
+{
+#if defined(ARDUINO_ARCH_ESP32)
+    stopTasks();
+#endif
+}
+
+/**
+ * @brief Add a sensor to the array and assign it to the slot of its bus.
+ * @param compass A pointer to the sensor, has to stay valid while the array is used.
+ * @return true if the sensor was added, false if there is no free sensor or bus slot.
+ */
+bool MultiCompassArray::addSensor(MultiCompass *compass)
+{
+    if (compass == NULL || sensorCount >= MULTICOMPASS_ARRAY_SIZE)
+    {
+        return false;
+    }
+
+    // Search the bus of the sensor, add it if it is new.
+    const void *identity = compass->getTransport()->getBus();
+    uint8_t bus = 0;
+    while (bus < busCount && buses[bus] != identity)
+    {
+        bus++;
+    }
+    if (bus == busCount)
+    {
+        if (busCount >= MULTICOMPASS_ARRAY_BUSES)
+        {
+            return false;
+        }
+        buses[busCount++] = identity;
+    }
+
+    sensors[sensorCount] = compass;
+    sensorBus[sensorCount] = bus;
+    sensorCount++;
+    return true;
+}
+
+/**
+ * @brief Get the number of sensors in the array.
+ * @return The number of sensors.
+ */
+uint8_t MultiCompassArray::getSensorCount()
+{
+    return sensorCount;
+}
+
+/**
+ * @brief Get the number of different buses in the array.
+ * @return The number of buses.
+ */
+uint8_t MultiCompassArray::getBusCount()
+{
+    return busCount;
+}
+
+/**
+ * @brief Get a sensor of the array.
+ * @param index The index of the sensor, in the order the sensors were added.
+ * @return A pointer to the sensor, NULL if the index is invalid.
+ */
+MultiCompass *MultiCompassArray::getSensor(uint8_t index)
+{
+    if (index >= sensorCount)
+    {
+        return NULL;
+    }
+    return sensors[index];
+}
+
+/**
+ * @brief Read all sensors into one frame, in parallel if the bus tasks are running.
+ * @param frame A pointer to a MultiCompassFrame struct where the readings will be stored.
+ * @param x The X axis of the sensors.
+ * @param y The Y axis of the sensors.
+ * @param z The Z axis of the sensors.
+ * @return true if all sensors were read, false otherwise.
+ */
+bool MultiCompassArray::readFrame(MultiCompassFrame *frame, int x, int y, int z)
+{
+    frame->timestamp = micros();
+    frame->count = sensorCount;
+    frame->validMask = 0;
+    axes[0] = x;
+    axes[1] = y;
+    axes[2] = z;
+    pendingFrame = frame;
+
+#if defined(ARDUINO_ARCH_ESP32)
+    if (busDone != NULL)
+    {
+        // Wake all bus tasks and wait until each of them has read its bus.
+        // Every transfer is bounded by the timeout of its sensor, so this wait is bounded as well.
+        for (uint8_t bus = 0; bus < busCount; bus++)
+        {
+            xTaskNotifyGive(busTasks[bus]);
+        }
+        for (uint8_t bus = 0; bus < busCount; bus++)
+        {
+            xSemaphoreTake(busDone, portMAX_DELAY);
+        }
+        for (uint8_t bus = 0; bus < busCount; bus++)
+        {
+            frame->validMask |= busMasks[bus];
+        }
+        pendingFrame = NULL;
+        return frame->validMask == ((1UL << sensorCount) - 1);
+    }
+#endif
+
+    for (uint8_t bus = 0; bus < busCount; bus++)
+    {
+        frame->validMask |= readBus(bus);
+    }
+    pendingFrame = NULL;
+    return frame->validMask == ((1UL << sensorCount) - 1);
+}
+
+/**
+ * @brief Read all sensors of one bus into the pending frame.
+ * @param bus The index of the bus.
+ * @return A bit mask of the sensors that were read successfully.
+ */
+uint32_t MultiCompassArray::readBus(uint8_t bus)
+{
+    uint32_t mask = 0;
+    for (uint8_t i = 0; i < sensorCount; i++)
+    {
+        // The full chain runs in the task of the bus, so the scaling and filtering are parallel as well.
+        if (sensorBus[i] == bus && sensors[i]->update(&pendingFrame->data[i], axes[0], axes[1], axes[2]))
+        {
+            mask |= 1UL << i;
+        }
+    }
+    return mask;
+}
+
+#if defined(ARDUINO_ARCH_ESP32)
+/**
+ * @brief Start one task per bus, alternating between both cores.
+ * @param priority The FreeRTOS priority of the tasks.
+ * @return true if all tasks were created, false otherwise.
+ */
+bool MultiCompassArray::startTasks(UBaseType_t priority)
+{
+    if (busDone != NULL)
+    {
+        return false;
+    }
+    busDone = xSemaphoreCreateCounting(MULTICOMPASS_ARRAY_BUSES, 0);
+    if (busDone == NULL)
+    {
+        return false;
+    }
+    for (uint8_t bus = 0; bus < busCount; bus++)
+    {
+        // The task takes its bus index from nextTaskBus and acknowledges it through busDone.
+        nextTaskBus = bus;
+        if (xTaskCreatePinnedToCore(busTaskLoop, "MultiCompassBus", 2048, this, priority, &busTasks[bus], bus % 2) != pdPASS)
+        {
+            stopTasks();
+            return false;
+        }
+        xSemaphoreTake(busDone, portMAX_DELAY);
+    }
+    return true;
+}
+
+/**
+ * @brief Stop the bus tasks.
+ */
+void MultiCompassArray::stopTasks()
+{
+    for (uint8_t bus = 0; bus < MULTICOMPASS_ARRAY_BUSES; bus++)
+    {
+        if (busTasks[bus] != NULL)
+        {
+            vTaskDelete(busTasks[bus]);
+            busTasks[bus] = NULL;
+        }
+    }
+    if (busDone != NULL)
+    {
+        vSemaphoreDelete(busDone);
+        busDone = NULL;
+    }
+}
+
+/**
+ * @brief Task body of a bus task, reads its bus whenever readFrame() notifies it.
+ * @param arg A pointer to the MultiCompassArray instance.
+ */
+void MultiCompassArray::busTaskLoop(void *arg)
+{
+    MultiCompassArray *array = (MultiCompassArray *)arg;
+    uint8_t bus = array->nextTaskBus;
+    xSemaphoreGive(array->busDone);
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        array->busMasks[bus] = array->readBus(bus);
+        xSemaphoreGive(array->busDone);
+    }
+}
+#endif
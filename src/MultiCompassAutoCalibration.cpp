@@ -0,0 +1,366 @@
+/*
+ *   Copyright (c) 2023 Malte Hering
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#if !defined(MULTICOMPASS_NO_FLOAT)
+
+#include "MultiCompassAutoCalibration.h"
+#include <math.h>
+
+#define AUTOCAL_STRIDE (MULTICOMPASS_AUTOCAL_WINDOW / MULTICOMPASS_AUTOCAL_EVAL) ///< Distance of the kept samples in the window
+
+/**
+ * @brief Create a new MultiCompassAutoCalibration for a sensor.
+ * @param compass A pointer to the sensor whose calibration is refined.
+ */
+MultiCompassAutoCalibration::MultiCompassAutoCalibration(MultiCompass *compass)
+{
+    this->compass = compass;
+    decimation = MULTICOMPASS_AUTOCAL_DECIMATION;
+    skipped = 0;
+    dropped = 0;
+    reset();
+}
+
+/**
+ * @brief Drop the current window, the previous calibration and the status.
+ */
+void MultiCompassAutoCalibration::reset()
+{
+    CompassCalibrationSample sample;
+    while (queue.pop(sample))
+    {
+    }
+    fit.reset();
+    windowCount = 0;
+    hasPrevious = false;
+    // The calibration the auto calibration starts from is the first rollback target.
+    currentGood = true;
+    lastCandidate.valid = false;
+    status = {};
+    status.fitError = -1;
+    status.offsetChange = -1;
+    dropped = 0;
+}
+
+/**
+ * @brief Set how many offered samples are skipped between two queued ones.
+ * @param decimation Every n-th sample enters the queue, at least 1.
+ */
+void MultiCompassAutoCalibration::setDecimation(uint8_t decimation)
+{
+    this->decimation = decimation > 0 ? decimation : 1;
+}
+
+/**
+ * @brief Offer an acquired sample. This runs in the sampling path, so it never waits for the worker.
+ * @param data A pointer to a CompassData object containing the raw sensor data.
+ */
+void MultiCompassAutoCalibration::addSample(const CompassData *data)
+{
+    // Saturated and disturbed samples would pull the fit away from the field of the platform.
+    if (data->flags & (COMPASS_FLAG_OVERFLOW | COMPASS_FLAG_RANGE_CHANGED | COMPASS_FLAG_ANOMALY))
+    {
+        return;
+    }
+    if (++skipped < decimation)
+    {
+        return;
+    }
+    skipped = 0;
+
+    // Convert to the raw units of the calibration while the field range of the sample is known.
+    CompassCalibrationSample sample = {data->rawX * compass->getRawScale(0),
+                                       data->rawY * compass->getRawScale(1),
+                                       data->rawZ * compass->getRawScale(2)};
+    if (!queue.push(sample))
+    {
+        dropped++;
+    }
+}
+
+/**
+ * @brief Drain the queue into the fit and evaluate the candidate once the window is complete.
+ * @return true if a calibration was published, false otherwise.
+ */
+bool MultiCompassAutoCalibration::process()
+{
+    bool published = false;
+    CompassCalibrationSample sample;
+    while (queue.pop(sample))
+    {
+        // Hold out samples spread over the whole window, the last ones alone may cover only a small part of the sphere.
+        // The fit never sees them, so they score the candidate as fairly as the published calibration.
+        if (windowCount % AUTOCAL_STRIDE == 0 && windowCount / AUTOCAL_STRIDE < MULTICOMPASS_AUTOCAL_EVAL)
+        {
+            kept[windowCount / AUTOCAL_STRIDE] = sample;
+        }
+        else
+        {
+            fit.addSample(sample.x, sample.y, sample.z);
+        }
+        windowCount++;
+        status.samples++;
+        if (windowCount >= MULTICOMPASS_AUTOCAL_WINDOW)
+        {
+            published |= finishWindow();
+        }
+    }
+    status.dropped = dropped;
+    return published;
+}
+
+/**
+ * @brief Solve the fit of the completed window, publish the best calibration and start the next window.
+ * @return true if a calibration was published, false otherwise.
+ */
+bool MultiCompassAutoCalibration::finishWindow()
+{
+    status.fits++;
+
+    // The published calibration is the reference, a min/max calibration is compared as a diagonal matrix.
+    const CompassCalibrationState &state = compass->acquireCalibration();
+    CompassSoftIron current;
+    if (state.softIron.valid)
+    {
+        current = state.softIron;
+    }
+    else
+    {
+        fromSettings(&state.settings, &current);
+    }
+    float residual = evaluate(&current);
+    bool published = false;
+
+    CompassSoftIron candidate;
+    bool solved = fit.getSoftIron(&candidate);
+    status.fitError = solved ? fit.getFitError() : -1;
+    if (solved && status.fitError <= MULTICOMPASS_AUTOCAL_MAX_ERROR)
+    {
+        // The offset change of two independent windows shows whether the fits agree, scaled onto the unit sphere.
+        if (lastCandidate.valid)
+        {
+            float change = 0;
+            for (uint8_t row = 0; row < 3; row++)
+            {
+                float value = 0;
+                for (uint8_t column = 0; column < 3; column++)
+                {
+                    value += candidate.matrix[row * 3 + column] * (candidate.offset[column] - lastCandidate.offset[column]);
+                }
+                change += value * value;
+            }
+            status.offsetChange = sqrtf(change);
+        }
+        lastCandidate = candidate;
+
+        float candidateResidual = evaluate(&candidate);
+        if (candidateResidual < residual * MULTICOMPASS_AUTOCAL_MARGIN)
+        {
+            publish(&candidate);
+            residual = candidateResidual;
+            status.published++;
+            published = true;
+        }
+        else
+        {
+            status.rejected++;
+        }
+    }
+    else
+    {
+        status.rejected++;
+    }
+
+    // A published fit that matches the field worse than the last known-good calibration is undone.
+    if (!published && hasPrevious)
+    {
+        CompassSoftIron replaced = previous;
+        if (!replaced.valid)
+        {
+            fromSettings(&state.settings, &replaced);
+        }
+        float previousResidual = evaluate(&replaced);
+        if (previousResidual < residual * MULTICOMPASS_AUTOCAL_MARGIN)
+        {
+            rollback();
+            residual = previousResidual;
+            status.rollbacks++;
+            published = true;
+        }
+    }
+    if (!published)
+    {
+        // The calibration held for a whole window, so it becomes the rollback target of the next publish.
+        currentGood = true;
+    }
+
+    status.residual = residual;
+    status.converged = residual < MULTICOMPASS_AUTOCAL_RESIDUAL && status.offsetChange >= 0 &&
+                       status.offsetChange < MULTICOMPASS_AUTOCAL_SETTLED;
+
+    // Every window is fitted on its own, so the calibration follows a changed environment.
+    fit.reset();
+    windowCount = 0;
+    return published;
+}
+
+/**
+ * @brief Publish the last known-good calibration again.
+ * @return true if a known-good calibration existed, false otherwise.
+ */
+bool MultiCompassAutoCalibration::rollback()
+{
+    if (!hasPrevious)
+    {
+        return false;
+    }
+    // previous stays the target, so repeated rollbacks do not toggle between the last two calibrations.
+    apply(&previous);
+    currentGood = true;
+    return true;
+}
+
+/**
+ * @brief Get the convergence metrics.
+ * @return A reference to the status.
+ */
+const CompassAutoCalibrationStatus &MultiCompassAutoCalibration::getStatus()
+{
+    return status;
+}
+
+/**
+ * @brief Calculate the RMS deviation of the calibrated field norm from 1 on the kept samples.
+ * @param calibration The calibration to evaluate.
+ * @return The residual.
+ */
+float MultiCompassAutoCalibration::evaluate(const CompassSoftIron *calibration)
+{
+    const float *m = calibration->matrix;
+    float sum = 0;
+    for (uint8_t i = 0; i < MULTICOMPASS_AUTOCAL_EVAL; i++)
+    {
+        float x = kept[i].x - calibration->offset[0];
+        float y = kept[i].y - calibration->offset[1];
+        float z = kept[i].z - calibration->offset[2];
+        float scaledX = m[0] * x + m[1] * y + m[2] * z;
+        float scaledY = m[3] * x + m[4] * y + m[5] * z;
+        float scaledZ = m[6] * x + m[7] * y + m[8] * z;
+        float error = sqrtf(scaledX * scaledX + scaledY * scaledY + scaledZ * scaledZ) - 1;
+        sum += error * error;
+    }
+    return sqrtf(sum / MULTICOMPASS_AUTOCAL_EVAL);
+}
+
+/**
+ * @brief Express the min/max calibration of the settings as a diagonal soft iron calibration.
+ * @param settings The min/max calibration.
+ * @param calibration A pointer to the soft iron calibration where the result will be stored.
+ */
+void MultiCompassAutoCalibration::fromSettings(const CompassSetting *settings, CompassSoftIron *calibration)
+{
+    const CompassRawValue minimum[3] = {settings->minX, settings->minY, settings->minZ};
+    const CompassRawValue maximum[3] = {settings->maxX, settings->maxY, settings->maxZ};
+    for (uint8_t i = 0; i < 9; i++)
+    {
+        calibration->matrix[i] = 0;
+    }
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        // The same scaling as the coefficients of the min/max calibration.
+        float halfRange = fabsf(maximum[i] - minimum[i]) / 2;
+        calibration->offset[i] = (maximum[i] + minimum[i]) / 2.0f;
+        calibration->matrix[i * 4] = halfRange > 0 ? 1 / halfRange : 0;
+    }
+    calibration->valid = false;
+}
+
+/**
+ * @brief Publish a candidate and keep the replaced calibration if it was known to be good.
+ * @param calibration The calibration to publish.
+ */
+void MultiCompassAutoCalibration::publish(const CompassSoftIron *calibration)
+{
+    if (currentGood)
+    {
+        // An unconfirmed candidate that is replaced right away never becomes the rollback target.
+        previous = compass->getSoftIronCalibration();
+        hasPrevious = true;
+    }
+    apply(calibration);
+    currentGood = false;
+}
+
+/**
+ * @brief Publish a calibration to the sensor.
+ * @param calibration The calibration to publish, an invalid one switches back to the min/max calibration.
+ */
+void MultiCompassAutoCalibration::apply(const CompassSoftIron *calibration)
+{
+    CompassCalibrationState *state = compass->editCalibration();
+    state->softIron = *calibration;
+    compass->publishCalibration();
+    // Another calibration maps the field to another norm.
+    compass->resetFieldBaseline();
+}
+
+#if defined(ARDUINO_ARCH_ESP32)
+/**
+ * @brief Start a low priority worker task which runs process().
+ * @param priority The FreeRTOS priority of the task.
+ * @param core The core the task is pinned to.
+ * @return true if the task was created, false otherwise.
+ */
+bool MultiCompassAutoCalibration::startTask(UBaseType_t priority, BaseType_t core)
+{
+    if (task != NULL)
+    {
+        return false;
+    }
+    // The fit solves a 9x9 system on the stack.
+    BaseType_t result = xTaskCreatePinnedToCore(taskLoop, "MultiCompassCal", 4096, this, priority, &task, core);
+    return result == pdPASS;
+}
+
+/**
+ * @brief Stop the worker task.
+ */
+void MultiCompassAutoCalibration::stopTask()
+{
+    if (task != NULL)
+    {
+        vTaskDelete(task);
+        task = NULL;
+    }
+}
+
+/**
+ * @brief Task body of the worker, runs process() every MULTICOMPASS_AUTOCAL_PERIOD milliseconds.
+ * @param arg A pointer to the MultiCompassAutoCalibration instance.
+ */
+void MultiCompassAutoCalibration::taskLoop(void *arg)
+{
+    MultiCompassAutoCalibration *calibration = (MultiCompassAutoCalibration *)arg;
+    for (;;)
+    {
+        calibration->process();
+        vTaskDelay(pdMS_TO_TICKS(MULTICOMPASS_AUTOCAL_PERIOD));
+    }
+}
+#endif
+
+#endif
@@ -0,0 +1,314 @@
+/*
+ *   Copyright (c) 2023 Malte Hering
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "MultiCompassBitBangTransport.h"
+
+MultiCompassBitBangTransport *MultiCompassBitBangTransport::first = NULL;
+
+// Pull a line low.
+static inline void lineLow(uint8_t pin)
+{
+    digitalWrite(pin, LOW);
+    pinMode(pin, OUTPUT);
+}
+
+// Release a line, the pull-ups take it high.
+static inline void lineRelease(uint8_t pin)
+{
+    pinMode(pin, INPUT_PULLUP);
+}
+
+/**
+ * @brief Create a software I2C master and release both lines.
+ * @param sda The GPIO of SDA.
+ * @param scl The GPIO of SCL.
+ * @param halfPeriod The half clock period in microseconds.
+ */
+MultiCompassBitBangTransport::MultiCompassBitBangTransport(uint8_t sda, uint8_t scl, uint8_t halfPeriod)
+{
+    this->sda = sda;
+    this->scl = scl;
+    this->halfPeriod = halfPeriod;
+    lineRelease(sda);
+    lineRelease(scl);
+    // Append, so the oldest transport of a line stays the identity of its bus.
+    next = NULL;
+    MultiCompassBitBangTransport **link = &first;
+    while (*link != NULL)
+    {
+        link = &(*link)->next;
+    }
+    *link = this;
+}
+
+/**
+ * @brief Remove the transport from the list of all bit-bang transports.
+ */
+MultiCompassBitBangTransport::~MultiCompassBitBangTransport()
+{
+    MultiCompassBitBangTransport **link = &first;
+    while (*link != NULL && *link != this)
+    {
+        link = &(*link)->next;
+    }
+    if (*link == this)
+    {
+        *link = next;
+    }
+}
+
+/**
+ * @brief Get the identity of the bus, the oldest transport that shares SDA or SCL with this one.
+ * @return A pointer to that transport.
+ */
+const void *MultiCompassBitBangTransport::getBus()
+{
+    for (MultiCompassBitBangTransport *other = first; other != NULL; other = other->next)
+    {
+        if (other->sda == sda || other->scl == scl || other->sda == scl || other->scl == sda)
+        {
+            return other;
+        }
+    }
+    return this;
+}
+
+/**
+ * @brief Write the register pointer and a block of data in one transaction.
+ * @param address The I2C address of the sensor.
+ * @param reg The first register.
+ * @param buffer A pointer to the data.
+ * @param length The number of data bytes.
+ * @param timeout Unused, the transfer is clocked by this master and only waits for clock stretching.
+ * @return The status of the transaction.
+ */
+CompassStatus MultiCompassBitBangTransport::write(uint8_t address, uint8_t reg, const uint8_t *buffer, uint8_t length, uint32_t timeout)
+{
+    (void)timeout;
+    CompassStatus status = start();
+    if (status == COMPASS_OK)
+    {
+        status = writeByte(address << 1);
+    }
+    if (status == COMPASS_OK)
+    {
+        status = writeByte(reg);
+    }
+    for (uint8_t i = 0; i < length && status == COMPASS_OK; i++)
+    {
+        status = writeByte(buffer[i]);
+    }
+    stop();
+    return status;
+}
+
+/**
+ * @brief Read bytes from the current register pointer into the receive buffer.
+ * A failed read leaves the buffer empty, so the caller runs into its timeout.
+ * @param address The I2C address of the sensor.
+ * @param length The number of bytes.
+ * @param timeout Unused, the transfer is clocked by this master and only waits for clock stretching.
+ */
+void MultiCompassBitBangTransport::request(uint8_t address, uint8_t length, uint32_t timeout)
+{
+    (void)timeout;
+    length = min(length, (uint8_t)MULTICOMPASS_TRANSPORT_BUFFER);
+    rxIndex = 0;
+    rxLength = receive(address, rxBuffer, length) == COMPASS_OK ? length : 0;
+}
+
+/**
+ * @brief Read consecutive registers in one transaction with a repeated start.
+ * @param address The I2C address of the sensor.
+ * @param reg The first register.
+ * @param buffer A pointer to the buffer where the bytes will be stored.
+ * @param length The number of bytes.
+ * @param timeout Unused, the transfer is clocked by this master and only waits for clock stretching.
+ * @return The status of the transfer.
+ */
+CompassStatus MultiCompassBitBangTransport::readRegisters(uint8_t address, uint8_t reg, uint8_t *buffer, uint8_t length, uint32_t timeout)
+{
+    (void)timeout;
+    CompassStatus status = start();
+    if (status == COMPASS_OK)
+    {
+        status = writeByte(address << 1);
+    }
+    if (status == COMPASS_OK)
+    {
+        status = writeByte(reg);
+    }
+    if (status != COMPASS_OK)
+    {
+        stop();
+        return status;
+    }
+    return receive(address, buffer, length);
+}
+
+/**
+ * @brief Send the address of a read, clock in a block of bytes and end with a STOP condition.
+ * @param address The I2C address of the sensor.
+ * @param buffer A pointer to the buffer where the bytes will be stored.
+ * @param length The number of bytes.
+ * @return The status of the transaction.
+ */
+CompassStatus MultiCompassBitBangTransport::receive(uint8_t address, uint8_t *buffer, uint8_t length)
+{
+    CompassStatus status = start();
+    if (status == COMPASS_OK)
+    {
+        status = writeByte((address << 1) | 1);
+    }
+    for (uint8_t i = 0; i < length && status == COMPASS_OK; i++)
+    {
+        // The last byte is not acknowledged, which tells the sensor to release SDA.
+        status = readByte(&buffer[i], i + 1 < length);
+    }
+    stop();
+    return status;
+}
+
+/**
+ * @brief Send a START condition: SDA falls while SCL is high.
+ * @return COMPASS_OK, or COMPASS_ERROR_BUS if SDA is held low by another device.
+ */
+CompassStatus MultiCompassBitBangTransport::start()
+{
+    lineRelease(sda);
+    delayMicroseconds(halfPeriod);
+    if (!releaseClock())
+    {
+        return COMPASS_ERROR_TIMEOUT;
+    }
+    if (digitalRead(sda) == LOW)
+    {
+        return COMPASS_ERROR_BUS;
+    }
+    lineLow(sda);
+    delayMicroseconds(halfPeriod);
+    lineLow(scl);
+    return COMPASS_OK;
+}
+
+/**
+ * @brief Send a STOP condition: SDA rises while SCL is high.
+ */
+void MultiCompassBitBangTransport::stop()
+{
+    lineLow(sda);
+    delayMicroseconds(halfPeriod);
+    releaseClock();
+    delayMicroseconds(halfPeriod);
+    lineRelease(sda);
+    delayMicroseconds(halfPeriod);
+}
+
+/**
+ * @brief Release SCL and wait while the sensor stretches the clock.
+ * @return true if SCL went high, false after MULTICOMPASS_BITBANG_STRETCH microseconds.
+ */
+bool MultiCompassBitBangTransport::releaseClock()
+{
+    lineRelease(scl);
+    unsigned long start = micros();
+    while (digitalRead(scl) == LOW)
+    {
+        if (micros() - start > MULTICOMPASS_BITBANG_STRETCH)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Clock out one byte, most significant bit first, and read the acknowledge bit.
+ * @param value The byte.
+ * @return COMPASS_OK if it was acknowledged, COMPASS_ERROR_NACK or COMPASS_ERROR_TIMEOUT otherwise.
+ */
+CompassStatus MultiCompassBitBangTransport::writeByte(uint8_t value)
+{
+    for (uint8_t bit = 0x80; bit != 0; bit >>= 1)
+    {
+        if (value & bit)
+        {
+            lineRelease(sda);
+        }
+        else
+        {
+            lineLow(sda);
+        }
+        delayMicroseconds(halfPeriod);
+        if (!releaseClock())
+        {
+            return COMPASS_ERROR_TIMEOUT;
+        }
+        delayMicroseconds(halfPeriod);
+        lineLow(scl);
+    }
+
+    // The sensor pulls SDA low during the ninth clock to acknowledge.
+    lineRelease(sda);
+    delayMicroseconds(halfPeriod);
+    if (!releaseClock())
+    {
+        return COMPASS_ERROR_TIMEOUT;
+    }
+    bool acknowledged = digitalRead(sda) == LOW;
+    delayMicroseconds(halfPeriod);
+    lineLow(scl);
+    return acknowledged ? COMPASS_OK : COMPASS_ERROR_NACK;
+}
+
+/**
+ * @brief Clock in one byte, most significant bit first, and answer with an acknowledge bit.
+ * @param value A pointer to the byte.
+ * @param acknowledge true to request another byte, false after the last one.
+ * @return COMPASS_OK, or COMPASS_ERROR_TIMEOUT if the clock stayed low.
+ */
+CompassStatus MultiCompassBitBangTransport::readByte(uint8_t *value, bool acknowledge)
+{
+    uint8_t result = 0;
+    lineRelease(sda);
+    for (uint8_t i = 0; i < 8; i++)
+    {
+        delayMicroseconds(halfPeriod);
+        if (!releaseClock())
+        {
+            return COMPASS_ERROR_TIMEOUT;
+        }
+        result = (result << 1) | (digitalRead(sda) == HIGH ? 1 : 0);
+        delayMicroseconds(halfPeriod);
+        lineLow(scl);
+    }
+
+    if (acknowledge)
+    {
+        lineLow(sda);
+    }
+    delayMicroseconds(halfPeriod);
+    if (!releaseClock())
+    {
+        return COMPASS_ERROR_TIMEOUT;
+    }
+    delayMicroseconds(halfPeriod);
+    lineLow(scl);
+    lineRelease(sda);
+    *value = result;
+    return COMPASS_OK;
+}
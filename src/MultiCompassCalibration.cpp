@@ -0,0 +1,352 @@
+/*
+ *   Copyright (c) 2023 Malte Hering
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#if !defined(MULTICOMPASS_NO_FLOAT)
+
+#include "MultiCompassCalibration.h"
+#include <math.h>
+
+/**
+ * @brief Index of element (row, column) with column <= row in a packed lower triangle.
+ */
+#define PACKED_INDEX(row, column) ((row) * ((row) + 1) / 2 + (column))
+
+/**
+ * @brief Create a new, empty MultiCompassCalibration.
+ */
+MultiCompassCalibration::MultiCompassCalibration()
+{
+    reset();
+}
+
+/**
+ * @brief Drop all accumulated samples and the last result.
+ */
+void MultiCompassCalibration::reset()
+{
+    for (uint8_t i = 0; i < MULTICOMPASS_CALIBRATION_PACKED; i++)
+    {
+        sums[i] = 0;
+    }
+    for (uint8_t i = 0; i < MULTICOMPASS_CALIBRATION_TERMS; i++)
+    {
+        vector[i] = 0;
+    }
+    count = 0;
+    solved = false;
+    fitError = -1;
+    result.valid = false;
+}
+
+/**
+ * @brief Add a raw sample to the sums of the fit.
+ * @param x The raw X axis of the sensor.
+ * @param y The raw Y axis of the sensor.
+ * @param z The raw Z axis of the sensor.
+ */
+void MultiCompassCalibration::addSample(float x, float y, float z)
+{
+    // Normalize the sample, so the squared terms and the linear terms have a similar magnitude.
+    x *= 1 / MULTICOMPASS_CALIBRATION_NORM;
+    y *= 1 / MULTICOMPASS_CALIBRATION_NORM;
+    z *= 1 / MULTICOMPASS_CALIBRATION_NORM;
+    const float phi[MULTICOMPASS_CALIBRATION_TERMS] = {x * x, y * y, z * z, 2 * x * y, 2 * x * z, 2 * y * z, 2 * x, 2 * y, 2 * z};
+
+    uint8_t index = 0;
+    for (uint8_t row = 0; row < MULTICOMPASS_CALIBRATION_TERMS; row++)
+    {
+        for (uint8_t column = 0; column <= row; column++)
+        {
+            sums[index++] += phi[row] * phi[column];
+        }
+        vector[row] += phi[row];
+    }
+    count++;
+    solved = false;
+}
+
+/**
+ * @brief Add the raw values of a sample to the sums of the fit.
+ * @param data A pointer to a CompassData object containing the raw sensor data.
+ */
+void MultiCompassCalibration::addSample(const CompassData *data)
+{
+    addSample(data->rawX, data->rawY, data->rawZ);
+}
+
+/**
+ * @brief Get the number of accumulated samples.
+ * @return The number of samples.
+ */
+uint32_t MultiCompassCalibration::getSampleCount()
+{
+    return count;
+}
+
+/**
+ * @brief Solve the fit and derive offset and soft iron matrix, unless the result is still up to date.
+ * @return true if the samples describe a valid ellipsoid, false otherwise.
+ */
+bool MultiCompassCalibration::solve()
+{
+    if (solved)
+    {
+        return result.valid;
+    }
+    solved = true;
+    result.valid = false;
+    fitError = -1;
+    if (count < MULTICOMPASS_CALIBRATION_TERMS)
+    {
+        return false;
+    }
+
+    // Solve the normal equations on a copy, so more samples can be added afterwards.
+    float matrix[MULTICOMPASS_CALIBRATION_PACKED];
+    float p[MULTICOMPASS_CALIBRATION_TERMS];
+    for (uint8_t i = 0; i < MULTICOMPASS_CALIBRATION_PACKED; i++)
+    {
+        matrix[i] = sums[i];
+    }
+    for (uint8_t i = 0; i < MULTICOMPASS_CALIBRATION_TERMS; i++)
+    {
+        p[i] = vector[i];
+    }
+    if (!solveCholesky(matrix, p))
+    {
+        return false;
+    }
+
+    // With S p = b the sum of the squared errors p^T S p - 2 p^T b + n reduces to n - p^T b.
+    float error = count;
+    for (uint8_t i = 0; i < MULTICOMPASS_CALIBRATION_TERMS; i++)
+    {
+        error -= p[i] * vector[i];
+    }
+
+    // x^T A x + 2 g^T x = 1 is an ellipsoid around c = -A^-1 g with (x - c)^T A (x - c) = 1 + c^T A c.
+    const float a[9] = {p[0], p[3], p[4],
+                        p[3], p[1], p[5],
+                        p[4], p[5], p[2]};
+    float cofactor[9] = {a[4] * a[8] - a[5] * a[7], a[2] * a[7] - a[1] * a[8], a[1] * a[5] - a[2] * a[4],
+                         a[5] * a[6] - a[3] * a[8], a[0] * a[8] - a[2] * a[6], a[2] * a[3] - a[0] * a[5],
+                         a[3] * a[7] - a[4] * a[6], a[1] * a[6] - a[0] * a[7], a[0] * a[4] - a[1] * a[3]};
+    float determinant = a[0] * cofactor[0] + a[1] * cofactor[3] + a[2] * cofactor[6];
+    if (!(determinant > 0))
+    {
+        return false;
+    }
+    float center[3];
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        center[i] = -(cofactor[i * 3] * p[6] + cofactor[i * 3 + 1] * p[7] + cofactor[i * 3 + 2] * p[8]) / determinant;
+    }
+    float radius = 1;
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        for (uint8_t j = 0; j < 3; j++)
+        {
+            radius += center[i] * a[i * 3 + j] * center[j];
+        }
+    }
+    if (!(radius > 0))
+    {
+        return false;
+    }
+
+    // The symmetric square root of A / (1 + c^T A c) maps the ellipsoid onto the unit sphere.
+    float soft[9];
+    for (uint8_t i = 0; i < 9; i++)
+    {
+        soft[i] = a[i] / radius;
+    }
+    if (!squareRoot(soft))
+    {
+        return false;
+    }
+
+    // Convert back from normalized to raw units.
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        result.offset[i] = center[i] * MULTICOMPASS_CALIBRATION_NORM;
+    }
+    for (uint8_t i = 0; i < 9; i++)
+    {
+        result.matrix[i] = soft[i] * (1 / MULTICOMPASS_CALIBRATION_NORM);
+    }
+    result.valid = true;
+    fitError = sqrtf((error > 0 ? error : 0) / count);
+    return true;
+}
+
+/**
+ * @brief Get the calibration of the last solution, solve the fit first if necessary.
+ * @param result A pointer to a CompassSoftIron object where the calibration will be stored.
+ * @return true if the result is valid, false otherwise.
+ */
+bool MultiCompassCalibration::getSoftIron(CompassSoftIron *result)
+{
+    if (!solve())
+    {
+        return false;
+    }
+    *result = this->result;
+    return true;
+}
+
+/**
+ * @brief Get the root mean square error of the last solution.
+ * @return The error, negative if there is no valid solution.
+ */
+float MultiCompassCalibration::getFitError()
+{
+    solve();
+    return fitError;
+}
+
+/**
+ * @brief Solve a packed symmetric positive definite system in place.
+ * @param matrix The packed lower triangle of the system, overwritten with the Cholesky factor.
+ * @param vector The right side, overwritten with the solution.
+ * @return true if the system is positive definite, false otherwise.
+ */
+bool MultiCompassCalibration::solveCholesky(float *matrix, float *vector)
+{
+    const uint8_t n = MULTICOMPASS_CALIBRATION_TERMS;
+
+    // Decompose column by column, L L^T = S.
+    for (uint8_t j = 0; j < n; j++)
+    {
+        float diagonal = matrix[PACKED_INDEX(j, j)];
+        for (uint8_t k = 0; k < j; k++)
+        {
+            diagonal -= matrix[PACKED_INDEX(j, k)] * matrix[PACKED_INDEX(j, k)];
+        }
+        // A pivot that vanished relative to its row means the samples do not span all orientations.
+        if (!(diagonal > matrix[PACKED_INDEX(j, j)] * 1e-7f))
+        {
+            return false;
+        }
+        diagonal = sqrtf(diagonal);
+        matrix[PACKED_INDEX(j, j)] = diagonal;
+        for (uint8_t i = j + 1; i < n; i++)
+        {
+            float value = matrix[PACKED_INDEX(i, j)];
+            for (uint8_t k = 0; k < j; k++)
+            {
+                value -= matrix[PACKED_INDEX(i, k)] * matrix[PACKED_INDEX(j, k)];
+            }
+            matrix[PACKED_INDEX(i, j)] = value / diagonal;
+        }
+    }
+
+    // Forward substitution with L, then backward substitution with L^T.
+    for (uint8_t i = 0; i < n; i++)
+    {
+        float value = vector[i];
+        for (uint8_t k = 0; k < i; k++)
+        {
+            value -= matrix[PACKED_INDEX(i, k)] * vector[k];
+        }
+        vector[i] = value / matrix[PACKED_INDEX(i, i)];
+    }
+    for (int8_t i = n - 1; i >= 0; i--)
+    {
+        float value = vector[i];
+        for (uint8_t k = i + 1; k < n; k++)
+        {
+            value -= matrix[PACKED_INDEX(k, i)] * vector[k];
+        }
+        vector[i] = value / matrix[PACKED_INDEX(i, i)];
+    }
+    return true;
+}
+
+/**
+ * @brief Replace a symmetric 3x3 matrix with its symmetric square root V sqrt(D) V^T.
+ * @param matrix The row major matrix, overwritten with its square root.
+ * @return true if the matrix is positive definite, false otherwise.
+ */
+bool MultiCompassCalibration::squareRoot(float *matrix)
+{
+    float v[9] = {1, 0, 0, 0, 1, 0, 0, 0, 1};
+
+    // Cyclic Jacobi sweeps, a 3x3 matrix is diagonal after a few of them.
+    for (uint8_t sweep = 0; sweep < 16; sweep++)
+    {
+        float offDiagonal = fabsf(matrix[1]) + fabsf(matrix[2]) + fabsf(matrix[5]);
+        if (offDiagonal <= 1e-9f * (fabsf(matrix[0]) + fabsf(matrix[4]) + fabsf(matrix[8])))
+        {
+            break;
+        }
+        for (uint8_t pair = 0; pair < 3; pair++)
+        {
+            const uint8_t p = pair == 2 ? 1 : 0;
+            const uint8_t q = pair == 0 ? 1 : 2;
+            const uint8_t r = 3 - p - q;
+            float apq = matrix[p * 3 + q];
+            if (apq == 0)
+            {
+                continue;
+            }
+            float theta = (matrix[q * 3 + q] - matrix[p * 3 + p]) / (2 * apq);
+            float t = 1 / (fabsf(theta) + sqrtf(theta * theta + 1));
+            if (theta < 0)
+            {
+                t = -t;
+            }
+            float c = 1 / sqrtf(t * t + 1);
+            float s = t * c;
+
+            // Rotate the pair (p, q) so its off diagonal element vanishes.
+            float arp = matrix[r * 3 + p];
+            float arq = matrix[r * 3 + q];
+            matrix[p * 3 + p] -= t * apq;
+            matrix[q * 3 + q] += t * apq;
+            matrix[p * 3 + q] = matrix[q * 3 + p] = 0;
+            matrix[r * 3 + p] = matrix[p * 3 + r] = c * arp - s * arq;
+            matrix[r * 3 + q] = matrix[q * 3 + r] = s * arp + c * arq;
+            for (uint8_t k = 0; k < 3; k++)
+            {
+                float vkp = v[k * 3 + p];
+                float vkq = v[k * 3 + q];
+                v[k * 3 + p] = c * vkp - s * vkq;
+                v[k * 3 + q] = s * vkp + c * vkq;
+            }
+        }
+    }
+
+    float root[3];
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        if (!(matrix[i * 4] > 0))
+        {
+            return false;
+        }
+        root[i] = sqrtf(matrix[i * 4]);
+    }
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        for (uint8_t j = 0; j < 3; j++)
+        {
+            matrix[i * 3 + j] = v[i * 3] * root[0] * v[j * 3] + v[i * 3 + 1] * root[1] * v[j * 3 + 1] + v[i * 3 + 2] * root[2] * v[j * 3 + 2];
+        }
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,170 @@
+/*
+ *   Copyright (c) 2023 Malte Hering
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "MultiCompassFilter.h"
+#include <math.h>
+
+#if !defined(MULTICOMPASS_NO_FLOAT)
+/**
+ * @brief Create a biquad that passes its input through.
+ */
+MultiCompassBiquad::MultiCompassBiquad()
+{
+    const CompassBiquadCoefficients passThrough = {1, 0, 0, 0, 0};
+    setCoefficients(&passThrough);
+}
+
+/**
+ * @brief Set the coefficients and reset the state.
+ * @param coefficients A pointer to the normalized coefficients.
+ */
+void MultiCompassBiquad::setCoefficients(const CompassBiquadCoefficients *coefficients)
+{
+    this->coefficients = *coefficients;
+    reset();
+}
+
+/**
+ * @brief Reset the state, the next input primes it.
+ */
+void MultiCompassBiquad::reset()
+{
+    z1 = 0;
+    z2 = 0;
+    primed = false;
+}
+
+/**
+ * @brief Filter one value.
+ * @param value The input value.
+ * @return The output value.
+ */
+float MultiCompassBiquad::update(float value)
+{
+    const CompassBiquadCoefficients &c = coefficients;
+    if (!primed)
+    {
+        // Start in the steady state of a constant input, a low-pass would otherwise rise slowly from zero.
+        float gain = 1 + c.a1 + c.a2;
+        float output = gain != 0 ? value * (c.b0 + c.b1 + c.b2) / gain : 0;
+        z1 = output - c.b0 * value;
+        z2 = c.b2 * value - c.a2 * output;
+        primed = true;
+    }
+    float output = c.b0 * value + z1;
+    z1 = c.b1 * value - c.a1 * output + z2;
+    z2 = c.b2 * value - c.a2 * output;
+    return output;
+}
+
+/**
+ * @brief Calculate the coefficients of a second order low-pass with the bilinear transform.
+ * @param cutoff The cutoff frequency in Hz.
+ * @param sampleRate The sample rate in Hz.
+ * @param q The quality factor.
+ * @param coefficients A pointer to a CompassBiquadCoefficients object where the coefficients will be stored.
+ */
+void MultiCompassBiquad::lowPass(float cutoff, float sampleRate, float q, CompassBiquadCoefficients *coefficients)
+{
+    float omega = 2 * (float)PI * cutoff / sampleRate;
+    float cosine = cosf(omega);
+    float alpha = sinf(omega) / (2 * q);
+    float a0 = 1 + alpha;
+    coefficients->b0 = (1 - cosine) / 2 / a0;
+    coefficients->b1 = (1 - cosine) / a0;
+    coefficients->b2 = coefficients->b0;
+    coefficients->a1 = -2 * cosine / a0;
+    coefficients->a2 = (1 - alpha) / a0;
+}
+#endif
+
+/**
+ * @brief Create a fixed point biquad that passes its input through.
+ */
+MultiCompassBiquadFixed::MultiCompassBiquadFixed()
+{
+    // Set the pass through directly, so a build without float support needs no conversion.
+    b[0] = 1UL << MULTICOMPASS_BIQUAD_SHIFT;
+    b[1] = 0;
+    b[2] = 0;
+    a[0] = 0;
+    a[1] = 0;
+    reset();
+}
+
+#if !defined(MULTICOMPASS_NO_FLOAT)
+
+/**
+ * @brief Convert the coefficients to fixed point and reset the state.
+ * @param coefficients A pointer to the normalized coefficients.
+ */
+void MultiCompassBiquadFixed::setCoefficients(const CompassBiquadCoefficients *coefficients)
+{
+    const float one = (float)(1UL << MULTICOMPASS_BIQUAD_SHIFT);
+    b[0] = lroundf(coefficients->b0 * one);
+    b[1] = lroundf(coefficients->b1 * one);
+    b[2] = lroundf(coefficients->b2 * one);
+    a[0] = lroundf(coefficients->a1 * one);
+    a[1] = lroundf(coefficients->a2 * one);
+    reset();
+}
+#endif
+
+/**
+ * @brief Reset the state, the next input primes it.
+ */
+void MultiCompassBiquadFixed::reset()
+{
+    x1 = 0;
+    x2 = 0;
+    y1 = 0;
+    y2 = 0;
+    primed = false;
+}
+
+/**
+ * @brief Filter one Q14 value.
+ * @param value The input value.
+ * @return The output value.
+ */
+int16_t MultiCompassBiquadFixed::update(int16_t value)
+{
+    if (!primed)
+    {
+        // A low-pass has unity gain at DC, so a constant input is its own steady state.
+        x1 = value;
+        x2 = value;
+        y1 = (int32_t)value << MULTICOMPASS_BIQUAD_GUARD;
+        y2 = y1;
+        primed = true;
+    }
+    // The inputs are extended by the guard bits, so all five products share the same scale.
+    int64_t sum = (int64_t)b[0] * ((int32_t)value << MULTICOMPASS_BIQUAD_GUARD) +
+                  (int64_t)b[1] * ((int32_t)x1 << MULTICOMPASS_BIQUAD_GUARD) +
+                  (int64_t)b[2] * ((int32_t)x2 << MULTICOMPASS_BIQUAD_GUARD) -
+                  (int64_t)a[0] * y1 -
+                  (int64_t)a[1] * y2;
+    int32_t output = (int32_t)((sum + (1LL << (MULTICOMPASS_BIQUAD_SHIFT - 1))) >> MULTICOMPASS_BIQUAD_SHIFT);
+    // Limit the history to the Q14 range, an overshoot at full scale would otherwise wrap.
+    const int32_t limit = 32767L << MULTICOMPASS_BIQUAD_GUARD;
+    output = constrain(output, -limit, limit);
+    x2 = x1;
+    x1 = value;
+    y2 = y1;
+    y1 = output;
+    return (int16_t)((output + (1 << (MULTICOMPASS_BIQUAD_GUARD - 1))) >> MULTICOMPASS_BIQUAD_GUARD);
+}
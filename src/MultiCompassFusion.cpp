@@ -0,0 +1,229 @@
+/*
+ *   Copyright (c) 2023 Malte Hering
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#if !defined(MULTICOMPASS_NO_FLOAT)
+
+#include "MultiCompassFusion.h"
+#include <math.h>
+
+/**
+ * @brief Create a new MultiCompassFusion for the sensors of an array.
+ * @param array A pointer to the array whose frames are fused.
+ */
+MultiCompassFusion::MultiCompassFusion(MultiCompassArray *array)
+{
+    this->array = array;
+    reset();
+}
+
+/**
+ * @brief Reset the noise estimates and the outlier counts of all sensors.
+ */
+void MultiCompassFusion::reset()
+{
+    for (uint8_t i = 0; i < MULTICOMPASS_ARRAY_SIZE; i++)
+    {
+        variance[i] = MULTICOMPASS_FUSION_NOISE;
+        outliers[i] = 0;
+    }
+    usedMask = 0;
+    sequence = 0;
+}
+
+/**
+ * @brief Fuse the scaled readings of a frame into one sample.
+ * @param frame A pointer to the frame, its readings are used as delivered by readFrame().
+ * @param result A pointer to a CompassData object where the fused sample will be stored.
+ * @param x The X axis of the sensor.
+ * @param y The Y axis of the sensor.
+ * @param z The Z axis of the sensor.
+ * @return true if at least one sensor contributed, false otherwise.
+ */
+bool MultiCompassFusion::fuse(const MultiCompassFrame *frame, CompassData *result, int x, int y, int z)
+{
+    float vectors[3][MULTICOMPASS_ARRAY_SIZE];
+    uint8_t sensors[MULTICOMPASS_ARRAY_SIZE];
+    uint8_t count = 0;
+    usedMask = 0;
+
+    // Collect the calibrated vectors of all readable sensors, saturated samples have no direction.
+    uint8_t frameCount = min(frame->count, array->getSensorCount());
+    for (uint8_t i = 0; i < frameCount; i++)
+    {
+        const CompassData *data = &frame->data[i];
+        if (!(frame->validMask & (1UL << i)) || (data->flags & (COMPASS_FLAG_OVERFLOW | COMPASS_FLAG_RANGE_CHANGED)))
+        {
+            continue;
+        }
+        // The readings are already scaled and filtered by the sensor, scaling the raw values again would undo the filter.
+        vectors[0][count] = data->scaledX;
+        vectors[1][count] = data->scaledY;
+        vectors[2][count] = data->scaledZ;
+        sensors[count] = i;
+        count++;
+    }
+    if (count == 0)
+    {
+        return false;
+    }
+
+    // Vote against the component wise median, it takes more than half of the sensors to move it.
+    uint32_t candidates = (1UL << count) - 1;
+    if (count >= 3)
+    {
+        float center[3];
+        for (uint8_t axis = 0; axis < 3; axis++)
+        {
+            float values[MULTICOMPASS_ARRAY_SIZE];
+            for (uint8_t k = 0; k < count; k++)
+            {
+                values[k] = vectors[axis][k];
+            }
+            center[axis] = median(values, count);
+        }
+        uint32_t agreeing = 0;
+        for (uint8_t k = 0; k < count; k++)
+        {
+            float dx = vectors[0][k] - center[0];
+            float dy = vectors[1][k] - center[1];
+            float dz = vectors[2][k] - center[2];
+            if (dx * dx + dy * dy + dz * dz <= MULTICOMPASS_FUSION_GATE * MULTICOMPASS_FUSION_GATE)
+            {
+                agreeing |= 1UL << k;
+            }
+        }
+        // Without any agreement there is no majority to trust, so all sensors are kept.
+        if (agreeing != 0)
+        {
+            candidates = agreeing;
+        }
+    }
+
+    // Average the remaining vectors, weighted with the inverse noise variance and the flags.
+    float sum[3] = {0, 0, 0};
+    float total = 0;
+    float weights[MULTICOMPASS_ARRAY_SIZE];
+    bool anomaly = true;
+    for (uint8_t k = 0; k < count; k++)
+    {
+        uint8_t sensor = sensors[k];
+        weights[k] = 0;
+        if (!(candidates & (1UL << k)))
+        {
+            outliers[sensor]++;
+            continue;
+        }
+        float weight = 1 / fmaxf(variance[sensor], MULTICOMPASS_FUSION_FLOOR);
+        if (frame->data[sensor].flags & COMPASS_FLAG_ANOMALY)
+        {
+            weight *= MULTICOMPASS_FUSION_ANOMALY_WEIGHT;
+        }
+        else
+        {
+            anomaly = false;
+        }
+        sum[0] += weight * vectors[0][k];
+        sum[1] += weight * vectors[1][k];
+        sum[2] += weight * vectors[2][k];
+        total += weight;
+        weights[k] = weight;
+        usedMask |= 1UL << sensor;
+    }
+
+    result->rawX = 0;
+    result->rawY = 0;
+    result->rawZ = 0;
+    result->scaledX = sum[0] / total;
+    result->scaledY = sum[1] / total;
+    result->scaledZ = sum[2] / total;
+    result->timestamp = frame->timestamp;
+    result->sequence = ++sequence;
+    result->flags = anomaly ? COMPASS_FLAG_ANOMALY : 0;
+
+    // The noise of every sensor, outliers included, is its distance from the vector fused from the other sensors.
+    // Against a vector that contains its own reading, a biased sensor would look quiet and gain even more weight.
+    for (uint8_t k = 0; k < count; k++)
+    {
+        float others = total - weights[k];
+        if (others <= 0)
+        {
+            // No other sensor to compare with.
+            continue;
+        }
+        float dx = vectors[0][k] - (sum[0] - weights[k] * vectors[0][k]) / others;
+        float dy = vectors[1][k] - (sum[1] - weights[k] * vectors[1][k]) / others;
+        float dz = vectors[2][k] - (sum[2] - weights[k] * vectors[2][k]) / others;
+        float &noise = variance[sensors[k]];
+        noise += (dx * dx + dy * dy + dz * dz - noise) * MULTICOMPASS_FUSION_ALPHA;
+    }
+
+    array->getSensor(0)->calculateHeading(result, x, y, z);
+    return true;
+}
+
+/**
+ * @brief Get the sensors that contributed to the last fused sample.
+ * @return A bit mask, bit n is set if sensor n contributed.
+ */
+uint32_t MultiCompassFusion::getUsedMask()
+{
+    return usedMask;
+}
+
+/**
+ * @brief Get the noise estimate of a sensor.
+ * @param index The index of the sensor.
+ * @return The RMS distance of its vector from the vector fused from the other sensors, 0 if the index is invalid.
+ */
+float MultiCompassFusion::getNoise(uint8_t index)
+{
+    return index < MULTICOMPASS_ARRAY_SIZE ? sqrtf(variance[index]) : 0;
+}
+
+/**
+ * @brief Get how often a sensor was voted out.
+ * @param index The index of the sensor.
+ * @return The number of frames the sensor was an outlier in, 0 if the index is invalid.
+ */
+uint32_t MultiCompassFusion::getOutlierCount(uint8_t index)
+{
+    return index < MULTICOMPASS_ARRAY_SIZE ? outliers[index] : 0;
+}
+
+/**
+ * @brief Calculate the median of a few values with an insertion sort.
+ * @param values The values, sorted in place.
+ * @param count The number of values.
+ * @return The median, the mean of the two middle values for an even count.
+ */
+float MultiCompassFusion::median(float *values, uint8_t count)
+{
+    for (uint8_t i = 1; i < count; i++)
+    {
+        float value = values[i];
+        uint8_t j = i;
+        while (j > 0 && values[j - 1] > value)
+        {
+            values[j] = values[j - 1];
+            j--;
+        }
+        values[j] = value;
+    }
+    return (count & 1) ? values[count / 2] : (values[count / 2 - 1] + values[count / 2]) / 2;
+}
+
+#endif
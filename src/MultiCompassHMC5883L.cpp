@@ -21,29 +21,155 @@
  * @brief Construct a new MultiCompassHMC5883L object
  * @param wire1 A pointer to a TwoWire object that will be used for I2C communication
  */
-MultiCompassHMC5883L::MultiCompassHMC5883L(TwoWire *wire1) : MultiCompass(wire1)
+MultiCompassHMC5883L::MultiCompassHMC5883L(TwoWire *wire1) : MultiCompassDriver(wire1)
 {
-    adress = HMC5883L_ADDRESS + 1;
+    adress = HMC5883L_ADDRESS;
 };
 
+/**
+ * @brief Construct a new MultiCompassHMC5883L object on another transport
+ * @param transport A pointer to the transport that will be used for I2C communication
+ */
+MultiCompassHMC5883L::MultiCompassHMC5883L(MultiCompassTransport *transport) : MultiCompassDriver(transport)
+{
+    adress = HMC5883L_ADDRESS;
+}
+
+/**
+ * @brief Identify the HMC5883L magnetometer, load its configuration and optionally run the self test
+ * @param selfTest Whether to run the self test and apply its gain corrections
+ * @return COMPASS_SETUP_OK if the module is ready, otherwise the reason of the failure
+ */
+CompassSetupStatus MultiCompassHMC5883L::begin(bool selfTest)
+{
+    // Without a bus timeout a stuck bus would block the identification forever on AVR
+    enableWireTimeout();
+    // One burst from CONFIG_A to IDENT_C confirms the address, identifies the chip and loads the configuration
+    uint8_t buffer[HMC5883L_REGISTER_COUNT];
+    if (!readBytes(HMC5883L_REGISTER_CONFIG_A, buffer, HMC5883L_REGISTER_COUNT))
+    {
+        return COMPASS_SETUP_NO_RESPONSE;
+    }
+    if (buffer[HMC5883L_REGISTER_IDENT_A] != HMC5883L_IDENT_A ||
+        buffer[HMC5883L_REGISTER_IDENT_B] != HMC5883L_IDENT_B ||
+        buffer[HMC5883L_REGISTER_IDENT_C] != HMC5883L_IDENT_C)
+    {
+        return COMPASS_SETUP_WRONG_ID;
+    }
+    configA = buffer[HMC5883L_REGISTER_CONFIG_A];
+    configB = buffer[HMC5883L_REGISTER_CONFIG_B];
+    modeRegister = buffer[HMC5883L_REGISTER_MODE];
+    updateRawScale();
+    return selfTest ? this->selfTest() : COMPASS_SETUP_OK;
+}
+
+/**
+ * @brief Run the positive and negative bias self test of the HMC5883L magnetometer, following the datasheet
+ * @return COMPASS_SETUP_OK if all axes are within the limits, otherwise the reason of the failure
+ */
+CompassSetupStatus MultiCompassHMC5883L::selfTest()
+{
+#if defined(MULTICOMPASS_NO_FLOAT)
+    // Field of the internal coil on each axis in milligauss
+    static const uint16_t expected[3] = {1160, 1160, 1080};
+#else
+    // Field of the internal coil on each axis in gauss
+    static const float expected[3] = {1.16f, 1.16f, 1.08f};
+#endif
+    CompassRawSample positive, negative;
+    CompassSetupStatus status = measureBias(HMC5883L_SELFTEST_POSITIVE, &positive);
+    if (status == COMPASS_SETUP_OK)
+    {
+        status = measureBias(HMC5883L_SELFTEST_NEGATIVE, &negative);
+    }
+
+    // Restore the configuration in any case, the bias must not stay enabled
+    if (!applyConfig() && status == COMPASS_SETUP_OK)
+    {
+        status = COMPASS_SETUP_CONFIG_FAILED;
+    }
+    if (status != COMPASS_SETUP_OK)
+    {
+        return status;
+    }
+
+    const int16_t high[3] = {positive.x, positive.y, positive.z};
+    const int16_t low[3] = {negative.x, negative.y, negative.z};
+#if defined(MULTICOMPASS_NO_FLOAT)
+    uint16_t correction[3];
+#else
+    float correction[3];
+#endif
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        // Both readings have to be within the limits, their half difference is free of the ambient field
+        if (high[i] < HMC5883L_SELFTEST_LOW || high[i] > HMC5883L_SELFTEST_HIGH ||
+            -low[i] < HMC5883L_SELFTEST_LOW || -low[i] > HMC5883L_SELFTEST_HIGH)
+        {
+            return COMPASS_SETUP_SELFTEST_FAILED;
+        }
+#if defined(MULTICOMPASS_NO_FLOAT)
+        // expected / 1000 * gain / ((high - low) / 2) in Q12, where 4096 * 2 / 1000 == 1024 / 125
+        uint32_t gain = getGain((HMC5883L_FieldRange)(HMC5883L_SELFTEST_CONFIG_B >> 5));
+        correction[i] = expected[i] * gain * 1024 / 125 / (high[i] - low[i]);
+#else
+        float measured = (high[i] - low[i]) / 2.0f;
+        correction[i] = expected[i] * getGain((HMC5883L_FieldRange)(HMC5883L_SELFTEST_CONFIG_B >> 5)) / measured;
+#endif
+    }
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        gainCorrection[i] = correction[i];
+    }
+    updateRawScale();
+    return COMPASS_SETUP_OK;
+}
+
+/**
+ * @brief Measure the self test field of the HMC5883L magnetometer with one bias direction
+ * @param bias CONFIG_A with the bias bits
+ * @param sample Pointer to a CompassRawSample struct to store the measurement
+ * @return COMPASS_SETUP_OK if the measurement was read, otherwise the reason of the failure
+ */
+CompassSetupStatus MultiCompassHMC5883L::measureBias(uint8_t bias, CompassRawSample *sample)
+{
+    const uint8_t config[3] = {bias, HMC5883L_SELFTEST_CONFIG_B, HMC5883L_MODE_CONTINOUS};
+    if (!writeBytes(HMC5883L_REGISTER_CONFIG_A, config, 3))
+    {
+        return COMPASS_SETUP_CONFIG_FAILED;
+    }
+    // The conversion in progress still uses the previous settings, so the first result is dropped
+    delay(HMC5883L_SELFTEST_WAIT);
+    if (!readRawSample(sample))
+    {
+        return COMPASS_SETUP_NO_RESPONSE;
+    }
+    delay(HMC5883L_SELFTEST_WAIT);
+    if (!readRawSample(sample))
+    {
+        return COMPASS_SETUP_NO_RESPONSE;
+    }
+    return COMPASS_SETUP_OK;
+}
+
 /**
  * @brief Set the operating mode of the HMC5883L magnetometer
  * @param mode The desired operating mode, as a HMC5883L_Mode enum value
  */
 void MultiCompassHMC5883L::setMode(HMC5883L_Mode mode)
 {
-    uint8_t value = readByte(HMC5883L_REGISTER_MODE);
-    value &= 0b11111100;
-    value |= mode;
-    writeByte(HMC5883L_REGISTER_MODE, value);
+    // Update the shadow copy, so a single write is enough
+    modeRegister &= 0b11111100;
+    modeRegister |= mode;
+    writeByte(HMC5883L_REGISTER_MODE, modeRegister);
 }
 /**
- * @brief Get the current operating mode of the HMC5883L magnetometer
+ * @brief Get the current operating mode of the HMC5883L magnetometer from the shadow copy
  * @return The current operating mode, as a HMC5883L_Mode enum value
  */
 HMC5883L_Mode MultiCompassHMC5883L::getMode()
 {
-    uint8_t value = readByte(HMC5883L_REGISTER_MODE);
+    uint8_t value = modeRegister;
     value &= 0b00000011;
     return (HMC5883L_Mode)value;
 }
@@ -53,20 +179,21 @@ HMC5883L_Mode MultiCompassHMC5883L::getMode()
  */
 void MultiCompassHMC5883L::setFieldRange(HMC5883L_FieldRange range)
 {
-    writeByte(HMC5883L_REGISTER_CONFIG_B, range << 5);
+    // All other bits of CONFIG_B have to be cleared
+    configB = range << 5;
+    writeByte(HMC5883L_REGISTER_CONFIG_B, configB);
+    updateRawScale();
 }
 
 /**
- * @brief Get the current magnetic field range of the HMC5883L magnetometer
+ * @brief Get the current magnetic field range of the HMC5883L magnetometer from the shadow copy
  * 
  * @return The current magnetic field range, as a HMC5883L_FieldRange enum value
  */
 HMC5883L_FieldRange MultiCompassHMC5883L::getFieldRange()
 {
-    // Read the current value of the configuration register for the HMC5883L
-    uint8_t value = readByte(HMC5883L_REGISTER_CONFIG_B);
-    // Extract the magnetic field range bits (bits 5-6) from the register value and cast to HMC5883L_FieldRange
-    HMC5883L_FieldRange ret = (HMC5883L_FieldRange)((value >> 5) & 0b00000011);
+    // Extract the magnetic field range bits (bits 5-7) from the register value and cast to HMC5883L_FieldRange
+    HMC5883L_FieldRange ret = (HMC5883L_FieldRange)((configB >> 5) & 0b00000111);
     return ret;
 }
 
@@ -77,23 +204,22 @@ HMC5883L_FieldRange MultiCompassHMC5883L::getFieldRange()
  */
 void MultiCompassHMC5883L::setOutputRate(HMC5883L_OutputRate samplerate)
 {
-    uint8_t value = readByte(HMC5883L_REGISTER_CONFIG_A);
     // Clear bits 2-4 of the current value to make room for the new output data rate
-    value &= 0b11100011;
+    configA &= 0b11100011;
     // Set the output data rate bits in the value
-    value |= (samplerate << 2);
+    configA |= (samplerate << 2);
     // Write the new value to the configuration register
-    writeByte(HMC5883L_REGISTER_CONFIG_A, value);
+    writeByte(HMC5883L_REGISTER_CONFIG_A, configA);
 }
 /**
- * @brief Get the current output data rate of the HMC5883L magnetometer
+ * @brief Get the current output data rate of the HMC5883L magnetometer from the shadow copy
  * 
  * @return The current output data rate, as a HMC5883L_OutputRate enum value
  */
 HMC5883L_OutputRate MultiCompassHMC5883L::getOutputRate()
 {
-    uint8_t value = readByte(HMC5883L_REGISTER_CONFIG_A);
-    // Clear all but the bits 3-5 of the value to extract the output data rate
+    uint8_t value = configA;
+    // Clear all but the bits 2-4 of the value to extract the output data rate
     value &= 0b00011100;
     // Shift the output data rate bits to the right to obtain the final value
     value >>= 2;
@@ -106,71 +232,336 @@ HMC5883L_OutputRate MultiCompassHMC5883L::getOutputRate()
  */
 void MultiCompassHMC5883L::setAveragedSamples(HMC5883L_Samples samples)
 {
-    uint8_t value = readByte(HMC5883L_REGISTER_CONFIG_A);
     // Clear bits 5-6 of the current value to make room for the new number of averaged samples
-    value &= 0b10011111;
+    configA &= 0b10011111;
     // Set the averaged samples bits in the value
-    value |= (samples << 5);
+    configA |= (samples << 5);
     // Write the new value to the configuration register
-    writeByte(HMC5883L_REGISTER_CONFIG_A, value);
+    writeByte(HMC5883L_REGISTER_CONFIG_A, configA);
+}
+
+/**
+ * @brief Get the number of averaged samples of the HMC5883L magnetometer from the shadow copy
+ * @return The current number of averaged samples, as a HMC5883L_Samples enum value
+ */
+HMC5883L_Samples MultiCompassHMC5883L::getAveragedSamples()
+{
+    // Extract the averaged samples bits (bits 5-6)
+    return (HMC5883L_Samples)((configA >> 5) & 0b00000011);
+}
+
+/**
+ * @brief Set the whole configuration of the HMC5883L magnetometer with a single transaction
+ * @param samples The desired number of averaged samples
+ * @param samplerate The desired output data rate
+ * @param range The desired field range
+ * @param mode The desired operating mode
+ * @return true if the configuration was written, false otherwise
+ */
+bool MultiCompassHMC5883L::setConfig(HMC5883L_Samples samples, HMC5883L_OutputRate samplerate, HMC5883L_FieldRange range, HMC5883L_Mode mode)
+{
+    // Keep the measurement configuration bits of CONFIG_A and the high speed bit of MODE
+    configA = (configA & 0b00000011) | (samples << 5) | (samplerate << 2);
+    configB = range << 5;
+    modeRegister = (modeRegister & 0b11111100) | mode;
+    updateRawScale();
+    return applyConfig();
+}
+
+/**
+ * @brief Check whether stored configuration bytes belong to the HMC5883L, without applying them
+ * @param buffer Pointer to the configuration bytes
+ * @param length The number of configuration bytes
+ * @return true if there are HMC5883L_CONFIG_BYTES bytes with a valid calibration range, false otherwise
+ */
+bool MultiCompassHMC5883L::checkConfigBytes(const uint8_t *buffer, uint8_t length)
+{
+    return length == HMC5883L_CONFIG_BYTES && buffer[3] <= HMC5883L_FIELDRANGE_8_1GA;
+}
+
+/**
+ * @brief Write the shadow copies of CONFIG_A, CONFIG_B and MODE in a single transaction
+ * @return true if the registers were written, false otherwise
+ */
+bool MultiCompassHMC5883L::applyConfig()
+{
+    // The three registers are consecutive and the register pointer increments after each byte
+    const uint8_t buffer[3] = {configA, configB, modeRegister};
+    return writeBytes(HMC5883L_REGISTER_CONFIG_A, buffer, 3);
+}
+
+/**
+ * @brief Refresh the shadow copies of CONFIG_A, CONFIG_B and MODE from the module in a single transaction
+ * @return true if the registers were read, false otherwise
+ */
+bool MultiCompassHMC5883L::loadConfig()
+{
+    uint8_t buffer[3];
+    if (!readBytes(HMC5883L_REGISTER_CONFIG_A, buffer, 3))
+    {
+        return false;
+    }
+    configA = buffer[0];
+    configB = buffer[1];
+    modeRegister = buffer[2];
+    updateRawScale();
+    return true;
+}
+
+/**
+ * @brief Get the configuration that is stored with the calibration
+ * @param buffer Pointer to the buffer for CONFIG_A, CONFIG_B, MODE and the calibration range
+ * @param length The size of the buffer
+ * @return The number of configuration bytes, 0 if the buffer is too small
+ */
+uint8_t MultiCompassHMC5883L::getConfigBytes(uint8_t *buffer, uint8_t length)
+{
+    if (length < HMC5883L_CONFIG_BYTES)
+    {
+        return 0;
+    }
+    buffer[0] = configA;
+    buffer[1] = configB;
+    buffer[2] = modeRegister;
+    buffer[3] = calibrationRange;
+    return HMC5883L_CONFIG_BYTES;
+}
+
+/**
+ * @brief Restore the configuration that was stored with the calibration and write it to the module
+ * @param buffer Pointer to the configuration bytes
+ * @param length The number of configuration bytes
+ * @return true if the configuration was written, false otherwise
+ */
+bool MultiCompassHMC5883L::setConfigBytes(const uint8_t *buffer, uint8_t length)
+{
+    if (!checkConfigBytes(buffer, length))
+    {
+        return false;
+    }
+    configA = buffer[0];
+    configB = buffer[1];
+    modeRegister = buffer[2];
+    calibrationRange = (HMC5883L_FieldRange)(buffer[3] & 0b111);
+    updateRawScale();
+    return applyConfig();
 }
 
 /**
  * @brief Get the raw magnetic field data from the HMC5883L magnetometer
  * @param data Pointer to a CompassData struct to store the raw magnetic field data
+ * @return true if the output registers were read, false otherwise
  */
-void MultiCompassHMC5883L::getData(CompassData *data)
+bool MultiCompassHMC5883L::getData(CompassData *data)
 {
-    // Read the raw X, Y, and Z magnetic field data from the sensor
-    data->rawX = readTwoBytes(HMC5883L_REGISTER_OUT_X_M, true);
-    data->rawY = readTwoBytes(HMC5883L_REGISTER_OUT_Y_M, true);
-    data->rawZ = readTwoBytes(HMC5883L_REGISTER_OUT_Z_M, true);
+    // Read all six output registers in one burst, so all axes belong to the same conversion
+    return MultiCompass::getData(data);
+}
+
+/**
+ * @brief Get the raw magnetic field data and the status register from the HMC5883L magnetometer
+ * @param data Pointer to a CompassData struct to store the raw magnetic field data
+ * @param status Pointer to a byte to store the status register
+ * @return true if the output and status registers were read, false otherwise
+ */
+bool MultiCompassHMC5883L::getData(CompassData *data, uint8_t *status)
+{
+    uint8_t buffer[HMC5883L_DATA_LENGTH + 1];
+    CompassRawSample sample;
+    uint32_t timestamp = micros();
+    // The status register directly follows OUT_Y_L, so it is part of the same burst
+    if (!readBytes(HMC5883L_REGISTER_OUT_X_M, buffer, HMC5883L_DATA_LENGTH + 1))
+    {
+        return false;
+    }
+    decodeData(buffer, &sample);
+    data->rawX = sample.x;
+    data->rawY = sample.y;
+    data->rawZ = sample.z;
+    data->timestamp = timestamp;
+    data->sequence = nextSequence();
+    data->flags = 0;
+    checkSample(data);
+    checkField(data);
+    *status = buffer[HMC5883L_DATA_LENGTH];
+    return true;
+}
+
+/**
+ * @brief Read one raw sample of the HMC5883L magnetometer in a single burst transaction
+ * @param sample Pointer to a CompassRawSample struct to store the raw magnetic field data
+ * @return true if all output registers were read, false otherwise
+ */
+bool MultiCompassHMC5883L::readRawSample(CompassRawSample *sample)
+{
+    uint8_t buffer[HMC5883L_DATA_LENGTH];
+    if (!readBytes(HMC5883L_REGISTER_OUT_X_M, buffer, HMC5883L_DATA_LENGTH))
+    {
+        return false;
+    }
+    decodeData(buffer, sample);
+    return true;
+}
+
+/**
+ * @brief Start a single measurement of the HMC5883L magnetometer
+ * @return true if the measurement was started, false otherwise
+ */
+bool MultiCompassHMC5883L::triggerMeasurement()
+{
+    // Remember the edge counter first, so an early edge is not missed
+    triggerCount = getDataReadyCount();
+    setMode(HMC5883_MODE_SINGLE);
+    triggerTime = micros();
+    triggerPending = lastStatus == COMPASS_OK;
+    return triggerPending;
+}
+
+/**
+ * @brief Check without blocking whether the triggered measurement is completed
+ * @return true if the measurement can be read, false otherwise
+ */
+bool MultiCompassHMC5883L::isMeasurementReady()
+{
+    if (!triggerPending)
+    {
+        return false;
+    }
+    uint32_t elapsed = micros() - triggerTime;
+    if (isDataReadyEnabled())
+    {
+        // Fall back to twice the measurement time in case the edge was missed
+        return getDataReadyCount() != triggerCount || elapsed >= 2 * measurementTime;
+    }
+    return elapsed >= measurementTime;
 }
+
 /**
- * @brief Calibration function for the HMC5883L compass module.
- * Updates the min and max values for each axis based on the current readings
- * from the compass sensor. Calibration is complete when the time since last calibration
- * is greater than the calibration period.
- * @param data pointer to a CompassData object containing the raw X, Y, and Z values
- * from the compass sensor
- * @return true if calibration is complete, false otherwise
+ * @brief Read the triggered measurement of the HMC5883L magnetometer once it is completed
+ * @param data Pointer to a CompassData struct to store the raw magnetic field data
+ * @return true if the measurement was read, false if it is still pending or no measurement was triggered
  */
-    bool MultiCompassHMC5883L::calibration(CompassData *data)
+bool MultiCompassHMC5883L::getTriggeredData(CompassData *data)
+{
+    if (!isMeasurementReady())
     {
-    // Update minimum values for each axis
-    if (data->rawX < settings.minX)
+        return false;
+    }
+    triggerPending = false;
+    // The module is already back in idle mode, so this is the only bus access besides the trigger
+    modeRegister = (modeRegister & 0b11111100) | HMC5883L_MODE_IDLE;
+    return getData(data);
+}
+
+/**
+ * @brief Convert the output register block of the HMC5883L to raw axis values
+ * @param buffer The six output bytes, starting at OUT_X_M (order X, Z, Y, MSB first)
+ * @param sample Pointer to a CompassRawSample struct to store the raw magnetic field data
+ */
+void MultiCompassHMC5883L::decodeData(const uint8_t *buffer, CompassRawSample *sample)
+{
+    sample->x = (int16_t)(buffer[0] << 8 | buffer[1]);
+    sample->z = (int16_t)(buffer[2] << 8 | buffer[3]);
+    sample->y = (int16_t)(buffer[4] << 8 | buffer[5]);
+}
+/**
+ * @brief Flag saturated samples and step the field range with hysteresis if auto-ranging is enabled
+ * @param data Pointer to a CompassData struct containing the raw magnetic field data
+ */
+void MultiCompassHMC5883L::checkSample(CompassData *data)
+{
+    if (data->rawX == HMC5883L_OVERFLOW || data->rawY == HMC5883L_OVERFLOW || data->rawZ == HMC5883L_OVERFLOW)
     {
-    settings.minX = data->rawX;
-    settings.lastCalibration = millis();
+        data->flags |= COMPASS_FLAG_OVERFLOW;
     }
-    if (data->rawY < settings.minY)
+    if (settleCount > 0)
     {
-    settings.minY = data->rawY;
-    settings.lastCalibration = millis();
+        // The sample may still be measured with the previous gain, so it must not trigger another step
+        settleCount--;
+        data->flags |= COMPASS_FLAG_RANGE_CHANGED;
+        return;
     }
-    if (data->rawZ < settings.minZ)
+    if (!autoRange)
     {
-    settings.minZ = data->rawZ;
-    settings.lastCalibration = millis();
+        return;
     }
 
-    // Update maximum values for each axis
-    if (data->rawX > settings.maxX)
+    HMC5883L_FieldRange range = getFieldRange();
+    // The thresholds are compared in integers, the raw values are integers in every build
+    int32_t peak = max(max(labs((int32_t)data->rawX), labs((int32_t)data->rawY)), labs((int32_t)data->rawZ));
+    HMC5883L_FieldRange next = range;
+    if ((data->flags & COMPASS_FLAG_OVERFLOW) || peak > HMC5883L_AUTORANGE_HIGH)
     {
-    settings.maxX = data->rawX;
-    settings.lastCalibration = millis();
+        // Saturated or close to it, switch to the next less sensitive range right away
+        weakCount = 0;
+        if (range < HMC5883L_FIELDRANGE_8_1GA)
+        {
+            next = (HMC5883L_FieldRange)(range + 1);
+        }
     }
-    if (data->rawY > settings.maxY)
+    else if (range > HMC5883L_FIELDRANGE_0_88GA &&
+             peak * getGain((HMC5883L_FieldRange)(range - 1)) < HMC5883L_AUTORANGE_LOW * (int32_t)getGain(range))
     {
-    settings.maxY = data->rawY;
-    settings.lastCalibration = millis();
+        // The sample would stay far below the upper threshold in the next more sensitive range
+        if (++weakCount >= autoRangeHold)
+        {
+            weakCount = 0;
+            next = (HMC5883L_FieldRange)(range - 1);
+        }
     }
-    if (data->rawZ > settings.maxZ)
+    else
     {
-    settings.maxZ = data->rawZ;
-    settings.lastCalibration = millis();
+        weakCount = 0;
     }
 
-    // Check if calibration is complete
-    return (millis() - settings.lastCalibration) > calibrationPeriod;
-    }
\ No newline at end of file
+    if (next != range)
+    {
+        setFieldRange(next);
+        // The new gain is used from the second measurement on, buffered samples still use the old one
+        settleCount = 1 + availableSamples();
+    }
+}
+
+/**
+ * @brief Enable or disable the automatic selection of the field range
+ * @param enable true to enable auto-ranging
+ */
+void MultiCompassHMC5883L::setAutoRange(bool enable)
+{
+    autoRange = enable;
+    weakCount = 0;
+}
+
+/**
+ * @brief Check whether auto-ranging is enabled
+ * @return true if auto-ranging is enabled, false otherwise
+ */
+bool MultiCompassHMC5883L::isAutoRange()
+{
+    return autoRange;
+}
+
+/**
+ * @brief Get the gain of a field range of the HMC5883L magnetometer
+ * @param range The field range
+ * @return The gain in LSB per gauss
+ */
+uint16_t MultiCompassHMC5883L::getGain(HMC5883L_FieldRange range)
+{
+    static const uint16_t gains[] = {1370, 1090, 820, 660, 440, 390, 330, 230};
+    return gains[range & 0b111];
+}
+
+/**
+ * @brief Update rawScale and the coefficients after the field range changed
+ */
+void MultiCompassHMC5883L::updateRawScale()
+{
+#if defined(MULTICOMPASS_NO_FLOAT)
+    uint32_t scale = ((uint32_t)getGain(calibrationRange) << 12) / getGain(getFieldRange());
+    setRawScale((scale * gainCorrection[0]) >> 12, (scale * gainCorrection[1]) >> 12, (scale * gainCorrection[2]) >> 12);
+#else
+    float scale = (float)getGain(calibrationRange) / getGain(getFieldRange());
+    setRawScale(scale * gainCorrection[0], scale * gainCorrection[1], scale * gainCorrection[2]);
+#endif
+}
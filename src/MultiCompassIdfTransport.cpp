@@ -0,0 +1,165 @@
+/*
+ *   Copyright (c) 2023 Malte Hering
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "MultiCompassIdfTransport.h"
+#include "MultiCompass.h"
+
+#if defined(MULTICOMPASS_IDF_TRANSPORT)
+
+/**
+ * @brief Create a transport for a bus of the i2c_master driver.
+ * @param bus The handle of the bus.
+ * @param clock The SCL frequency of the sensor in Hz.
+ */
+MultiCompassIdfTransport::MultiCompassIdfTransport(i2c_master_bus_handle_t bus, uint32_t clock)
+{
+    this->bus = bus;
+    this->clock = clock;
+}
+
+/**
+ * @brief Remove the device from the bus.
+ */
+MultiCompassIdfTransport::~MultiCompassIdfTransport()
+{
+    if (device != NULL)
+    {
+        i2c_master_bus_rm_device(device);
+    }
+}
+
+/**
+ * @brief Get the identity of the bus.
+ * @return The handle of the bus, shared by all of its devices.
+ */
+const void *MultiCompassIdfTransport::getBus()
+{
+    return bus;
+}
+
+/**
+ * @brief Write the register pointer and a block of data in one transaction.
+ * @param address The I2C address of the sensor.
+ * @param reg The first register.
+ * @param buffer A pointer to the data.
+ * @param length The number of data bytes, at most MULTICOMPASS_TRANSPORT_BUFFER.
+ * @param timeout The timeout in microseconds, rounded up to the milliseconds of the driver.
+ * @return The status of the transaction, COMPASS_ERROR_BUS for a longer write.
+ */
+CompassStatus MultiCompassIdfTransport::write(uint8_t address, uint8_t reg, const uint8_t *buffer, uint8_t length, uint32_t timeout)
+{
+    // The register pointer and the data have to leave in one transmit, a shortened write would be silently incomplete.
+    if (length > MULTICOMPASS_TRANSPORT_BUFFER || !attach(address))
+    {
+        return COMPASS_ERROR_BUS;
+    }
+    uint8_t frame[MULTICOMPASS_TRANSPORT_BUFFER + 1];
+    frame[0] = reg;
+    if (length > 0)
+    {
+        memcpy(&frame[1], buffer, length);
+    }
+    return status(i2c_master_transmit(device, frame, length + 1, (timeout + 999) / 1000));
+}
+
+/**
+ * @brief Read bytes from the current register pointer into the receive buffer.
+ * A failed read leaves the buffer empty, so the caller runs into its timeout.
+ * @param address The I2C address of the sensor.
+ * @param length The number of bytes.
+ * @param timeout The timeout in microseconds, rounded up to the milliseconds of the driver.
+ */
+void MultiCompassIdfTransport::request(uint8_t address, uint8_t length, uint32_t timeout)
+{
+    length = min(length, (uint8_t)MULTICOMPASS_TRANSPORT_BUFFER);
+    rxIndex = 0;
+    rxLength = 0;
+    if (attach(address) && i2c_master_receive(device, rxBuffer, length, (timeout + 999) / 1000) == ESP_OK)
+    {
+        rxLength = length;
+    }
+}
+
+/**
+ * @brief Read consecutive registers in one transaction with a repeated start.
+ * @param address The I2C address of the sensor.
+ * @param reg The first register.
+ * @param buffer A pointer to the buffer where the bytes will be stored.
+ * @param length The number of bytes.
+ * @param timeout The timeout in microseconds, rounded up to the milliseconds of the driver.
+ * @return The status of the transfer.
+ */
+CompassStatus MultiCompassIdfTransport::readRegisters(uint8_t address, uint8_t reg, uint8_t *buffer, uint8_t length, uint32_t timeout)
+{
+    if (!attach(address))
+    {
+        return COMPASS_ERROR_BUS;
+    }
+    return status(i2c_master_transmit_receive(device, &reg, 1, buffer, length, (timeout + 999) / 1000));
+}
+
+/**
+ * @brief Add the device of an address to the bus.
+ * @param address The I2C address of the sensor.
+ * @return true if the device is ready, false otherwise.
+ */
+bool MultiCompassIdfTransport::attach(uint8_t address)
+{
+    if (device != NULL && deviceAddress == address)
+    {
+        return true;
+    }
+    if (device != NULL)
+    {
+        i2c_master_bus_rm_device(device);
+        device = NULL;
+    }
+    i2c_device_config_t config = {};
+    config.dev_addr_length = I2C_ADDR_BIT_LEN_7;
+    config.device_address = address;
+    config.scl_speed_hz = clock;
+    if (i2c_master_bus_add_device(bus, &config, &device) != ESP_OK)
+    {
+        device = NULL;
+        return false;
+    }
+    deviceAddress = address;
+    return true;
+}
+
+/**
+ * @brief Convert an error of the driver to a CompassStatus.
+ * @param error The value returned by the driver.
+ * @return The matching CompassStatus.
+ */
+CompassStatus MultiCompassIdfTransport::status(esp_err_t error)
+{
+    switch (error)
+    {
+    case ESP_OK:
+        return COMPASS_OK;
+    case ESP_ERR_TIMEOUT:
+        return COMPASS_ERROR_TIMEOUT;
+    case ESP_ERR_INVALID_STATE:    // Not acknowledged, up to ESP-IDF 5.2.
+    case ESP_ERR_INVALID_RESPONSE: // Not acknowledged, since ESP-IDF 5.3.
+        return COMPASS_ERROR_NACK;
+    default:
+        return COMPASS_ERROR_BUS;
+    }
+}
+
+#endif
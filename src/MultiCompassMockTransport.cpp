@@ -0,0 +1,193 @@
+/*
+ *   Copyright (c) 2023 Malte Hering
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "MultiCompassMockTransport.h"
+
+/**
+ * @brief Create a mock sensor with all registers cleared.
+ * @param address The acknowledged I2C address.
+ */
+MultiCompassMockTransport::MultiCompassMockTransport(uint8_t address)
+{
+    this->address = address;
+    memset(registers, 0, sizeof(registers));
+    memset(&layout, 0, sizeof(layout));
+}
+
+/**
+ * @brief Set a register.
+ * @param reg The register.
+ * @param value The value.
+ */
+void MultiCompassMockTransport::setRegister(uint8_t reg, uint8_t value)
+{
+    registers[reg] = value;
+}
+
+/**
+ * @brief Get a register.
+ * @param reg The register.
+ * @return The value.
+ */
+uint8_t MultiCompassMockTransport::getRegister(uint8_t reg)
+{
+    return registers[reg];
+}
+
+/**
+ * @brief Set the samples that are replayed through the output registers.
+ * @param samples A pointer to the samples.
+ * @param count The number of samples.
+ * @param layout A pointer to the layout of the output registers.
+ * @param loop Whether to start again after the last sample.
+ */
+void MultiCompassMockTransport::setReplay(const CompassRawSample *samples, size_t count, const CompassReplayLayout *layout, bool loop)
+{
+    this->samples = samples;
+    sampleCount = count;
+    this->layout = *layout;
+    this->loop = loop;
+    position = 0;
+}
+
+/**
+ * @brief Get the number of replayed samples.
+ * @return The number of samples loaded since setReplay().
+ */
+size_t MultiCompassMockTransport::getReplayPosition()
+{
+    return position;
+}
+
+/**
+ * @brief Let the next transactions fail.
+ * @param status The status of the failed transactions.
+ * @param count The number of failed transactions.
+ */
+void MultiCompassMockTransport::failNext(CompassStatus status, uint8_t count)
+{
+    failure = status;
+    failures = count;
+}
+
+/**
+ * @brief Store the register pointer and the data in the register file.
+ * @param address The I2C address of the sensor.
+ * @param reg The first register.
+ * @param buffer A pointer to the data.
+ * @param length The number of data bytes.
+ * @param timeout Unused, the mock answers right away.
+ * @return The status of the transaction.
+ */
+CompassStatus MultiCompassMockTransport::write(uint8_t address, uint8_t reg, const uint8_t *buffer, uint8_t length, uint32_t timeout)
+{
+    (void)timeout;
+    writes++;
+    if (failures > 0)
+    {
+        failures--;
+        return failure;
+    }
+    if (address != this->address)
+    {
+        return COMPASS_ERROR_NACK;
+    }
+    // A finished replay behaves like a sensor that left the bus.
+    if (length == 0 && reg == layout.reg && samples != NULL && !loop && position >= sampleCount)
+    {
+        return COMPASS_ERROR_NACK;
+    }
+    pointer = reg;
+    for (uint8_t i = 0; i < length; i++)
+    {
+        registers[pointer++] = buffer[i];
+    }
+    return COMPASS_OK;
+}
+
+/**
+ * @brief Copy bytes of the register file into the receive buffer.
+ * @param address The I2C address of the sensor.
+ * @param length The number of bytes.
+ * @param timeout Unused, the mock answers right away.
+ */
+void MultiCompassMockTransport::request(uint8_t address, uint8_t length, uint32_t timeout)
+{
+    (void)timeout;
+    requests++;
+    receivedLength = 0;
+    receivedPosition = 0;
+    // An unknown address or a longer read than the Wire buffer receives nothing, the caller runs into its timeout.
+    if (address != this->address || length > MULTICOMPASS_MOCK_BUFFER)
+    {
+        return;
+    }
+    if (pointer == layout.reg && samples != NULL && !loadSample())
+    {
+        return;
+    }
+    for (uint8_t i = 0; i < length; i++)
+    {
+        received[i] = registers[pointer++];
+    }
+    receivedLength = length;
+}
+
+/**
+ * @brief Get the number of received bytes that were not read yet.
+ * @return The number of bytes.
+ */
+int MultiCompassMockTransport::available()
+{
+    return receivedLength - receivedPosition;
+}
+
+/**
+ * @brief Read the next received byte.
+ * @return The byte, -1 if none is available.
+ */
+int MultiCompassMockTransport::read()
+{
+    if (receivedPosition >= receivedLength)
+    {
+        return -1;
+    }
+    return received[receivedPosition++];
+}
+
+/**
+ * @brief Load the next sample into the output registers.
+ * @return true if a sample was loaded, false if the replay is finished.
+ */
+bool MultiCompassMockTransport::loadSample()
+{
+    if (sampleCount == 0 || (!loop && position >= sampleCount))
+    {
+        return false;
+    }
+    const CompassRawSample &sample = samples[position % sampleCount];
+    position++;
+    const int16_t axes[3] = {sample.x, sample.y, sample.z};
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        uint8_t reg = layout.reg + layout.offset[i];
+        uint16_t value = (uint16_t)axes[i];
+        registers[reg] = layout.bigEndian ? value >> 8 : value;
+        registers[(uint8_t)(reg + 1)] = layout.bigEndian ? value : value >> 8;
+    }
+    return true;
+}
@@ -0,0 +1,304 @@
+/*
+ *   Copyright (c) 2023 Malte Hering
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "MultiCompassQMC5883L.h"
+
+/**
+ * @brief Construct a new MultiCompassQMC5883L object
+ * @param wire1 A pointer to a TwoWire object that will be used for I2C communication
+ */
+MultiCompassQMC5883L::MultiCompassQMC5883L(TwoWire *wire1) : MultiCompassDriver(wire1)
+{
+    adress = QMC5883L_ADDRESS;
+}
+
+/**
+ * @brief Construct a new MultiCompassQMC5883L object on another transport
+ * @param transport A pointer to the transport that will be used for I2C communication
+ */
+MultiCompassQMC5883L::MultiCompassQMC5883L(MultiCompassTransport *transport) : MultiCompassDriver(transport)
+{
+    adress = QMC5883L_ADDRESS;
+}
+
+/**
+ * @brief Check the chip id, set the SET/RESET period and write the configuration of the QMC5883L magnetometer
+ * @param selfTest Ignored, the QMC5883L has no self test
+ * @return COMPASS_SETUP_OK if the module is ready, otherwise the reason of the failure
+ */
+CompassSetupStatus MultiCompassQMC5883L::begin(bool selfTest)
+{
+    (void)selfTest;
+    // Without a bus timeout a stuck bus would block the identification forever on AVR
+    enableWireTimeout();
+    uint8_t id = readByte(QMC5883L_REGISTER_CHIP_ID);
+    if (lastStatus != COMPASS_OK)
+    {
+        return COMPASS_SETUP_NO_RESPONSE;
+    }
+    if (id != QMC5883L_CHIP_ID)
+    {
+        return COMPASS_SETUP_WRONG_ID;
+    }
+    // The datasheet asks for this value before the first measurement
+    writeByte(QMC5883L_REGISTER_SET_RESET, QMC5883L_SET_RESET_PERIOD);
+    if (lastStatus != COMPASS_OK || !applyConfig())
+    {
+        return COMPASS_SETUP_CONFIG_FAILED;
+    }
+    return COMPASS_SETUP_OK;
+}
+
+/**
+ * @brief Set the operating mode of the QMC5883L magnetometer
+ * @param mode The desired operating mode, as a QMC5883L_Mode enum value
+ */
+void MultiCompassQMC5883L::setMode(QMC5883L_Mode mode)
+{
+    // Clear bits 0-1 of the shadow copy to make room for the new mode
+    control1 &= 0b11111100;
+    control1 |= mode;
+    writeByte(QMC5883L_REGISTER_CONTROL_1, control1);
+}
+
+/**
+ * @brief Get the current operating mode of the QMC5883L magnetometer from the shadow copy
+ * @return The current operating mode, as a QMC5883L_Mode enum value
+ */
+QMC5883L_Mode MultiCompassQMC5883L::getMode()
+{
+    return (QMC5883L_Mode)(control1 & 0b00000011);
+}
+
+/**
+ * @brief Set the magnetic field range of the QMC5883L magnetometer
+ * @param range The desired field range, as a QMC5883L_FieldRange enum value
+ */
+void MultiCompassQMC5883L::setFieldRange(QMC5883L_FieldRange range)
+{
+    // Clear bits 4-5 of the shadow copy to make room for the new range
+    control1 &= 0b11001111;
+    control1 |= (range << 4);
+    writeByte(QMC5883L_REGISTER_CONTROL_1, control1);
+    updateRawScale();
+}
+
+/**
+ * @brief Get the current magnetic field range of the QMC5883L magnetometer from the shadow copy
+ * @return The current magnetic field range, as a QMC5883L_FieldRange enum value
+ */
+QMC5883L_FieldRange MultiCompassQMC5883L::getFieldRange()
+{
+    return (QMC5883L_FieldRange)((control1 >> 4) & 0b00000011);
+}
+
+/**
+ * @brief Set the output data rate of the QMC5883L magnetometer
+ * @param samplerate The desired output data rate, as a QMC5883L_OutputRate enum value
+ */
+void MultiCompassQMC5883L::setOutputRate(QMC5883L_OutputRate samplerate)
+{
+    // Clear bits 2-3 of the shadow copy to make room for the new output data rate
+    control1 &= 0b11110011;
+    control1 |= (samplerate << 2);
+    writeByte(QMC5883L_REGISTER_CONTROL_1, control1);
+}
+
+/**
+ * @brief Get the current output data rate of the QMC5883L magnetometer from the shadow copy
+ * @return The current output data rate, as a QMC5883L_OutputRate enum value
+ */
+QMC5883L_OutputRate MultiCompassQMC5883L::getOutputRate()
+{
+    return (QMC5883L_OutputRate)((control1 >> 2) & 0b00000011);
+}
+
+/**
+ * @brief Set the over sampling ratio of the QMC5883L magnetometer
+ * @param oversampling The desired over sampling ratio, as a QMC5883L_Oversampling enum value
+ */
+void MultiCompassQMC5883L::setOversampling(QMC5883L_Oversampling oversampling)
+{
+    // Clear bits 6-7 of the shadow copy to make room for the new over sampling ratio
+    control1 &= 0b00111111;
+    control1 |= (oversampling << 6);
+    writeByte(QMC5883L_REGISTER_CONTROL_1, control1);
+}
+
+/**
+ * @brief Get the current over sampling ratio of the QMC5883L magnetometer from the shadow copy
+ * @return The current over sampling ratio, as a QMC5883L_Oversampling enum value
+ */
+QMC5883L_Oversampling MultiCompassQMC5883L::getOversampling()
+{
+    return (QMC5883L_Oversampling)((control1 >> 6) & 0b00000011);
+}
+
+/**
+ * @brief Set the whole configuration of the QMC5883L magnetometer with a single transaction
+ * @param oversampling The desired over sampling ratio
+ * @param samplerate The desired output data rate
+ * @param range The desired field range
+ * @param mode The desired operating mode
+ * @return true if the configuration was written, false otherwise
+ */
+bool MultiCompassQMC5883L::setConfig(QMC5883L_Oversampling oversampling, QMC5883L_OutputRate samplerate, QMC5883L_FieldRange range, QMC5883L_Mode mode)
+{
+    control1 = (oversampling << 6) | (range << 4) | (samplerate << 2) | mode;
+    updateRawScale();
+    return applyConfig();
+}
+
+/**
+ * @brief Check whether stored configuration bytes belong to the QMC5883L, without applying them
+ * @param buffer Pointer to the configuration bytes
+ * @param length The number of configuration bytes
+ * @return true if there are QMC5883L_CONFIG_BYTES bytes with a valid calibration range, false otherwise
+ */
+bool MultiCompassQMC5883L::checkConfigBytes(const uint8_t *buffer, uint8_t length)
+{
+    return length == QMC5883L_CONFIG_BYTES && buffer[2] <= QMC5883L_FIELDRANGE_8GA;
+}
+
+/**
+ * @brief Write the shadow copies of CONTROL_1 and CONTROL_2 in a single transaction
+ * @return true if the registers were written, false otherwise
+ */
+bool MultiCompassQMC5883L::applyConfig()
+{
+    // Both registers are consecutive and the register pointer increments after each byte
+    const uint8_t buffer[2] = {control1, control2};
+    return writeBytes(QMC5883L_REGISTER_CONTROL_1, buffer, 2);
+}
+
+/**
+ * @brief Refresh the shadow copies of CONTROL_1 and CONTROL_2 from the module in a single transaction
+ * @return true if the registers were read, false otherwise
+ */
+bool MultiCompassQMC5883L::loadConfig()
+{
+    uint8_t buffer[2];
+    if (!readBytes(QMC5883L_REGISTER_CONTROL_1, buffer, 2))
+    {
+        return false;
+    }
+    control1 = buffer[0];
+    // The reset bit always reads as zero, it is not part of the configuration
+    control2 = buffer[1] & ~QMC5883L_CONTROL_2_SOFT_RST;
+    updateRawScale();
+    return true;
+}
+
+/**
+ * @brief Get the configuration that is stored with the calibration
+ * @param buffer Pointer to the buffer for CONTROL_1, CONTROL_2 and the calibration range
+ * @param length The size of the buffer
+ * @return The number of configuration bytes, 0 if the buffer is too small
+ */
+uint8_t MultiCompassQMC5883L::getConfigBytes(uint8_t *buffer, uint8_t length)
+{
+    if (length < QMC5883L_CONFIG_BYTES)
+    {
+        return 0;
+    }
+    buffer[0] = control1;
+    buffer[1] = control2;
+    buffer[2] = calibrationRange;
+    return QMC5883L_CONFIG_BYTES;
+}
+
+/**
+ * @brief Restore the configuration that was stored with the calibration and write it to the module
+ * @param buffer Pointer to the configuration bytes
+ * @param length The number of configuration bytes
+ * @return true if the configuration was written, false otherwise
+ */
+bool MultiCompassQMC5883L::setConfigBytes(const uint8_t *buffer, uint8_t length)
+{
+    if (!checkConfigBytes(buffer, length))
+    {
+        return false;
+    }
+    control1 = buffer[0];
+    control2 = buffer[1] & ~QMC5883L_CONTROL_2_SOFT_RST;
+    calibrationRange = (QMC5883L_FieldRange)(buffer[2] & 0b11);
+    updateRawScale();
+    return applyConfig();
+}
+
+/**
+ * @brief Read one raw sample and the status register of the QMC5883L magnetometer in a single burst transaction
+ * @param sample Pointer to a CompassRawSample struct to store the raw magnetic field data
+ * @return true if the output registers were read, false otherwise
+ */
+bool MultiCompassQMC5883L::readRawSample(CompassRawSample *sample)
+{
+    uint8_t buffer[QMC5883L_DATA_LENGTH + 1];
+    // The status register directly follows OUT_Z_M, so it is part of the same burst
+    if (!readBytes(QMC5883L_REGISTER_OUT_X_L, buffer, QMC5883L_DATA_LENGTH + 1))
+    {
+        return false;
+    }
+    if (buffer[QMC5883L_DATA_LENGTH] & QMC5883L_STATUS_OVL)
+    {
+        // Mark the sample, so the overflow survives the data ready buffer
+        sample->x = QMC5883L_OVERFLOW;
+        sample->y = QMC5883L_OVERFLOW;
+        sample->z = QMC5883L_OVERFLOW;
+        return true;
+    }
+    // Unlike the HMC5883L the axes are little endian and in X, Y, Z order
+    sample->x = (int16_t)(buffer[1] << 8 | buffer[0]);
+    sample->y = (int16_t)(buffer[3] << 8 | buffer[2]);
+    sample->z = (int16_t)(buffer[5] << 8 | buffer[4]);
+    return true;
+}
+
+/**
+ * @brief Flag samples of the QMC5883L magnetometer that were out of range
+ * @param data Pointer to a CompassData struct containing the raw magnetic field data
+ */
+void MultiCompassQMC5883L::checkSample(CompassData *data)
+{
+    if (data->rawX == QMC5883L_OVERFLOW && data->rawY == QMC5883L_OVERFLOW && data->rawZ == QMC5883L_OVERFLOW)
+    {
+        data->flags |= COMPASS_FLAG_OVERFLOW;
+    }
+}
+
+/**
+ * @brief Get the gain of a field range of the QMC5883L magnetometer
+ * @param range The field range
+ * @return The gain in LSB per gauss
+ */
+uint16_t MultiCompassQMC5883L::getGain(QMC5883L_FieldRange range)
+{
+    return range == QMC5883L_FIELDRANGE_8GA ? 3000 : 12000;
+}
+
+/**
+ * @brief Update rawScale and the coefficients after the field range changed
+ */
+void MultiCompassQMC5883L::updateRawScale()
+{
+#if defined(MULTICOMPASS_NO_FLOAT)
+    uint16_t scale = ((uint32_t)getGain(calibrationRange) << 12) / getGain(getFieldRange());
+#else
+    float scale = (float)getGain(calibrationRange) / getGain(getFieldRange());
+#endif
+    setRawScale(scale, scale, scale);
+}
@@ -0,0 +1,193 @@
+/*
+ *   Copyright (c) 2023 Malte Hering
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "MultiCompassStm32Transport.h"
+#include "MultiCompass.h"
+
+#if defined(HAL_I2C_MODULE_ENABLED)
+
+/**
+ * @brief Create a transport for an I2C handle.
+ * @param handle The initialized I2C handle.
+ */
+MultiCompassStm32Transport::MultiCompassStm32Transport(I2C_HandleTypeDef *handle)
+{
+    this->handle = handle;
+}
+
+/**
+ * @brief Write the register pointer and a block of data in one transaction.
+ * @param address The I2C address of the sensor.
+ * @param reg The first register.
+ * @param buffer A pointer to the data.
+ * @param length The number of data bytes.
+ * @param timeout The timeout in microseconds, rounded up to the milliseconds of the HAL.
+ * @return The status of the transaction.
+ */
+CompassStatus MultiCompassStm32Transport::write(uint8_t address, uint8_t reg, const uint8_t *buffer, uint8_t length, uint32_t timeout)
+{
+    // The writes are a few bytes of configuration, so they do not need the DMA.
+    uint32_t milliseconds = (timeout + 999) / 1000;
+    if (length == 0)
+    {
+        return status(HAL_I2C_Master_Transmit(handle, address << 1, &reg, 1, milliseconds));
+    }
+    return status(HAL_I2C_Mem_Write(handle, address << 1, reg, I2C_MEMADD_SIZE_8BIT, (uint8_t *)buffer, length, milliseconds));
+}
+
+/**
+ * @brief Start reading bytes from the current register pointer, with the DMA if one is linked.
+ * @param address The I2C address of the sensor.
+ * @param length The number of bytes.
+ * @param timeout The timeout in microseconds, rounded up to the milliseconds of the HAL.
+ */
+void MultiCompassStm32Transport::request(uint8_t address, uint8_t length, uint32_t timeout)
+{
+    length = min(length, (uint8_t)MULTICOMPASS_TRANSPORT_BUFFER);
+    rxIndex = 0;
+    rxLength = 0;
+    pendingLength = 0;
+    if (handle->hdmarx != NULL)
+    {
+        // The bytes become available once the DMA is done, see available().
+        invalidateDmaBuffer();
+        if (HAL_I2C_Master_Receive_DMA(handle, address << 1, dmaBuffer, length) == HAL_OK)
+        {
+            pendingLength = length;
+            pendingAddress = address;
+        }
+        return;
+    }
+    if (HAL_I2C_Master_Receive(handle, address << 1, rxBuffer, length, (timeout + 999) / 1000) == HAL_OK)
+    {
+        rxLength = length;
+    }
+}
+
+/**
+ * @brief Abort the running DMA receive of request() after a timeout.
+ * Otherwise the handle stays busy and every following transfer fails with HAL_BUSY.
+ */
+void MultiCompassStm32Transport::abort()
+{
+    if (pendingLength > 0)
+    {
+        HAL_I2C_Master_Abort_IT(handle, pendingAddress << 1);
+        pendingLength = 0;
+    }
+}
+
+/**
+ * @brief Get the identity of the bus.
+ * @return The I2C handle, shared by all sensors of the peripheral.
+ */
+const void *MultiCompassStm32Transport::getBus()
+{
+    return handle;
+}
+
+/**
+ * @brief Get the number of received bytes, 0 while the DMA receive is running.
+ * @return The number of bytes.
+ */
+int MultiCompassStm32Transport::available()
+{
+    if (pendingLength > 0 && HAL_I2C_GetState(handle) == HAL_I2C_STATE_READY)
+    {
+        // A failed receive keeps the buffer empty, so the caller runs into its timeout.
+        rxLength = HAL_I2C_GetError(handle) == HAL_I2C_ERROR_NONE ? pendingLength : 0;
+        pendingLength = 0;
+        invalidateDmaBuffer();
+        memcpy(rxBuffer, dmaBuffer, rxLength);
+    }
+    return MultiCompassBufferedTransport::available();
+}
+
+/**
+ * @brief Read consecutive registers in one transaction with a repeated start, with the DMA if one is linked.
+ * @param address The I2C address of the sensor.
+ * @param reg The first register.
+ * @param buffer A pointer to the buffer where the bytes will be stored.
+ * @param length The number of bytes.
+ * @param timeout The timeout in microseconds.
+ * @return The status of the transfer.
+ */
+CompassStatus MultiCompassStm32Transport::readRegisters(uint8_t address, uint8_t reg, uint8_t *buffer, uint8_t length, uint32_t timeout)
+{
+    if (handle->hdmarx == NULL || length > sizeof(dmaBuffer))
+    {
+        return status(HAL_I2C_Mem_Read(handle, address << 1, reg, I2C_MEMADD_SIZE_8BIT, buffer, length, (timeout + 999) / 1000));
+    }
+
+    unsigned long start = micros();
+    // A dirty line written back during the transfer would overwrite the received bytes.
+    invalidateDmaBuffer();
+    CompassStatus result = status(HAL_I2C_Mem_Read_DMA(handle, address << 1, reg, I2C_MEMADD_SIZE_8BIT, dmaBuffer, length));
+    if (result != COMPASS_OK)
+    {
+        return result;
+    }
+    // The CPU only waits for the end of the transfer, the bytes are moved by the DMA.
+    while (HAL_I2C_GetState(handle) != HAL_I2C_STATE_READY)
+    {
+        if (micros() - start > timeout)
+        {
+            // Free the peripheral for the next transfer, a stuck bus is then left to recoverBus().
+            HAL_I2C_Master_Abort_IT(handle, address << 1);
+            return COMPASS_ERROR_TIMEOUT;
+        }
+    }
+    if (HAL_I2C_GetError(handle) != HAL_I2C_ERROR_NONE)
+    {
+        return status(HAL_ERROR);
+    }
+    // Lines fetched by speculative reads during the transfer would still hold the old bytes.
+    invalidateDmaBuffer();
+    memcpy(buffer, dmaBuffer, length);
+    return COMPASS_OK;
+}
+
+/**
+ * @brief Discard the cached lines of the DMA buffer. Parts without a D-cache read the memory directly.
+ */
+void MultiCompassStm32Transport::invalidateDmaBuffer()
+{
+#if defined(__DCACHE_PRESENT) && (__DCACHE_PRESENT == 1U)
+    SCB_InvalidateDCache_by_Addr((uint32_t *)dmaBuffer, sizeof(dmaBuffer));
+#endif
+}
+
+/**
+ * @brief Convert the result of a HAL function to a CompassStatus.
+ * @param result The value returned by the HAL.
+ * @return The matching CompassStatus.
+ */
+CompassStatus MultiCompassStm32Transport::status(HAL_StatusTypeDef result)
+{
+    switch (result)
+    {
+    case HAL_OK:
+        return COMPASS_OK;
+    case HAL_TIMEOUT:
+        return COMPASS_ERROR_TIMEOUT;
+    default:
+        // The acknowledge failure flag tells a missing sensor from other errors.
+        return (HAL_I2C_GetError(handle) & HAL_I2C_ERROR_AF) ? COMPASS_ERROR_NACK : COMPASS_ERROR_BUS;
+    }
+}
+
+#endif
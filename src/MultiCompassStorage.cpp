@@ -0,0 +1,114 @@
+/*
+ *   Copyright (c) 2023 Malte Hering
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "MultiCompassStorage.h"
+
+#if defined(ARDUINO_ARCH_ESP32)
+/**
+ * @brief Create a storage for one key of the non-volatile storage.
+ * @param name The namespace, at most 15 characters.
+ * @param key The key of the blob, at most 15 characters.
+ */
+MultiCompassPreferencesStorage::MultiCompassPreferencesStorage(const char *name, const char *key)
+{
+    this->name = name;
+    this->key = key;
+}
+
+/**
+ * @brief Read the blob from the non-volatile storage.
+ * @param buffer A pointer to the buffer where the blob will be stored.
+ * @param length The size of the buffer.
+ * @return The number of bytes read, 0 if nothing is stored.
+ */
+size_t MultiCompassPreferencesStorage::read(uint8_t *buffer, size_t length)
+{
+    Preferences preferences;
+    if (!preferences.begin(name, true))
+    {
+        return 0;
+    }
+    size_t count = preferences.getBytes(key, buffer, length);
+    preferences.end();
+    return count;
+}
+
+/**
+ * @brief Write the blob to the non-volatile storage.
+ * @param buffer A pointer to the blob.
+ * @param length The length of the blob.
+ * @return true if the blob was stored, false otherwise.
+ */
+bool MultiCompassPreferencesStorage::write(const uint8_t *buffer, size_t length)
+{
+    Preferences preferences;
+    if (!preferences.begin(name, false))
+    {
+        return false;
+    }
+    size_t count = preferences.putBytes(key, buffer, length);
+    preferences.end();
+    return count == length;
+}
+#elif defined(__AVR__)
+/**
+ * @brief Create a storage at a fixed EEPROM address.
+ * @param address The first EEPROM address of the blob.
+ */
+MultiCompassEEPROMStorage::MultiCompassEEPROMStorage(int address)
+{
+    this->address = address;
+}
+
+/**
+ * @brief Read the blob from the EEPROM. The blob validates itself, so the whole buffer is read.
+ * @param buffer A pointer to the buffer where the blob will be stored.
+ * @param length The size of the buffer.
+ * @return The number of bytes read.
+ */
+size_t MultiCompassEEPROMStorage::read(uint8_t *buffer, size_t length)
+{
+    if (address < 0 || address + length > EEPROM.length())
+    {
+        return 0;
+    }
+    for (size_t i = 0; i < length; i++)
+    {
+        buffer[i] = EEPROM.read(address + i);
+    }
+    return length;
+}
+
+/**
+ * @brief Write the blob to the EEPROM. Unchanged bytes are not written again to save erase cycles.
+ * @param buffer A pointer to the blob.
+ * @param length The length of the blob.
+ * @return true if the blob was stored, false otherwise.
+ */
+bool MultiCompassEEPROMStorage::write(const uint8_t *buffer, size_t length)
+{
+    if (address < 0 || address + length > EEPROM.length())
+    {
+        return false;
+    }
+    for (size_t i = 0; i < length; i++)
+    {
+        EEPROM.update(address + i, buffer[i]);
+    }
+    return true;
+}
+#endif
@@ -0,0 +1,214 @@
+/*
+ *   Copyright (c) 2023 Malte Hering
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "MultiCompassStream.h"
+
+static_assert(MULTICOMPASS_STREAM_PAYLOAD <= 254, "A frame has to fit into a single COBS block");
+
+// Little endian helpers, the frame has the same byte order on every target.
+static void putUint16(uint8_t *buffer, uint16_t value)
+{
+    buffer[0] = value;
+    buffer[1] = value >> 8;
+}
+
+static void putUint32(uint8_t *buffer, uint32_t value)
+{
+    putUint16(buffer, value);
+    putUint16(buffer + 2, value >> 16);
+}
+
+/**
+ * @brief Create a stream for one sensor.
+ * @param output A pointer to the Print the frames are written to.
+ * @param sensor The number of the sensor in the frame header.
+ */
+MultiCompassStream::MultiCompassStream(Print *output, uint8_t sensor)
+{
+    this->output = output;
+    this->sensor = sensor;
+}
+
+/**
+ * @brief Add a sample to the current frame and write the frame once it is full.
+ * The current frame is also written before a sample that follows more than 65535 microseconds after the last one.
+ * @param data A pointer to a CompassData object containing the raw sensor data.
+ * @return true if the sample was added, false if writing the previous frame failed.
+ */
+bool MultiCompassStream::write(const CompassData *data)
+{
+    // A delta that does not fit into a record would shift every later timestamp, a new frame carries it in full.
+    if (count > 0 && data->timestamp - lastTimestamp > 0xFFFF && !flush())
+    {
+        return false;
+    }
+
+    if (count == 0)
+    {
+        // The header carries the full timestamp and sequence number, the records only the differences.
+        payload[0] = MULTICOMPASS_STREAM_VERSION;
+        payload[1] = sensor;
+        putUint32(&payload[3], data->timestamp);
+        putUint32(&payload[7], data->sequence);
+        lastTimestamp = data->timestamp;
+    }
+
+    CompassPackedSample record;
+    pack(data, lastTimestamp, &record);
+    lastTimestamp = data->timestamp;
+
+    uint8_t *buffer = &payload[MULTICOMPASS_STREAM_HEADER + count * MULTICOMPASS_RECORD_SIZE];
+    putUint16(&buffer[0], record.x);
+    putUint16(&buffer[2], record.y);
+    putUint16(&buffer[4], record.z);
+    putUint16(&buffer[6], record.delta);
+    buffer[8] = record.flags;
+    buffer[9] = record.sequence;
+    count++;
+
+    if (count == MULTICOMPASS_STREAM_BATCH)
+    {
+        return flush();
+    }
+    return true;
+}
+
+/**
+ * @brief Add an array of samples.
+ * @param data A pointer to an array of CompassData objects containing the raw sensor data.
+ * @param count The number of samples.
+ * @return The number of samples added.
+ */
+size_t MultiCompassStream::write(const CompassData *data, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!write(&data[i]))
+        {
+            return i;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Drain the data ready buffer of a sensor into the stream.
+ * @param compass A pointer to the sensor.
+ * @return The number of samples added.
+ */
+size_t MultiCompassStream::drain(MultiCompass *compass)
+{
+    CompassData data[MULTICOMPASS_STREAM_BATCH];
+    size_t total = 0;
+    // Only fetch what fits into the current frame, so a sample is never held back in the local array.
+    size_t acquired;
+    while ((acquired = compass->getDataBatch(data, MULTICOMPASS_STREAM_BATCH - count)) > 0)
+    {
+        size_t added = write(data, acquired);
+        total += added;
+        if (added < acquired || compass->availableSamples() == 0)
+        {
+            break;
+        }
+    }
+    return total;
+}
+
+/**
+ * @brief Write the current frame: COBS encoded header, records and CRC, followed by the 0x00 delimiter.
+ * @return true if the frame was written or was empty, false otherwise.
+ */
+bool MultiCompassStream::flush()
+{
+    if (count == 0)
+    {
+        return true;
+    }
+    payload[2] = count;
+    size_t length = MULTICOMPASS_STREAM_HEADER + count * MULTICOMPASS_RECORD_SIZE;
+    putUint16(&payload[length], MultiCompass::crc16(payload, length));
+    length += 2;
+    count = 0;
+
+    uint8_t frame[MULTICOMPASS_STREAM_PAYLOAD + 3];
+    size_t encoded = 0;
+    if (frames == 0)
+    {
+        // Separate the first frame from anything the receiver saw before, e.g. boot messages.
+        frame[encoded++] = 0;
+    }
+    encoded += encodeCobs(payload, length, &frame[encoded]);
+    frame[encoded++] = 0;
+    // One write lets the serial driver copy the whole frame at once.
+    if (output->write(frame, encoded) != encoded)
+    {
+        dropped++;
+        return false;
+    }
+    frames++;
+    return true;
+}
+
+/**
+ * @brief Pack a sample into a record.
+ * @param data A pointer to a CompassData object containing the raw sensor data.
+ * @param previous The timestamp of the previous record in microseconds.
+ * @param record A pointer to a CompassPackedSample object where the record will be stored.
+ */
+void MultiCompassStream::pack(const CompassData *data, uint32_t previous, CompassPackedSample *record)
+{
+    // The raw values are integers of the sensor, CompassData holds them exactly in every layout.
+    record->x = (int16_t)data->rawX;
+    record->y = (int16_t)data->rawY;
+    record->z = (int16_t)data->rawZ;
+    uint32_t delta = data->timestamp - previous;
+    record->flags = data->flags & ~COMPASS_RECORD_DELTA_SATURATED;
+    if (delta > 0xFFFF)
+    {
+        delta = 0xFFFF;
+        record->flags |= COMPASS_RECORD_DELTA_SATURATED;
+    }
+    record->delta = delta;
+    record->sequence = data->sequence;
+}
+
+/**
+ * @brief Encode a block with COBS: every 0x00 is replaced by the distance to the next one.
+ * @param input A pointer to the data.
+ * @param length The length of the data, at most 254 bytes.
+ * @param output A pointer to the buffer, with space for length + 1 bytes.
+ * @return The length of the encoded data.
+ */
+size_t MultiCompassStream::encodeCobs(const uint8_t *input, size_t length, uint8_t *output)
+{
+    size_t code = 0;
+    size_t position = 1;
+    for (size_t i = 0; i < length; i++)
+    {
+        if (input[i] == 0)
+        {
+            output[code] = position - code;
+            code = position++;
+        }
+        else
+        {
+            output[position++] = input[i];
+        }
+    }
+    output[code] = position - code;
+    return position;
+}
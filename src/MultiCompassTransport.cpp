@@ -0,0 +1,96 @@
+/*
+ *   Copyright (c) 2023 Malte Hering
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "MultiCompassTransport.h"
+
+/**
+ * @brief Read consecutive registers with the register pointer, a request and the collected bytes.
+ * @param address The I2C address of the sensor.
+ * @param reg The first register.
+ * @param buffer A pointer to the buffer where the bytes will be stored.
+ * @param length The number of bytes.
+ * @param timeout The timeout in microseconds.
+ * @return The status of the transfer.
+ */
+CompassStatus MultiCompassTransport::readRegisters(uint8_t address, uint8_t reg, uint8_t *buffer, uint8_t length, uint32_t timeout)
+{
+    unsigned long start = micros();
+    // Send only the first register address to read from.
+    CompassStatus status = write(address, reg, NULL, 0, timeout);
+    if (status != COMPASS_OK)
+    {
+        return status;
+    }
+
+    // Request all bytes at once, the sensor increments its register pointer after every byte.
+    request(address, length, timeout);
+    do
+    {
+        status = collect(buffer, length, start, timeout);
+    } while (status == COMPASS_BUSY);
+    return status;
+}
+
+/**
+ * @brief Copy the requested bytes once all of them arrived.
+ * @param buffer A pointer to the buffer where the bytes will be stored.
+ * @param length The number of requested bytes.
+ * @param start The time in microseconds the transfer was started.
+ * @param timeout The timeout in microseconds.
+ * @return COMPASS_OK when the bytes were copied, COMPASS_BUSY while waiting, COMPASS_ERROR_TIMEOUT after the timeout.
+ * A timed out request is aborted.
+ */
+CompassStatus MultiCompassTransport::collect(uint8_t *buffer, uint8_t length, unsigned long start, uint32_t timeout)
+{
+    if (available() < length)
+    {
+        if (micros() - start > timeout)
+        {
+            // Stop a transfer that is still running, then drop incomplete data so it does not leak into the next one.
+            abort();
+            while (available() > 0)
+            {
+                read();
+            }
+            return COMPASS_ERROR_TIMEOUT;
+        }
+        return COMPASS_BUSY;
+    }
+    for (uint8_t i = 0; i < length; i++)
+    {
+        buffer[i] = read();
+    }
+    return COMPASS_OK;
+}
+
+/**
+ * @brief Get the number of received bytes that were not read yet.
+ * @return The number of bytes.
+ */
+int MultiCompassBufferedTransport::available()
+{
+    return rxLength - rxIndex;
+}
+
+/**
+ * @brief Read the next received byte.
+ * @return The byte, -1 if none is available.
+ */
+int MultiCompassBufferedTransport::read()
+{
+    return rxIndex < rxLength ? rxBuffer[rxIndex++] : -1;
+}
@@ -0,0 +1,135 @@
+#!/usr/bin/env python3
+#   Copyright (c) 2023 Malte Hering
+#   All rights reserved.
+#
+#   Licensed under the Apache License, Version 2.0 (the "License");
+#   you may not use this file except in compliance with the License.
+#   You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+#   Unless required by applicable law or agreed to in writing, software
+#   distributed under the License is distributed on an "AS IS" BASIS,
+#   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#   See the License for the specific language governing permissions and
+#   limitations under the License.
+
+"""Decode the binary stream of MultiCompassStream into CSV.
+
+Reads a capture file, stdin or, with pyserial installed, a serial port:
+
+    python3 multicompass_decode.py capture.bin > samples.csv
+    python3 multicompass_decode.py --port /dev/ttyUSB0 --baud 115200
+"""
+
+import argparse
+import struct
+import sys
+
+STREAM_VERSION = 1
+HEADER = struct.Struct("<BBBII")   # version, sensor, count, timestamp, sequence
+RECORD = struct.Struct("<hhhHBB")  # x, y, z, delta, flags, sequence
+DELTA_SATURATED = 0x80
+
+
+def crc16(data, crc=0xFFFF):
+    """CRC-16/CCITT-FALSE, the same as MultiCompass::crc16."""
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+            crc &= 0xFFFF
+    return crc
+
+
+def decode_cobs(data):
+    """Reverse MultiCompassStream::encodeCobs, returns None for a damaged block."""
+    output = bytearray()
+    index = 0
+    while index < len(data):
+        code = data[index]
+        if code == 0 or index + code > len(data):
+            return None
+        output += data[index + 1:index + code]
+        index += code
+        if index < len(data):
+            output.append(0)
+    return bytes(output)
+
+
+def decode_frame(block):
+    """Decode one frame into (sensor, sequence, timestamp, x, y, z, flags) rows, None if it is damaged."""
+    payload = decode_cobs(block)
+    if payload is None or len(payload) < HEADER.size + 2:
+        return None
+    body, crc = payload[:-2], struct.unpack("<H", payload[-2:])[0]
+    if crc16(body) != crc:
+        return None
+    version, sensor, count, timestamp, sequence = HEADER.unpack_from(body)
+    if version != STREAM_VERSION or len(body) != HEADER.size + count * RECORD.size:
+        return None
+
+    rows = []
+    for i in range(count):
+        x, y, z, delta, flags, low = RECORD.unpack_from(body, HEADER.size + i * RECORD.size)
+        if i > 0:
+            # The records carry the low byte of the sequence, the difference also counts lost samples.
+            sequence = (sequence + ((low - sequence) & 0xFF)) & 0xFFFFFFFF
+            timestamp = (timestamp + delta) & 0xFFFFFFFF
+        rows.append((sensor, sequence, timestamp, x, y, z, flags))
+    return rows
+
+
+def blocks(source):
+    """Split a byte source into the blocks between 0x00 delimiters."""
+    pending = bytearray()
+    while True:
+        chunk = source.read(256)
+        if not chunk:
+            break
+        pending += chunk
+        while True:
+            end = pending.find(0)
+            if end < 0:
+                break
+            yield bytes(pending[:end])
+            del pending[:end + 1]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("file", nargs="?", help="capture file, stdin if omitted")
+    parser.add_argument("--port", help="serial port, needs pyserial")
+    parser.add_argument("--baud", type=int, default=115200, help="baud rate of the serial port")
+    arguments = parser.parse_args()
+
+    if arguments.port:
+        import serial
+        source = serial.Serial(arguments.port, arguments.baud)
+    elif arguments.file:
+        source = open(arguments.file, "rb")
+    else:
+        source = sys.stdin.buffer
+
+    damaged = 0
+    print("sensor,sequence,timestamp_us,x,y,z,flags")
+    try:
+        # The first block may start in the middle of a frame, its CRC rejects it.
+        for block in blocks(source):
+            if not block:
+                # Two delimiters in a row, e.g. the one flush() writes before the first frame.
+                continue
+            rows = decode_frame(block)
+            if rows is None:
+                damaged += 1
+                continue
+            for row in rows:
+                print(",".join(str(value) for value in row))
+    except KeyboardInterrupt:
+        pass
+    if damaged:
+        print("%d damaged frames skipped" % damaged, file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()